@@ -0,0 +1,103 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <QString>
+#include <QList>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QRegularExpression>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <functional>
+
+/**
+ * @brief Minimal benchmark harness for passwordmanager_bench
+ *
+ * Every benchmark is a name, a set of parameters (payload size, entry count, ...)
+ * and a body that is timed once per iteration. Results are collected as JSON so
+ * runs can be compared between releases.
+ */
+class BenchRunner
+{
+public:
+  struct Options
+  {
+    QRegularExpression filter;    // Only run benchmarks whose name matches
+    qint64 maxEntries = 100000;   // Largest vault size for the vault benchmarks
+    double iterationScale = 1.0;  // Multiplies every iteration count
+  };
+
+  explicit BenchRunner(const Options &options) : m_options(options) {}
+
+  const Options &options() const { return m_options; }
+
+  bool isEnabled(const QString &name) const
+  {
+    return !m_options.filter.isValid() || m_options.filter.pattern().isEmpty() ||
+           m_options.filter.match(name).hasMatch();
+  }
+
+  /**
+   * @brief Time body once per iteration and record the result
+   * @param name Benchmark name, e.g. "crypto/encrypt"
+   * @param params Parameters of this run, stored with the result
+   * @param iterations Number of timed calls before scaling, at least one is run
+   * @param body Called with the iteration index
+   * @param bytesPerIteration Bytes processed per call, adds a throughput figure if non-zero
+   */
+  void run(const QString &name, const QJsonObject &params, int iterations,
+           const std::function<void(int)> &body, qint64 bytesPerIteration = 0)
+  {
+    if (!isEnabled(name))
+    {
+      return;
+    }
+
+    iterations = std::max(1, static_cast<int>(iterations * m_options.iterationScale));
+    QList<qint64> samples;
+    samples.reserve(iterations);
+
+    QElapsedTimer timer;
+    for (int i = 0; i < iterations; ++i)
+    {
+      timer.start();
+      body(i);
+      samples.append(timer.nsecsElapsed());
+    }
+
+    std::sort(samples.begin(), samples.end());
+    qint64 total = 0;
+    for (qint64 sample : samples)
+    {
+      total += sample;
+    }
+
+    QJsonObject result;
+    result["name"] = name;
+    result["params"] = params;
+    result["iterations"] = iterations;
+    result["mean_ns"] = static_cast<double>(total) / iterations;
+    result["median_ns"] = static_cast<double>(samples[iterations / 2]);
+    result["min_ns"] = static_cast<double>(samples.first());
+    result["max_ns"] = static_cast<double>(samples.last());
+    if (bytesPerIteration > 0 && total > 0)
+    {
+      result["bytes_per_second"] = static_cast<double>(bytesPerIteration) * iterations * 1e9 / total;
+    }
+    m_results.append(result);
+  }
+
+  QJsonArray results() const { return m_results; }
+
+private:
+  Options m_options;
+  QJsonArray m_results;
+};
+
+// One function per layer, each registers its benchmarks with the runner
+void runCryptoBenchmarks(BenchRunner &runner);
+void runEntryBenchmarks(BenchRunner &runner);
+void runFileBenchmarks(BenchRunner &runner);
+void runVaultBenchmarks(BenchRunner &runner);
+
+#endif // BENCH_H
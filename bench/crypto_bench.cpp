@@ -0,0 +1,96 @@
+#include "bench.h"
+#include "../src/crypto/cryptoutils.h"
+#include "../src/utils/fileutils.h"
+
+#include <QBuffer>
+#include <sodium.h>
+
+namespace
+{
+  const QList<qint64> PAYLOAD_SIZES = {64, 4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+
+  // Fewer iterations for large payloads keep every size at a similar runtime
+  int iterationsFor(qint64 size)
+  {
+    return static_cast<int>(std::clamp<qint64>(64 * 1024 * 1024 / (size * 16), 5, 20000));
+  }
+
+  QByteArray randomPayload(qint64 size)
+  {
+    QByteArray payload(size, Qt::Uninitialized);
+    randombytes_buf(payload.data(), payload.size());
+    return payload;
+  }
+}
+
+void runCryptoBenchmarks(BenchRunner &runner)
+{
+  const QByteArray salt = FileUtils::generateSalt();
+  runner.run("crypto/deriveKeyFromPassword", {}, 5,
+             [&](int)
+             { CryptoUtils::deriveKeyFromPassword("bench-master-password", salt); });
+
+  runner.run("crypto/calibrateKdf", {}, 1,
+             [&](int)
+             { CryptoUtils::calibrateKdf(); });
+
+  const SecureMemory::Buffer key = CryptoUtils::deriveKeyFromPassword("bench-master-password", salt);
+  runner.run("crypto/deriveSubkey", {}, 100000,
+             [&](int i)
+             { CryptoUtils::deriveSubkey(key, static_cast<quint64>(i), "pmentry_"); });
+
+  // Key-sized buffers from the locked arena against the general allocator
+  runner.run("crypto/secureBuffer/arena", {}, 100000,
+             [&](int)
+             { SecureMemory::Buffer buffer(key.view()); });
+  runner.run("crypto/secureBuffer/heap", {}, 100000,
+             [&](int)
+             {
+               QByteArray buffer = key.view().toByteArray();
+               sodium_memzero(buffer.data(), buffer.size());
+             });
+
+  for (qint64 size : PAYLOAD_SIZES)
+  {
+    const QJsonObject params{{"payload_bytes", size}};
+    QByteArray payload = randomPayload(size);
+
+    QByteArray nonce, ciphertext;
+    runner.run("crypto/encrypt", params, iterationsFor(size),
+               [&](int)
+               { CryptoUtils::encrypt(payload, key, ciphertext, nonce); },
+               size);
+
+    CryptoUtils::encrypt(payload, key, ciphertext, nonce);
+    QByteArray plain;
+    runner.run("crypto/decrypt", params, iterationsFor(size),
+               [&](int)
+               { CryptoUtils::decrypt(ciphertext, key, nonce, plain); },
+               size);
+
+    QByteArray stream;
+    runner.run("crypto/encryptStream", params, iterationsFor(size),
+               [&](int)
+               {
+                 QBuffer source(&payload);
+                 source.open(QIODevice::ReadOnly);
+                 stream.clear();
+                 QBuffer target(&stream);
+                 target.open(QIODevice::WriteOnly);
+                 CryptoUtils::encryptStream(source, payload.size(), target, key);
+               },
+               size);
+
+    runner.run("crypto/decryptStream", params, iterationsFor(size),
+               [&](int)
+               {
+                 QBuffer source(&stream);
+                 source.open(QIODevice::ReadOnly);
+                 plain.clear();
+                 QBuffer target(&plain);
+                 target.open(QIODevice::WriteOnly);
+                 CryptoUtils::decryptStream(source, stream.size(), target, key);
+               },
+               size);
+  }
+}
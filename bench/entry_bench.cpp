@@ -0,0 +1,75 @@
+#include "bench.h"
+#include "../src/vault/vaultentry.h"
+#include "../src/crypto/cryptoutils.h"
+#include "../src/utils/fileutils.h"
+
+namespace
+{
+  // Builds an entry in the legacy V1 format: individual_salt + nonce + ciphertext,
+  // key = Argon2(masterKey, individual_salt). Mirrors the pre-V2 encryptPassword.
+  VaultEntry makeV1Entry(QByteArrayView masterKey, const QString &password)
+  {
+    QByteArray individualSalt = FileUtils::generateSalt();
+    SecureMemory::Buffer derivedKey = CryptoUtils::deriveKeyFromPassword(QString::fromUtf8(masterKey), individualSalt);
+
+    QByteArray nonce, ciphertext;
+    CryptoUtils::encrypt(password.toUtf8(), derivedKey, ciphertext, nonce);
+
+    VaultEntry entry;
+    entry.id = VaultEntry::generateId();
+    entry.username = "bench";
+    entry.encryptedPassword = individualSalt + nonce + ciphertext;
+    entry.formatVersion = VaultEntry::FormatV1;
+    return entry;
+  }
+}
+
+void runEntryBenchmarks(BenchRunner &runner)
+{
+  const QString password = CryptoUtils::generateRandomPassword();
+  const SecureMemory::Buffer masterKey = CryptoUtils::deriveKeyFromPassword("bench-master-password", FileUtils::generateSalt());
+
+  // Argon2-backed operations are slow, keep the iteration count small
+  const int legacyIterations = 20;
+  const int iterations = 20000;
+
+  // Before: every encrypt and decrypt pays a full password hash
+  VaultEntry v1Entry = makeV1Entry(masterKey, password);
+  runner.run("entry/v1/encryptPassword", {}, legacyIterations,
+             [&](int)
+             { v1Entry = makeV1Entry(masterKey, password); });
+
+  runner.run("entry/v1/decryptPassword", {}, legacyIterations,
+             [&](int)
+             {
+               QString decrypted = v1Entry.decryptPassword(masterKey);
+               decrypted.fill(QChar(0));
+             });
+
+  // After: subkey derivation from the already stretched master key
+  VaultEntry v2Entry;
+  v2Entry.id = VaultEntry::generateId();
+  v2Entry.password = password;
+  v2Entry.encryptPassword(masterKey);
+  runner.run("entry/v2/encryptPassword", {}, iterations,
+             [&](int)
+             {
+               v2Entry.password = password;
+               v2Entry.encryptPassword(masterKey);
+             });
+
+  runner.run("entry/v2/decryptPassword", {}, iterations,
+             [&](int)
+             {
+               QString decrypted = v2Entry.decryptPassword(masterKey);
+               decrypted.fill(QChar(0));
+             });
+
+  // One-time migration cost of a legacy entry (V1 decrypt + V2 encrypt)
+  runner.run("entry/migrate", {}, legacyIterations,
+             [&](int)
+             {
+               VaultEntry entry = v1Entry;
+               entry.migrate(masterKey);
+             });
+}
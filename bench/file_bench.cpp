@@ -0,0 +1,54 @@
+#include "bench.h"
+#include "../src/crypto/cryptoutils.h"
+#include "../src/utils/fileutils.h"
+
+#include <QDebug>
+#include <QTemporaryDir>
+#include <sodium.h>
+
+namespace
+{
+  const QList<qint64> PAYLOAD_SIZES = {4 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+
+  int iterationsFor(qint64 size)
+  {
+    return static_cast<int>(std::clamp<qint64>(256 * 1024 * 1024 / (size * 16), 5, 2000));
+  }
+}
+
+void runFileBenchmarks(BenchRunner &runner)
+{
+  QTemporaryDir dir;
+  if (!dir.isValid())
+  {
+    qWarning() << "Cannot create a temporary directory, skipping file benchmarks";
+    return;
+  }
+
+  const FileUtils::KeyDerivation keyDerivation{FileUtils::generateSalt(), CryptoUtils::KdfParams::interactive()};
+  const SecureMemory::Buffer rootKey = CryptoUtils::deriveKeyFromPassword("bench-master-password", keyDerivation.salt);
+
+  for (qint64 size : PAYLOAD_SIZES)
+  {
+    const QJsonObject params{{"payload_bytes", size}};
+    const QString path = dir.filePath(QString("vault-%1.bin").arg(size));
+
+    QByteArray payload(size, Qt::Uninitialized);
+    randombytes_buf(payload.data(), payload.size());
+    FileUtils::createVault(path, keyDerivation, rootKey, payload);
+
+    runner.run("file/updateVault", params, iterationsFor(size),
+               [&](int)
+               { FileUtils::updateVault(path, rootKey, payload); },
+               size);
+
+    runner.run("file/readVault", params, iterationsFor(size),
+               [&](int)
+               { FileUtils::readVault(path, rootKey); },
+               size);
+
+    runner.run("file/extractSalt", params, 1000,
+               [&](int)
+               { FileUtils::extractSalt(path); });
+  }
+}
@@ -0,0 +1,82 @@
+#include "bench.h"
+#include "../src/utils/metrics.h"
+#include "../src/utils/tracing.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QFile>
+#include <QJsonDocument>
+#include <QSysInfo>
+#include <QThreadPool>
+#include <cstdio>
+#include <sodium.h>
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("passwordmanager_bench");
+
+  if (sodium_init() < 0)
+  {
+    qFatal("libsodium initialization failed!");
+  }
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Benchmarks of the crypto, file and vault layers, reported as JSON");
+  parser.addHelpOption();
+  QCommandLineOption filterOption("filter", "Only run benchmarks whose name matches <regex>.", "regex");
+  QCommandLineOption maxEntriesOption("max-entries", "Largest vault size to benchmark (default 100000).", "count", "100000");
+  QCommandLineOption scaleOption("scale", "Multiply every iteration count by <factor> (default 1).", "factor", "1");
+  QCommandLineOption outputOption({"o", "output"}, "Write the JSON report to <file> instead of stdout.", "file");
+  QCommandLineOption traceOption("trace", "Record tracing spans and write them as Chrome trace JSON to <file>.", "file");
+  QCommandLineOption metricsOption("metrics", "Write the operation latency histograms and counters as JSON to <file>.", "file");
+  parser.addOptions({filterOption, maxEntriesOption, scaleOption, outputOption, traceOption, metricsOption});
+  parser.process(app);
+  Tracing::configure(app.arguments());
+  Metrics::configure(app.arguments());
+
+  BenchRunner::Options options;
+  options.filter = QRegularExpression(parser.value(filterOption));
+  options.maxEntries = parser.value(maxEntriesOption).toLongLong();
+  options.iterationScale = parser.value(scaleOption).toDouble();
+  if (!options.filter.isValid() || options.maxEntries <= 0 || options.iterationScale <= 0)
+  {
+    fprintf(stderr, "Invalid arguments\n");
+    return 1;
+  }
+
+  BenchRunner runner(options);
+  runCryptoBenchmarks(runner);
+  runEntryBenchmarks(runner);
+  runFileBenchmarks(runner);
+  runVaultBenchmarks(runner);
+  Tracing::dump();
+  Metrics::dump();
+
+  QJsonObject report;
+  report["schema"] = 1;
+  report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+  report["qt_version"] = QString::fromLatin1(qVersion());
+  report["sodium_version"] = QString::fromLatin1(sodium_version_string());
+  report["cpu_architecture"] = QSysInfo::currentCpuArchitecture();
+  report["thread_pool_size"] = QThreadPool::globalInstance()->maxThreadCount();
+  report["results"] = runner.results();
+
+  QByteArray json = QJsonDocument(report).toJson();
+  if (parser.isSet(outputOption))
+  {
+    QFile file(parser.value(outputOption));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size())
+    {
+      fprintf(stderr, "Cannot write %s\n", qPrintable(parser.value(outputOption)));
+      return 1;
+    }
+  }
+  else
+  {
+    fwrite(json.constData(), 1, json.size(), stdout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,119 @@
+#include "bench.h"
+#include "../src/vault/vaultmanager.h"
+#include "../src/crypto/cryptoutils.h"
+
+#include <QDebug>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+
+namespace
+{
+  const QList<qint64> ENTRY_COUNTS = {10, 1000, 10000, 100000};
+  const QString MASTER_PASSWORD = "bench-master-password";
+
+  QList<VaultEntry> makeEntries(qint64 count)
+  {
+    QList<VaultEntry> entries;
+    entries.reserve(count);
+    for (qint64 i = 0; i < count; ++i)
+    {
+      entries.append({QString("user%1@example.com").arg(i), CryptoUtils::generateRandomPassword()});
+    }
+    return entries;
+  }
+}
+
+void runVaultBenchmarks(BenchRunner &runner)
+{
+  for (qint64 count : ENTRY_COUNTS)
+  {
+    if (count > runner.options().maxEntries)
+    {
+      continue;
+    }
+
+    QTemporaryDir dir;
+    if (!dir.isValid())
+    {
+      qWarning() << "Cannot create a temporary directory, skipping vault benchmarks";
+      return;
+    }
+
+    const QJsonObject params{{"entries", count}};
+    const QString path = dir.filePath("vault.bin");
+
+    // Populate the vault once, untimed, and leave a full snapshot on disk
+    QList<EntryId> ids;
+    {
+      VaultManager manager;
+      manager.openVault(path, MASTER_PASSWORD);
+      ids = manager.addEntries(makeEntries(count));
+      manager.saveVault();
+      manager.closeVault();
+    }
+
+    // Argon2 dominates small vaults, index decoding and journal replay large ones
+    runner.run("vault/openVault", params, 3,
+               [&](int)
+               {
+                 VaultManager manager;
+                 manager.openVault(path, MASTER_PASSWORD);
+                 manager.closeVault();
+               });
+
+    VaultManager manager;
+    manager.openVault(path, MASTER_PASSWORD);
+
+    // Random ids, so record blocks are read lazily from all over the file
+    runner.run("vault/getPasswordSecure", params, 1000,
+               [&](int)
+               {
+                 EntryId id = ids[QRandomGenerator::global()->bounded(ids.size())];
+                 QString password = manager.getPasswordSecure(id);
+                 password.fill(QChar(0));
+               });
+
+    // Reveal then copy: the second lookup of an entry is a cache hit
+    runner.run("vault/getPasswordSecureRepeated", params, 1000,
+               [&](int i)
+               {
+                 EntryId id = ids[(i / 2) % ids.size()];
+                 QString password = manager.getPasswordSecure(id);
+                 password.fill(QChar(0));
+               });
+
+    // One keystroke per iteration, as if "user4242@exa" was typed over and over
+    const QString typed = "user4242@exa";
+    runner.run("vault/searchEntries", params, 1200,
+               [&](int i)
+               { manager.searchEntries(typed.left(i % typed.size() + 1)); });
+
+    runner.run("vault/addEntry", params, 200,
+               [&](int i)
+               { manager.addEntry({QString("added%1@example.com").arg(i), CryptoUtils::generateRandomPassword()}); });
+
+    // One mutation made durable per iteration, fsync dominates unless relaxed
+    const QList<QPair<QString, FileUtils::Durability>> durabilities = {
+        {"strict", FileUtils::Durability::Strict},
+        {"grouped", FileUtils::Durability::Grouped},
+        {"relaxed", FileUtils::Durability::Relaxed},
+    };
+    for (const auto &[name, durability] : durabilities)
+    {
+      manager.setDurability(durability);
+      runner.run("vault/commit", QJsonObject{{"entries", count}, {"durability", name}}, 50,
+                 [&](int i)
+                 {
+                   manager.addEntry({QString("commit%1@example.com").arg(i), CryptoUtils::generateRandomPassword()});
+                   manager.flushPendingWrites();
+                 });
+    }
+    manager.setDurability(FileUtils::Durability::Grouped);
+
+    runner.run("vault/saveEntries", params, 3,
+               [&](int)
+               { manager.saveVault(); });
+
+    manager.closeVault();
+  }
+}
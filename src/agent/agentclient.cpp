@@ -0,0 +1,204 @@
+#include "agentclient.h"
+#include <sodium.h>
+
+bool AgentClient::connectToAgent(const QString &socketPath, const QByteArray &tokenHex)
+{
+  QByteArray token = QByteArray::fromHex(tokenHex);
+  if (token.size() != AgentProtocol::TOKEN_SIZE)
+  {
+    return fail("Malformed agent token", AgentProtocol::Status::Unauthorized);
+  }
+
+  m_socket.connectToServer(socketPath);
+  if (!m_socket.waitForConnected(TIMEOUT))
+  {
+    sodium_memzero(token.data(), token.size());
+    return fail(m_socket.errorString(), AgentProtocol::Status::Ok);
+  }
+
+  // The answer is checked before the first real response
+  sendRequest(AgentProtocol::RequestType::Hello, token);
+  sodium_memzero(token.data(), token.size());
+  m_helloPending = true;
+  return true;
+}
+
+bool AgentClient::get(const QStringList &usernames, QList<Lookup> &outLookups)
+{
+  QByteArray body;
+  AgentProtocol::appendUInt32(body, static_cast<quint32>(usernames.size()));
+  for (const QString &username : usernames)
+  {
+    AgentProtocol::appendString(body, username);
+  }
+
+  QByteArray response;
+  if (!readResponse(sendRequest(AgentProtocol::RequestType::Get, body), response))
+  {
+    return false;
+  }
+
+  AgentProtocol::Reader reader(response);
+  quint32 count = 0;
+  bool ok = reader.readUInt32(count) && count == static_cast<quint32>(usernames.size());
+  outLookups.clear();
+  for (quint32 i = 0; ok && i < count; ++i)
+  {
+    quint8 status = 0;
+    Lookup lookup;
+    ok = reader.readUInt8(status) && reader.readString(lookup.password);
+    lookup.status = static_cast<AgentProtocol::ItemStatus>(status);
+    outLookups.append(lookup);
+  }
+  sodium_memzero(response.data(), response.size());
+
+  if (!ok || !reader.atEnd())
+  {
+    return fail("Malformed agent response", AgentProtocol::Status::BadRequest);
+  }
+  return true;
+}
+
+bool AgentClient::list(const QString &query, QStringList &outUsernames)
+{
+  QByteArray body;
+  AgentProtocol::appendString(body, query);
+
+  QByteArray response;
+  if (!readResponse(sendRequest(AgentProtocol::RequestType::List, body), response))
+  {
+    return false;
+  }
+
+  AgentProtocol::Reader reader(response);
+  quint32 count = 0;
+  bool ok = reader.readUInt32(count);
+  outUsernames.clear();
+  for (quint32 i = 0; ok && i < count; ++i)
+  {
+    QString username;
+    ok = reader.readString(username);
+    outUsernames.append(username);
+  }
+
+  if (!ok || !reader.atEnd())
+  {
+    return fail("Malformed agent response", AgentProtocol::Status::BadRequest);
+  }
+  return true;
+}
+
+bool AgentClient::add(const QString &username, const QString &password)
+{
+  return change(AgentProtocol::RequestType::Add, username, &password);
+}
+
+bool AgentClient::update(const QString &username, const QString &password)
+{
+  return change(AgentProtocol::RequestType::Update, username, &password);
+}
+
+bool AgentClient::remove(const QString &username)
+{
+  return change(AgentProtocol::RequestType::Remove, username, nullptr);
+}
+
+bool AgentClient::change(AgentProtocol::RequestType type, const QString &username, const QString *password)
+{
+  QByteArray body;
+  AgentProtocol::appendString(body, username);
+  if (password)
+  {
+    AgentProtocol::appendString(body, *password);
+  }
+  quint32 requestId = sendRequest(type, body);
+  sodium_memzero(body.data(), body.size());
+
+  QByteArray response;
+  if (!readResponse(requestId, response))
+  {
+    return false;
+  }
+  if (!response.isEmpty())
+  {
+    return fail("Malformed agent response", AgentProtocol::Status::BadRequest);
+  }
+  return true;
+}
+
+quint32 AgentClient::sendRequest(AgentProtocol::RequestType type, const QByteArray &body)
+{
+  quint32 requestId = m_nextRequestId++;
+  QByteArray payload;
+  AgentProtocol::appendUInt8(payload, static_cast<quint8>(type));
+  AgentProtocol::appendUInt32(payload, requestId);
+  payload += body;
+
+  QByteArray framed = AgentProtocol::frame(payload);
+  m_socket.write(framed);
+  m_socket.flush();
+  sodium_memzero(payload.data(), payload.size());
+  sodium_memzero(framed.data(), framed.size());
+  return requestId;
+}
+
+bool AgentClient::readResponse(quint32 requestId, QByteArray &outBody)
+{
+  // Responses arrive in request order, the pending Hello answer comes first
+  while (true)
+  {
+    QByteArray payload;
+    AgentProtocol::FrameResult result = AgentProtocol::takeFrame(m_buffer, m_offset, payload);
+    if (result == AgentProtocol::FrameResult::TooLarge)
+    {
+      return fail("Agent response too large", AgentProtocol::Status::BadRequest);
+    }
+    if (result == AgentProtocol::FrameResult::Incomplete)
+    {
+      if (!m_socket.waitForReadyRead(TIMEOUT))
+      {
+        return fail("No answer from the agent: " + m_socket.errorString(), AgentProtocol::Status::Locked);
+      }
+      m_buffer.remove(0, m_offset);
+      m_offset = 0;
+      m_buffer += m_socket.readAll();
+      continue;
+    }
+
+    AgentProtocol::Reader reader(payload);
+    quint8 status = 0;
+    quint32 responseId = 0;
+    if (!reader.readUInt8(status) || !reader.readUInt32(responseId))
+    {
+      return fail("Malformed agent response", AgentProtocol::Status::BadRequest);
+    }
+
+    if (static_cast<AgentProtocol::Status>(status) != AgentProtocol::Status::Ok)
+    {
+      QString message;
+      reader.readString(message);
+      return fail(message, static_cast<AgentProtocol::Status>(status));
+    }
+
+    if (m_helloPending)
+    {
+      m_helloPending = false;
+      continue;
+    }
+    if (responseId != requestId)
+    {
+      return fail("Agent answered out of order", AgentProtocol::Status::BadRequest);
+    }
+
+    outBody = payload.sliced(AgentProtocol::HEADER_SIZE);
+    sodium_memzero(payload.data(), payload.size());
+    return true;
+  }
+}
+
+bool AgentClient::fail(const QString &error, AgentProtocol::Status status)
+{
+  m_error = error;
+  m_status = status;
+  return false;
+}
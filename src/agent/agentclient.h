@@ -0,0 +1,88 @@
+#ifndef AGENTCLIENT_H
+#define AGENTCLIENT_H
+
+#include <QByteArray>
+#include <QList>
+#include <QLocalSocket>
+#include <QString>
+#include <QStringList>
+#include "agentprotocol.h"
+
+/**
+ * @brief Blocking client of a VaultAgent, for command line tools
+ *
+ * Connecting sends the Hello request without waiting for its answer, so a
+ * lookup or change costs a single round trip. All usernames of a lookup
+ * travel in one request and come back in one response
+ */
+class AgentClient
+{
+public:
+  struct Lookup
+  {
+    AgentProtocol::ItemStatus status = AgentProtocol::ItemStatus::NotFound;
+    QString password;
+  };
+
+  /**
+   * @brief Connect to the agent and authenticate
+   * @param socketPath Socket of the agent
+   * @param tokenHex Token printed by the agent, hex encoded
+   * @return false if no agent listens on the socket
+   */
+  bool connectToAgent(const QString &socketPath, const QByteArray &tokenHex);
+
+  /**
+   * @brief Look up the passwords of several usernames at once
+   * @return false if the agent refused or went away, see errorString and status
+   */
+  bool get(const QStringList &usernames, QList<Lookup> &outLookups);
+
+  /**
+   * @brief Usernames containing query, best match first, or every username for an empty query
+   */
+  bool list(const QString &query, QStringList &outUsernames);
+
+  /**
+   * @brief Add an entry, refused with status Failed if the username is taken
+   * @return true once the agent wrote the change
+   */
+  bool add(const QString &username, const QString &password);
+
+  /**
+   * @brief Replace the password of the one entry with this username
+   * @return true once the agent wrote the change, status Failed if the username is unknown or ambiguous
+   */
+  bool update(const QString &username, const QString &password);
+
+  /**
+   * @brief Remove the one entry with this username
+   * @return true once the agent wrote the change, status Failed if the username is unknown or ambiguous
+   */
+  bool remove(const QString &username);
+
+  QString errorString() const { return m_error; }
+
+  /**
+   * @brief Status of the last failed request, Locked means the agent lost its vault
+   */
+  AgentProtocol::Status status() const { return m_status; }
+
+private:
+  static constexpr int TIMEOUT = 2000; // Milliseconds to wait for the agent
+
+  QLocalSocket m_socket;
+  QByteArray m_buffer;
+  qsizetype m_offset = 0;
+  quint32 m_nextRequestId = 1;
+  bool m_helloPending = false;
+  QString m_error;
+  AgentProtocol::Status m_status = AgentProtocol::Status::Ok;
+
+  quint32 sendRequest(AgentProtocol::RequestType type, const QByteArray &body);
+  bool readResponse(quint32 requestId, QByteArray &outBody);
+  bool change(AgentProtocol::RequestType type, const QString &username, const QString *password);
+  bool fail(const QString &error, AgentProtocol::Status status);
+};
+
+#endif // AGENTCLIENT_H
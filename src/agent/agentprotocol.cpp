@@ -0,0 +1,112 @@
+#include "agentprotocol.h"
+#include <QDir>
+#include <QStandardPaths>
+#include <QtEndian>
+
+namespace AgentProtocol
+{
+  QString defaultSocketPath()
+  {
+    QString directory = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (directory.isEmpty())
+    {
+      directory = QDir::tempPath();
+    }
+    return directory + "/passwordmanager-agent.sock";
+  }
+
+  QByteArray frame(const QByteArray &payload)
+  {
+    QByteArray out;
+    out.reserve(LENGTH_SIZE + payload.size());
+    appendUInt32(out, static_cast<quint32>(payload.size()));
+    out += payload;
+    return out;
+  }
+
+  FrameResult takeFrame(const QByteArray &buffer, qsizetype &offset, QByteArray &outPayload)
+  {
+    if (buffer.size() - offset < LENGTH_SIZE)
+    {
+      return FrameResult::Incomplete;
+    }
+
+    quint32 length = qFromLittleEndian<quint32>(buffer.constData() + offset);
+    if (length > MAX_FRAME_SIZE)
+    {
+      return FrameResult::TooLarge;
+    }
+    if (buffer.size() - offset - LENGTH_SIZE < static_cast<qsizetype>(length))
+    {
+      return FrameResult::Incomplete;
+    }
+
+    outPayload = buffer.mid(offset + LENGTH_SIZE, length);
+    offset += LENGTH_SIZE + length;
+    return FrameResult::Complete;
+  }
+
+  void appendUInt8(QByteArray &out, quint8 value)
+  {
+    out.append(static_cast<char>(value));
+  }
+
+  void appendUInt32(QByteArray &out, quint32 value)
+  {
+    char bytes[sizeof(value)];
+    qToLittleEndian(value, bytes);
+    out.append(bytes, sizeof(bytes));
+  }
+
+  void appendString(QByteArray &out, QStringView value)
+  {
+    QByteArray utf8 = value.toUtf8();
+    appendUInt32(out, static_cast<quint32>(utf8.size()));
+    out += utf8;
+  }
+
+  bool Reader::readUInt8(quint8 &value)
+  {
+    if (m_data.size() - m_offset < 1)
+    {
+      return false;
+    }
+    value = static_cast<quint8>(m_data[m_offset]);
+    m_offset += 1;
+    return true;
+  }
+
+  bool Reader::readUInt32(quint32 &value)
+  {
+    if (m_data.size() - m_offset < static_cast<qsizetype>(sizeof(value)))
+    {
+      return false;
+    }
+    value = qFromLittleEndian<quint32>(m_data.data() + m_offset);
+    m_offset += sizeof(value);
+    return true;
+  }
+
+  bool Reader::readString(QString &value)
+  {
+    quint32 length = 0;
+    QByteArrayView utf8;
+    if (!readUInt32(length) || !readBytes(length, utf8))
+    {
+      return false;
+    }
+    value = QString::fromUtf8(utf8);
+    return true;
+  }
+
+  bool Reader::readBytes(qsizetype size, QByteArrayView &value)
+  {
+    if (size < 0 || m_data.size() - m_offset < size)
+    {
+      return false;
+    }
+    value = m_data.sliced(m_offset, size);
+    m_offset += size;
+    return true;
+  }
+}
@@ -0,0 +1,135 @@
+#ifndef AGENTPROTOCOL_H
+#define AGENTPROTOCOL_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+/**
+ * @brief Wire format between VaultAgent and AgentClient
+ *
+ * Every message is a frame (all integers little endian):
+ *   payload length (4) | payload
+ *
+ * Request payload:  type (1) | request id (4) | body
+ * Response payload: status (1) | request id (4) | body
+ *
+ * Strings are length (4) | UTF-8. Request bodies:
+ *   Hello:  token (TOKEN_SIZE), must be the first request of a connection
+ *   Get:    count (4) | count usernames, answered in one response
+ *   List:   query (string), empty for every username
+ *   Add:    username (string) | password (string)
+ *   Update: username (string) | password (string)
+ *   Remove: username (string)
+ *
+ * Response bodies with status Ok:
+ *   Hello: empty
+ *   Get:   count (4) | count times (item status (1) | password (string), empty unless Found)
+ *   List:  count (4) | count usernames
+ *   Add, Update, Remove: empty, sent once the change is written to the journal
+ * Any other status carries an error message (string).
+ *
+ * The agent holds the vault lock while it runs, so changes go through it and
+ * its answers never lag behind the file.
+ *
+ * Requests may be pipelined: the client writes several frames without waiting,
+ * the agent answers them in order and echoes the request id
+ */
+namespace AgentProtocol
+{
+  /**
+   * @brief Environment variable holding the socket of the running agent
+   */
+  constexpr char SOCKET_ENVIRONMENT_VARIABLE[] = "PASSWORDMANAGER_AGENT_SOCKET";
+
+  /**
+   * @brief Environment variable holding the hex token that authenticates a client
+   */
+  constexpr char TOKEN_ENVIRONMENT_VARIABLE[] = "PASSWORDMANAGER_AGENT_TOKEN";
+
+  constexpr qsizetype TOKEN_SIZE = 32;
+  constexpr quint32 MAX_FRAME_SIZE = 1024 * 1024; // Larger frames close the connection
+  constexpr qsizetype LENGTH_SIZE = 4;
+  constexpr qsizetype HEADER_SIZE = 5; // Request type or status (1) | request id (4)
+
+  enum class RequestType : quint8
+  {
+    Hello = 1,
+    Get = 2,
+    List = 3,
+    Add = 4,
+    Update = 5,
+    Remove = 6
+  };
+
+  enum class ItemStatus : quint8
+  {
+    Found = 0,
+    NotFound = 1,
+    Ambiguous = 2 // Several entries share the username
+  };
+
+  enum class Status : quint8
+  {
+    Ok = 0,
+    Unauthorized = 1, // No Hello with the right token yet
+    BadRequest = 2,   // Malformed body or unknown request type
+    Locked = 3,       // The vault was closed (session timeout), the agent is going away
+    Failed = 4        // A change was refused (unknown or duplicate username) or could not be written
+  };
+
+  /**
+   * @brief Default socket, in the per-user runtime directory
+   */
+  QString defaultSocketPath();
+
+  /**
+   * @brief Prefix a payload with its length
+   */
+  QByteArray frame(const QByteArray &payload);
+
+  enum class FrameResult
+  {
+    Complete,   // A frame was taken from the buffer
+    Incomplete, // Wait for more bytes
+    TooLarge    // The announced length exceeds MAX_FRAME_SIZE, drop the connection
+  };
+
+  /**
+   * @brief Read the frame starting at offset of a receive buffer
+   * Callers drop the consumed bytes once per read, not once per frame, so a
+   * burst of pipelined requests is parsed in linear time
+   * @param buffer Bytes received so far
+   * @param offset Start of the frame, advanced past it if the result is Complete
+   * @param outPayload Payload of the frame if the result is Complete
+   */
+  FrameResult takeFrame(const QByteArray &buffer, qsizetype &offset, QByteArray &outPayload);
+
+  void appendUInt8(QByteArray &out, quint8 value);
+  void appendUInt32(QByteArray &out, quint32 value);
+  void appendString(QByteArray &out, QStringView value);
+
+  /**
+   * @brief Bounds checked reader over a payload
+   * Every read returns false once the payload is exhausted, the values are then unspecified
+   */
+  class Reader
+  {
+  public:
+    explicit Reader(QByteArrayView data) : m_data(data) {}
+
+    bool readUInt8(quint8 &value);
+    bool readUInt32(quint32 &value);
+    bool readString(QString &value);
+    bool readBytes(qsizetype size, QByteArrayView &value);
+    bool atEnd() const { return m_offset == m_data.size(); }
+
+  private:
+    QByteArrayView m_data;
+    qsizetype m_offset = 0;
+  };
+}
+
+#endif // AGENTPROTOCOL_H
@@ -0,0 +1,367 @@
+#include "vaultagent.h"
+#include "../utils/tracing.h"
+#include <QDebug>
+#include <QLocalSocket>
+#include <sodium.h>
+
+namespace
+{
+  constexpr int STALE_SOCKET_TIMEOUT = 200; // Milliseconds to wait for a live agent on an existing socket
+
+  QByteArray responseHeader(AgentProtocol::Status status, quint32 requestId)
+  {
+    QByteArray response;
+    AgentProtocol::appendUInt8(response, static_cast<quint8>(status));
+    AgentProtocol::appendUInt32(response, requestId);
+    return response;
+  }
+
+  QByteArray errorResponse(AgentProtocol::Status status, quint32 requestId, const QString &message)
+  {
+    QByteArray response = responseHeader(status, requestId);
+    AgentProtocol::appendString(response, message);
+    return response;
+  }
+}
+
+VaultAgent::VaultAgent(VaultManager &vault, QObject *parent)
+    : QObject(parent), m_vault(vault), m_token(AgentProtocol::TOKEN_SIZE)
+{
+  randombytes_buf(m_token.data(), m_token.size());
+
+  // Only the user running the agent may connect
+  m_server.setSocketOptions(QLocalServer::UserAccessOption);
+  connect(&m_server, &QLocalServer::newConnection, this, &VaultAgent::onNewConnection);
+  connect(&m_vault, &VaultManager::vaultClosed, this, &VaultAgent::onVaultClosed);
+
+  auto markStale = [this]() { m_usernamesStale = true; };
+  connect(&m_vault, &VaultManager::entriesReset, this, markStale);
+  connect(&m_vault, &VaultManager::entryAdded, this, markStale);
+  connect(&m_vault, &VaultManager::entryRemoved, this, markStale);
+}
+
+VaultAgent::~VaultAgent()
+{
+  m_server.close();
+}
+
+bool VaultAgent::listen(const QString &socketPath)
+{
+  if (m_server.listen(socketPath))
+  {
+    return true;
+  }
+
+  if (m_server.serverError() != QAbstractSocket::AddressInUseError)
+  {
+    return false;
+  }
+
+  // A socket nobody answers on was left behind by an agent that did not shut down
+  QLocalSocket probe;
+  probe.connectToServer(socketPath);
+  if (probe.waitForConnected(STALE_SOCKET_TIMEOUT))
+  {
+    return false;
+  }
+  QLocalServer::removeServer(socketPath);
+  return m_server.listen(socketPath);
+}
+
+QByteArray VaultAgent::tokenHex() const
+{
+  return m_token.view().toByteArray().toHex();
+}
+
+void VaultAgent::onNewConnection()
+{
+  while (QLocalSocket *socket = m_server.nextPendingConnection())
+  {
+    m_connections.insert(socket, Connection());
+    connect(socket, &QLocalSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+    connect(socket, &QLocalSocket::disconnected, this,
+            [this, socket]()
+            {
+              m_connections.remove(socket);
+              socket->deleteLater();
+            });
+  }
+}
+
+void VaultAgent::onReadyRead(QLocalSocket *socket)
+{
+  TRACE_SPAN("agent", "VaultAgent::onReadyRead");
+  auto it = m_connections.find(socket);
+  if (it == m_connections.end())
+  {
+    return;
+  }
+  Connection &connection = it.value();
+  connection.buffer += socket->readAll();
+
+  // Pipelined requests are answered in order with a single write
+  QByteArray responses;
+  QByteArray payload;
+  bool disconnect = false;
+  AgentProtocol::FrameResult result = AgentProtocol::FrameResult::Incomplete;
+  while (!disconnect &&
+         (result = AgentProtocol::takeFrame(connection.buffer, connection.offset, payload)) == AgentProtocol::FrameResult::Complete)
+  {
+    QByteArray response = handleRequest(connection, payload, disconnect);
+    responses += AgentProtocol::frame(response);
+    sodium_memzero(response.data(), response.size());
+    sodium_memzero(payload.data(), payload.size()); // Changes carry passwords
+  }
+  sodium_memzero(connection.buffer.data(), connection.offset);
+  connection.buffer.remove(0, connection.offset);
+  connection.offset = 0;
+
+  if (!responses.isEmpty())
+  {
+    socket->write(responses);
+    sodium_memzero(responses.data(), responses.size());
+  }
+  if (disconnect || result == AgentProtocol::FrameResult::TooLarge)
+  {
+    socket->disconnectFromServer();
+  }
+}
+
+QByteArray VaultAgent::handleRequest(Connection &connection, const QByteArray &payload, bool &disconnect)
+{
+  AgentProtocol::Reader reader(payload);
+  quint8 type = 0;
+  quint32 requestId = 0;
+  if (!reader.readUInt8(type) || !reader.readUInt32(requestId))
+  {
+    disconnect = true;
+    return errorResponse(AgentProtocol::Status::BadRequest, requestId, "Truncated request");
+  }
+
+  if (static_cast<AgentProtocol::RequestType>(type) == AgentProtocol::RequestType::Hello)
+  {
+    QByteArrayView token;
+    if (!reader.readBytes(AgentProtocol::TOKEN_SIZE, token) ||
+        sodium_memcmp(token.data(), m_token.constData(), AgentProtocol::TOKEN_SIZE) != 0)
+    {
+      qWarning() << "Agent client presented a wrong token";
+      disconnect = true;
+      return errorResponse(AgentProtocol::Status::Unauthorized, requestId, "Wrong agent token");
+    }
+    connection.authenticated = true;
+    return responseHeader(AgentProtocol::Status::Ok, requestId);
+  }
+
+  if (!connection.authenticated)
+  {
+    disconnect = true;
+    return errorResponse(AgentProtocol::Status::Unauthorized, requestId, "Hello required");
+  }
+  if (!m_vault.isVaultOpen())
+  {
+    return errorResponse(AgentProtocol::Status::Locked, requestId, "Vault is locked");
+  }
+
+  switch (static_cast<AgentProtocol::RequestType>(type))
+  {
+  case AgentProtocol::RequestType::Get:
+  {
+    quint32 count = 0;
+    if (!reader.readUInt32(count))
+    {
+      return errorResponse(AgentProtocol::Status::BadRequest, requestId, "Truncated lookup");
+    }
+    QByteArray response = responseHeader(AgentProtocol::Status::Ok, requestId);
+    appendLookups(response, reader, count);
+    if (!reader.atEnd())
+    {
+      sodium_memzero(response.data(), response.size());
+      return errorResponse(AgentProtocol::Status::BadRequest, requestId, "Malformed lookup");
+    }
+    return response;
+  }
+  case AgentProtocol::RequestType::List:
+  {
+    QString query;
+    if (!reader.readString(query))
+    {
+      return errorResponse(AgentProtocol::Status::BadRequest, requestId, "Truncated list request");
+    }
+    QByteArray response = responseHeader(AgentProtocol::Status::Ok, requestId);
+    appendList(response, query);
+    return response;
+  }
+  case AgentProtocol::RequestType::Add:
+  case AgentProtocol::RequestType::Update:
+  case AgentProtocol::RequestType::Remove:
+    return applyChange(static_cast<AgentProtocol::RequestType>(type), requestId, reader);
+  default:
+    return errorResponse(AgentProtocol::Status::BadRequest, requestId, "Unknown request type");
+  }
+}
+
+void VaultAgent::appendLookups(QByteArray &response, AgentProtocol::Reader &reader, quint32 count)
+{
+  if (m_usernamesStale)
+  {
+    rebuildUsernames();
+  }
+
+  // The count is not trusted for a reservation, a short body simply ends the loop
+  QByteArray items;
+  quint32 answered = 0;
+  QString username;
+  while (answered < count && reader.readString(username))
+  {
+    auto it = m_usernames.constFind(username);
+    if (it == m_usernames.constEnd() || it.value() == 0)
+    {
+      AgentProtocol::ItemStatus status =
+          it == m_usernames.constEnd() ? AgentProtocol::ItemStatus::NotFound : AgentProtocol::ItemStatus::Ambiguous;
+      AgentProtocol::appendUInt8(items, static_cast<quint8>(status));
+      AgentProtocol::appendString(items, QString());
+    }
+    else
+    {
+      // Goes through the secret cache and extends the session
+      QString password = m_vault.getPasswordSecure(it.value());
+      AgentProtocol::ItemStatus status =
+          password.isNull() ? AgentProtocol::ItemStatus::NotFound : AgentProtocol::ItemStatus::Found;
+      AgentProtocol::appendUInt8(items, static_cast<quint8>(status));
+      AgentProtocol::appendString(items, password);
+      password.fill(QChar(0));
+    }
+    ++answered;
+  }
+
+  AgentProtocol::appendUInt32(response, answered);
+  response += items;
+  sodium_memzero(items.data(), items.size());
+}
+
+void VaultAgent::appendList(QByteArray &response, const QString &query)
+{
+  if (query.isEmpty())
+  {
+    AgentProtocol::appendUInt32(response, static_cast<quint32>(m_vault.entryCount()));
+    for (qsizetype row = 0; row < m_vault.entryCount(); ++row)
+    {
+      AgentProtocol::appendString(response, m_vault.entryAt(row).username);
+    }
+    return;
+  }
+
+  QList<EntryId> matches = m_vault.searchEntries(query);
+  AgentProtocol::appendUInt32(response, static_cast<quint32>(matches.size()));
+  for (EntryId id : matches)
+  {
+    AgentProtocol::appendString(response, m_vault.findEntry(id)->username);
+  }
+}
+
+QByteArray VaultAgent::applyChange(AgentProtocol::RequestType type, quint32 requestId, AgentProtocol::Reader &reader)
+{
+  TRACE_SPAN("agent", "VaultAgent::applyChange");
+  QString username;
+  QString password;
+  bool hasPassword = type != AgentProtocol::RequestType::Remove;
+  if (!reader.readString(username) || (hasPassword && !reader.readString(password)) || !reader.atEnd())
+  {
+    password.fill(QChar(0));
+    return errorResponse(AgentProtocol::Status::BadRequest, requestId, "Malformed change request");
+  }
+
+  // Same rules as the command line applies when it unlocks the vault itself
+  if (m_usernamesStale)
+  {
+    rebuildUsernames();
+  }
+  auto it = m_usernames.constFind(username);
+  EntryId id = it == m_usernames.constEnd() ? 0 : it.value();
+  QString refusal;
+  if (type == AgentProtocol::RequestType::Add && it != m_usernames.constEnd())
+  {
+    refusal = "An entry named " + username + " already exists, use update to change it";
+  }
+  else if (type != AgentProtocol::RequestType::Add && it == m_usernames.constEnd())
+  {
+    refusal = "No entry named " + username;
+  }
+  else if (type != AgentProtocol::RequestType::Add && id == 0)
+  {
+    refusal = "Several entries are named " + username;
+  }
+  if (!refusal.isEmpty())
+  {
+    password.fill(QChar(0));
+    return errorResponse(AgentProtocol::Status::Failed, requestId, refusal);
+  }
+
+  try
+  {
+    if (type == AgentProtocol::RequestType::Add)
+    {
+      VaultEntry entry;
+      entry.username = username;
+      entry.password = password;
+      m_vault.addEntry(entry);
+      entry.clearSensitiveData();
+    }
+    else if (type == AgentProtocol::RequestType::Update)
+    {
+      m_vault.updateEntry(id, password);
+    }
+    else
+    {
+      m_vault.removeEntry(id);
+    }
+  }
+  catch (const std::exception &e)
+  {
+    password.fill(QChar(0));
+    return errorResponse(AgentProtocol::Status::Failed, requestId, QString::fromUtf8(e.what()));
+  }
+  password.fill(QChar(0));
+  m_vault.extendSession();
+
+  // The agent writes every change through, anything still pending failed to reach the disk
+  if (m_vault.hasPendingWrites())
+  {
+    return errorResponse(AgentProtocol::Status::Failed, requestId,
+                         "The change is applied but could not be written yet, the agent keeps retrying");
+  }
+  return responseHeader(AgentProtocol::Status::Ok, requestId);
+}
+
+void VaultAgent::rebuildUsernames()
+{
+  m_usernames.clear();
+  m_usernames.reserve(m_vault.entryCount());
+  for (qsizetype row = 0; row < m_vault.entryCount(); ++row)
+  {
+    const VaultEntry &entry = m_vault.entryAt(row);
+    auto it = m_usernames.find(entry.username);
+    if (it == m_usernames.end())
+    {
+      m_usernames.insert(entry.username, entry.id);
+    }
+    else
+    {
+      it.value() = 0;
+    }
+  }
+  m_usernamesStale = false;
+}
+
+void VaultAgent::onVaultClosed()
+{
+  // Without the keys there is nothing left to serve, clients fall back to unlocking themselves
+  // Disconnecting removes the connection from m_connections, so iterate over a copy
+  const QList<QLocalSocket *> sockets = m_connections.keys();
+  for (QLocalSocket *socket : sockets)
+  {
+    socket->disconnectFromServer();
+  }
+  m_server.close();
+  emit stopped();
+}
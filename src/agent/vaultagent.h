@@ -0,0 +1,77 @@
+#ifndef VAULTAGENT_H
+#define VAULTAGENT_H
+
+#include <QHash>
+#include <QLocalServer>
+#include <QObject>
+#include "agentprotocol.h"
+#include "../vault/vaultmanager.h"
+
+class QLocalSocket;
+
+/**
+ * @brief Serves lookups and changes from an unlocked VaultManager over a local socket, like ssh-agent
+ *
+ * The vault is unlocked once and stays in the manager, with its keys in locked
+ * memory, so clients skip the password hash. The socket is only accessible to
+ * the user, and every connection has to present the random token of the agent
+ * first (see AgentProtocol). Password lookups go through getPasswordSecure, so
+ * they extend the session like in the GUI. Changes are applied to the same
+ * manager and written through before they are answered, since the vault lock
+ * keeps every other process from writing it. When the session times out the
+ * vault closes, the agent stops listening and emits stopped.
+ */
+class VaultAgent : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit VaultAgent(VaultManager &vault, QObject *parent = nullptr);
+  ~VaultAgent();
+
+  /**
+   * @brief Start serving on a socket path
+   * A stale socket left by a crashed agent is replaced, a live one is not
+   * @return false if the socket cannot be created, see errorString
+   */
+  bool listen(const QString &socketPath);
+  QString errorString() const { return m_server.errorString(); }
+  QString socketPath() const { return m_server.fullServerName(); }
+
+  /**
+   * @brief Token clients pass in their Hello request, hex encoded for the environment
+   */
+  QByteArray tokenHex() const;
+
+signals:
+  /**
+   * @brief Emitted once the agent stopped serving because the vault was closed
+   */
+  void stopped();
+
+private:
+  struct Connection
+  {
+    QByteArray buffer;     // Received bytes, frames before offset are handled
+    qsizetype offset = 0;
+    bool authenticated = false;
+  };
+
+  VaultManager &m_vault;
+  QLocalServer m_server;
+  SecureMemory::Buffer m_token;
+  QHash<QLocalSocket *, Connection> m_connections;
+  QHash<QString, EntryId> m_usernames; // Username -> entry id, 0 if several entries share it
+  bool m_usernamesStale = true;        // Rebuilt on the next lookup after the store changed
+
+  void onNewConnection();
+  void onReadyRead(QLocalSocket *socket);
+  void onVaultClosed();
+  QByteArray handleRequest(Connection &connection, const QByteArray &payload, bool &disconnect);
+  void appendLookups(QByteArray &response, AgentProtocol::Reader &reader, quint32 count);
+  void appendList(QByteArray &response, const QString &query);
+  QByteArray applyChange(AgentProtocol::RequestType type, quint32 requestId, AgentProtocol::Reader &reader);
+  void rebuildUsernames();
+};
+
+#endif // VAULTAGENT_H
@@ -0,0 +1,616 @@
+#include "../agent/agentclient.h"
+#include "../agent/vaultagent.h"
+#include "../vault/vaultmanager.h"
+#include "../utils/fileutils.h"
+#include "../utils/metrics.h"
+#include "../utils/tracing.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QSet>
+#include <QTextStream>
+#include <cstdio>
+#include <sodium.h>
+#include <stdexcept>
+#if defined(Q_OS_WIN)
+#include <io.h>
+#include <windows.h>
+#else
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief passwordmanager-cli: look up and rotate credentials from scripts
+ *
+ * Works on the same vault file as the GUI without loading any widget code.
+ * The master password is prompted for on a terminal, otherwise it is the
+ * first line of stdin. Passwords for add and update are the next line.
+ * Every mutation is committed to the journal before the command returns.
+ * With PASSWORDMANAGER_AGENT_SOCKET and PASSWORDMANAGER_AGENT_TOKEN set (see
+ * the agent command), get, list, add, update and remove go through the running
+ * agent and skip the unlock. No master password is read then
+ */
+namespace
+{
+  constexpr char DEFAULT_VAULT[] = "vault.txt";
+  constexpr char VAULT_ENVIRONMENT_VARIABLE[] = "PASSWORDMANAGER_VAULT";
+
+  enum ExitCode
+  {
+    ExitSuccess = 0,
+    ExitFailure = 1,
+    ExitUsage = 2
+  };
+
+  /**
+   * @brief A command that cannot be carried out as asked (unknown entry, duplicate name)
+   */
+  class CommandError : public std::runtime_error
+  {
+  public:
+    explicit CommandError(const QString &message) : std::runtime_error(message.toStdString()) {}
+  };
+
+  QTextStream &input()
+  {
+    static QTextStream stream(stdin);
+    return stream;
+  }
+
+  QTextStream &output()
+  {
+    static QTextStream stream(stdout);
+    return stream;
+  }
+
+  QTextStream &errorOutput()
+  {
+    static QTextStream stream(stderr);
+    return stream;
+  }
+
+  // Start of the process and the moment the first result reached stdout, for --timing
+  QElapsedTimer s_processTimer;
+  qint64 s_firstOutputNanoseconds = -1;
+
+  void markFirstOutput()
+  {
+    if (s_firstOutputNanoseconds < 0)
+    {
+      s_firstOutputNanoseconds = s_processTimer.nsecsElapsed();
+    }
+  }
+
+  void printLine(const QString &line)
+  {
+    output() << line << Qt::endl;
+    markFirstOutput();
+  }
+
+  bool isInteractive()
+  {
+#if defined(Q_OS_WIN)
+    return _isatty(_fileno(stdin));
+#else
+    return isatty(fileno(stdin));
+#endif
+  }
+
+  void setTerminalEcho(bool enabled)
+  {
+#if defined(Q_OS_WIN)
+    HANDLE handle = GetStdHandle(STD_INPUT_HANDLE);
+    DWORD mode = 0;
+    GetConsoleMode(handle, &mode);
+    SetConsoleMode(handle, enabled ? (mode | ENABLE_ECHO_INPUT) : (mode & ~ENABLE_ECHO_INPUT));
+#else
+    termios settings;
+    if (tcgetattr(STDIN_FILENO, &settings) != 0)
+    {
+      return;
+    }
+    if (enabled)
+    {
+      settings.c_lflag |= ECHO;
+    }
+    else
+    {
+      settings.c_lflag &= ~ECHO;
+    }
+    tcsetattr(STDIN_FILENO, TCSANOW, &settings);
+#endif
+  }
+
+  /**
+   * @brief Read one line of stdin, prompting without echo when stdin is a terminal
+   * @throws CommandError if stdin has no more lines
+   */
+  QString readSecret(const QString &prompt)
+  {
+    bool interactive = isInteractive();
+    if (interactive)
+    {
+      errorOutput() << prompt << Qt::flush;
+      setTerminalEcho(false);
+    }
+
+    QString line;
+    bool ok = input().readLineInto(&line);
+
+    if (interactive)
+    {
+      setTerminalEcho(true);
+      errorOutput() << Qt::endl;
+    }
+    if (!ok)
+    {
+      throw CommandError("No input for: " + prompt);
+    }
+    if (line.endsWith('\r'))
+    {
+      line.chop(1);
+    }
+    return line;
+  }
+
+  /**
+   * @brief Id of the one entry with this username
+   * @throws CommandError if there is none or the name is ambiguous
+   */
+  EntryId resolveEntry(const VaultManager &vault, const QString &username)
+  {
+    EntryId found = 0;
+    for (qsizetype row = 0; row < vault.entryCount(); ++row)
+    {
+      const VaultEntry &entry = vault.entryAt(row);
+      if (entry.username != username)
+      {
+        continue;
+      }
+      if (found != 0)
+      {
+        throw CommandError("Several entries are named " + username);
+      }
+      found = entry.id;
+    }
+
+    if (found == 0)
+    {
+      throw CommandError("No entry named " + username);
+    }
+    return found;
+  }
+
+  bool containsUsername(const VaultManager &vault, const QString &username)
+  {
+    for (qsizetype row = 0; row < vault.entryCount(); ++row)
+    {
+      if (vault.entryAt(row).username == username)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void runList(VaultManager &vault, const QStringList &arguments)
+  {
+    // Usernames are stored in the clear, listing never decrypts a password
+    if (!arguments.isEmpty())
+    {
+      for (EntryId id : vault.searchEntries(arguments.first()))
+      {
+        printLine(vault.findEntry(id)->username);
+      }
+      return;
+    }
+
+    for (qsizetype row = 0; row < vault.entryCount(); ++row)
+    {
+      printLine(vault.entryAt(row).username);
+    }
+  }
+
+  void runGet(VaultManager &vault, const QStringList &arguments)
+  {
+    // Nothing is printed unless every username resolves
+    QList<EntryId> ids;
+    for (const QString &username : arguments)
+    {
+      ids.append(resolveEntry(vault, username));
+    }
+
+    for (qsizetype i = 0; i < ids.size(); ++i)
+    {
+      QString password = vault.getPasswordSecure(ids[i]);
+      if (password.isNull())
+      {
+        throw CommandError("Cannot decrypt the password of " + arguments[i]);
+      }
+      printLine(password);
+      password.fill(QChar(0));
+    }
+  }
+
+  bool runGetViaAgent(AgentClient &agent, const QStringList &arguments)
+  {
+    // One request for all usernames, answered in a single round trip
+    QList<AgentClient::Lookup> lookups;
+    if (!agent.get(arguments, lookups))
+    {
+      return false;
+    }
+
+    for (qsizetype i = 0; i < lookups.size(); ++i)
+    {
+      if (lookups[i].status == AgentProtocol::ItemStatus::Ambiguous)
+      {
+        throw CommandError("Several entries are named " + arguments[i]);
+      }
+      if (lookups[i].status != AgentProtocol::ItemStatus::Found)
+      {
+        throw CommandError("No entry named " + arguments[i]);
+      }
+    }
+    for (AgentClient::Lookup &lookup : lookups)
+    {
+      printLine(lookup.password);
+      lookup.password.fill(QChar(0));
+    }
+    return true;
+  }
+
+  bool runListViaAgent(AgentClient &agent, const QStringList &arguments)
+  {
+    QStringList usernames;
+    if (!agent.list(arguments.value(0), usernames))
+    {
+      return false;
+    }
+    for (const QString &username : usernames)
+    {
+      printLine(username);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Report the outcome of a change sent to the agent
+   * The agent may have applied it before its answer got lost, so a failure is
+   * an error rather than a reason to unlock the vault here and apply it again
+   */
+  bool confirmChange(const AgentClient &agent, bool ok)
+  {
+    if (!ok)
+    {
+      throw CommandError("The agent did not carry out the change: " + agent.errorString());
+    }
+    return true;
+  }
+
+  bool runAddViaAgent(AgentClient &agent, const QStringList &arguments)
+  {
+    const QString &username = arguments.first();
+    QString password = readSecret("Password for " + username + ": ");
+    bool ok = agent.add(username, password);
+    password.fill(QChar(0));
+    return confirmChange(agent, ok);
+  }
+
+  bool runUpdateViaAgent(AgentClient &agent, const QStringList &arguments)
+  {
+    QString password = readSecret("New password for " + arguments.first() + ": ");
+    bool ok = agent.update(arguments.first(), password);
+    password.fill(QChar(0));
+    return confirmChange(agent, ok);
+  }
+
+  bool runRemoveViaAgent(AgentClient &agent, const QStringList &arguments)
+  {
+    return confirmChange(agent, agent.remove(arguments.first()));
+  }
+
+  void runAgent(VaultManager &vault, const QStringList &arguments)
+  {
+    QString socketPath = arguments.value(0, qEnvironmentVariable(AgentProtocol::SOCKET_ENVIRONMENT_VARIABLE));
+    if (socketPath.isEmpty())
+    {
+      socketPath = AgentProtocol::defaultSocketPath();
+    }
+
+    VaultAgent agent(vault);
+    if (!agent.listen(socketPath))
+    {
+      throw CommandError("Cannot listen on " + socketPath + ": " + agent.errorString());
+    }
+
+    // Shell assignments like ssh-agent. The agent stays in the foreground (like ssh-agent -D),
+    // so redirect them to a file that other shells source
+    printLine(QString("%1=%2; export %1;").arg(QLatin1String(AgentProtocol::SOCKET_ENVIRONMENT_VARIABLE), agent.socketPath()));
+    printLine(QString("%1=%2; export %1;")
+                  .arg(QLatin1String(AgentProtocol::TOKEN_ENVIRONMENT_VARIABLE), QString::fromLatin1(agent.tokenHex())));
+
+    // Serves until the session times out and the vault closes
+    QObject::connect(&agent, &VaultAgent::stopped, QCoreApplication::instance(), &QCoreApplication::quit);
+    QCoreApplication::exec();
+  }
+
+  /**
+   * @brief Run a command through the agent named by the environment, if there is one
+   * @return false if there is no usable agent and the vault has to be unlocked here
+   */
+  bool tryAgent(bool (*runViaAgent)(AgentClient &, const QStringList &), const QStringList &arguments)
+  {
+    QString socketPath = qEnvironmentVariable(AgentProtocol::SOCKET_ENVIRONMENT_VARIABLE);
+    QByteArray token = qgetenv(AgentProtocol::TOKEN_ENVIRONMENT_VARIABLE);
+    if (!runViaAgent || socketPath.isEmpty() || token.isEmpty())
+    {
+      return false;
+    }
+
+    AgentClient agent;
+    if (agent.connectToAgent(socketPath, token) && runViaAgent(agent, arguments))
+    {
+      return true;
+    }
+    errorOutput() << "Agent unavailable (" << agent.errorString() << "), unlocking the vault" << Qt::endl;
+    return false;
+  }
+
+  void runAdd(VaultManager &vault, const QStringList &arguments)
+  {
+    const QString &username = arguments.first();
+    if (containsUsername(vault, username))
+    {
+      throw CommandError("An entry named " + username + " already exists, use update to change it");
+    }
+
+    VaultEntry entry;
+    entry.username = username;
+    entry.password = readSecret("Password for " + username + ": ");
+    vault.addEntry(entry);
+    entry.clearSensitiveData();
+  }
+
+  void runUpdate(VaultManager &vault, const QStringList &arguments)
+  {
+    EntryId id = resolveEntry(vault, arguments.first());
+    QString password = readSecret("New password for " + arguments.first() + ": ");
+    vault.updateEntry(id, password);
+    password.fill(QChar(0));
+  }
+
+  void runRemove(VaultManager &vault, const QStringList &arguments)
+  {
+    vault.removeEntry(resolveEntry(vault, arguments.first()));
+  }
+
+  void runImport(VaultManager &vault, const QStringList &arguments)
+  {
+    // One "username,password" per line, the password is everything after the first comma
+    // "-" continues on stdin after the master password, through the same buffered stream
+    const QString &path = arguments.first();
+    QFile file(path);
+    QTextStream fileStream;
+    QTextStream &stream = path == "-" ? input() : fileStream;
+    if (path != "-")
+    {
+      if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+      {
+        throw FileUtils::FileOperationError("Cannot open import file: " + path.toStdString());
+      }
+      fileStream.setDevice(&file);
+    }
+
+    QSet<QString> usernames;
+    for (qsizetype row = 0; row < vault.entryCount(); ++row)
+    {
+      usernames.insert(vault.entryAt(row).username);
+    }
+
+    QList<VaultEntry> entries;
+    qsizetype skipped = 0;
+    QString line;
+    while (stream.readLineInto(&line))
+    {
+      if (line.endsWith('\r'))
+      {
+        line.chop(1);
+      }
+      qsizetype comma = line.indexOf(',');
+      if (comma <= 0 || comma == line.size() - 1)
+      {
+        if (!line.trimmed().isEmpty())
+        {
+          ++skipped;
+        }
+        continue;
+      }
+
+      QString username = line.left(comma);
+      if (usernames.contains(username))
+      {
+        ++skipped;
+        continue;
+      }
+
+      VaultEntry entry;
+      entry.username = username;
+      entry.password = line.mid(comma + 1);
+      usernames.insert(username);
+      entries.append(entry);
+      line.fill(QChar(0));
+    }
+
+    // Encrypted in parallel and committed with a single write
+    vault.addEntries(entries);
+    for (VaultEntry &entry : entries)
+    {
+      entry.clearSensitiveData();
+    }
+    printLine(QString("Imported %1 entries, skipped %2 lines").arg(entries.size()).arg(skipped));
+  }
+
+  struct Command
+  {
+    const char *name;
+    const char *usage;
+    bool createsVault; // Other commands refuse to create a missing vault
+    void (*run)(VaultManager &, const QStringList &);
+    int minArguments;
+    bool (*runViaAgent)(AgentClient &, const QStringList &); // Commands a running agent carries out
+  };
+
+  const Command COMMANDS[] = {
+      {"list", "list [query]", false, runList, 0, runListViaAgent},
+      {"get", "get <username>...", false, runGet, 1, runGetViaAgent},
+      {"add", "add <username>", true, runAdd, 1, runAddViaAgent},
+      {"update", "update <username>", false, runUpdate, 1, runUpdateViaAgent},
+      {"remove", "remove <username>", false, runRemove, 1, runRemoveViaAgent},
+      {"import", "import <file|->", true, runImport, 1, nullptr},
+      {"agent", "agent [socket]", false, runAgent, 0, nullptr},
+  };
+
+  void runUnlocked(const Command &command, const QString &vaultPath, const QStringList &arguments)
+  {
+    if (!command.createsVault && !FileUtils::exists(vaultPath))
+    {
+      throw CommandError("Vault file not found: " + vaultPath);
+    }
+
+    VaultManager vault;
+    // Scripts exit right after the command, so nothing is left for a write-behind window
+    vault.setWriteBehindWindow(0);
+    QString masterPassword = readSecret("Master password: ");
+    vault.openVault(vaultPath, masterPassword);
+    masterPassword.fill(QChar(0));
+
+    command.run(vault, arguments);
+
+    // closeVault falls back to a snapshot for anything the journal did not take.
+    // The agent command returns once its session timed out and the vault is closed already
+    if (vault.isVaultOpen() && !vault.closeVault())
+    {
+      throw CommandError("The change could not be written to " + vaultPath);
+    }
+  }
+
+  const Command *findCommand(const QString &name)
+  {
+    for (const Command &command : COMMANDS)
+    {
+      if (name == QLatin1String(command.name))
+      {
+        return &command;
+      }
+    }
+    return nullptr;
+  }
+
+  QString commandSummary()
+  {
+    QString summary = "Commands:\n";
+    for (const Command &command : COMMANDS)
+    {
+      summary += QString("  %1\n").arg(QLatin1String(command.usage));
+    }
+    return summary;
+  }
+
+  void printTiming()
+  {
+    // Argon2 cost is chosen per vault, everything else is the overhead of the tool
+    Metrics::Snapshot metrics = Metrics::snapshot();
+    double kdfMilliseconds = metrics.histogram(Metrics::Operation::KeyDerivation).totalNanoseconds / 1e6;
+    double firstOutputMilliseconds =
+        (s_firstOutputNanoseconds >= 0 ? s_firstOutputNanoseconds : s_processTimer.nsecsElapsed()) / 1e6;
+    errorOutput() << QString("First output after %1 ms: %2 ms key derivation, %3 ms everything else")
+                         .arg(firstOutputMilliseconds, 0, 'f', 2)
+                         .arg(kdfMilliseconds, 0, 'f', 2)
+                         .arg(firstOutputMilliseconds - kdfMilliseconds, 0, 'f', 2)
+                  << Qt::endl;
+  }
+
+  int run(const QCoreApplication &app)
+  {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Look up and change vault entries without the GUI.\n\n"
+                                     "The master password is prompted for on a terminal, otherwise it is the first\n"
+                                     "line of stdin. add and update read the entry password the same way.\n"
+                                     "Through a running agent no master password is read.\n\n" +
+                                     commandSummary());
+    parser.addHelpOption();
+    QCommandLineOption vaultOption({"f", "vault"},
+                                   QString("Vault file (default $%1, then %2).")
+                                       .arg(QLatin1String(VAULT_ENVIRONMENT_VARIABLE), QLatin1String(DEFAULT_VAULT)),
+                                   "file");
+    QCommandLineOption timingOption("timing", "Report the time to first output, with and without key derivation, on stderr.");
+    QCommandLineOption traceOption("trace", "Record tracing spans and write them as Chrome trace JSON to <file>.", "file");
+    QCommandLineOption metricsOption("metrics", "Write the operation latency histograms and counters as JSON to <file>.", "file");
+    parser.addOptions({vaultOption, timingOption, traceOption, metricsOption});
+    parser.addPositionalArgument("command", "Command to run, see above.");
+    parser.addPositionalArgument("arguments", "Arguments of the command.", "[arguments...]");
+    parser.process(app);
+    Tracing::configure(app.arguments());
+    Metrics::configure(app.arguments());
+
+    QStringList positional = parser.positionalArguments();
+    const Command *command = positional.isEmpty() ? nullptr : findCommand(positional.takeFirst());
+    if (!command || positional.size() < command->minArguments)
+    {
+      errorOutput() << (command ? QString("Usage: %1").arg(QLatin1String(command->usage)) : commandSummary()) << Qt::endl;
+      return ExitUsage;
+    }
+
+    QString vaultPath = parser.value(vaultOption);
+    if (vaultPath.isEmpty())
+    {
+      vaultPath = qEnvironmentVariable(VAULT_ENVIRONMENT_VARIABLE, DEFAULT_VAULT);
+    }
+
+    int exitCode = ExitSuccess;
+    try
+    {
+      if (!tryAgent(command->runViaAgent, positional))
+      {
+        runUnlocked(*command, vaultPath, positional);
+      }
+    }
+    catch (const std::exception &e)
+    {
+      errorOutput() << e.what() << Qt::endl;
+      exitCode = ExitFailure;
+    }
+
+    if (parser.isSet(timingOption))
+    {
+      printTiming();
+    }
+    Tracing::dump();
+    Metrics::dump();
+    return exitCode;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  s_processTimer.start();
+
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("passwordmanager-cli");
+
+  // stdout carries results and stderr the errors, keep the vault's debug chatter out of both
+  QLoggingCategory::setFilterRules("*.debug=false");
+
+  if (sodium_init() < 0)
+  {
+    fprintf(stderr, "libsodium initialization failed!\n");
+    return ExitFailure;
+  }
+
+  return run(app);
+}
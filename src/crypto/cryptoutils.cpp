@@ -1,20 +1,108 @@
 #include "cryptoutils.h"
+#include "../utils/metrics.h"
+#include "../utils/tracing.h"
 #include <sodium.h>
 #include <QDebug>
 #include <QRandomGenerator>
+#include <QIODevice>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QtConcurrent>
+#include <limits>
+#include <utility>
+
+namespace
+{
+  constexpr qint64 STREAM_HEADER_SIZE = crypto_secretstream_xchacha20poly1305_HEADERBYTES;
+  constexpr qint64 STREAM_TAG_SIZE = crypto_secretstream_xchacha20poly1305_ABYTES;
+
+  // Shared by both decrypt overloads, out must hold ciphertext size - ABYTES bytes
+  unsigned long long decryptInto(QByteArrayView ciphertext, QByteArrayView key, QByteArrayView nonce, char *out,
+                                 QByteArrayView associatedData)
+  {
+    unsigned long long decrypted_len = 0;
+    if (crypto_aead_xchacha20poly1305_ietf_decrypt(
+            reinterpret_cast<unsigned char *>(out), &decrypted_len,
+            nullptr,
+            reinterpret_cast<const unsigned char *>(ciphertext.data()), ciphertext.size(),
+            reinterpret_cast<const unsigned char *>(associatedData.constData()), associatedData.size(),
+            reinterpret_cast<const unsigned char *>(nonce.data()),
+            reinterpret_cast<const unsigned char *>(key.data())) != 0)
+    {
+      throw CryptoUtils::CryptoOperationError("Decryption failed - incorrect password or corrupted file");
+    }
+    return decrypted_len;
+  }
+
+  void checkDecryptInputs(QByteArrayView ciphertext, QByteArrayView key, QByteArrayView nonce)
+  {
+    if (ciphertext.size() < static_cast<qsizetype>(crypto_aead_xchacha20poly1305_ietf_ABYTES))
+    {
+      throw CryptoUtils::CryptoOperationError("Ciphertext is too short");
+    }
+    if (nonce.size() != static_cast<qsizetype>(crypto_aead_xchacha20poly1305_ietf_NPUBBYTES))
+    {
+      throw CryptoUtils::CryptoOperationError("Invalid nonce size");
+    }
+    if (key.size() != static_cast<qsizetype>(crypto_aead_xchacha20poly1305_ietf_KEYBYTES))
+    {
+      throw CryptoUtils::CryptoOperationError("Invalid key size");
+    }
+  }
+
+  // Reads the next chunk on the thread pool, so disk I/O overlaps with the crypto
+  // of the current chunk. The device is only touched by one thread at a time
+  QFuture<QByteArray> readChunkAsync(QIODevice &source, qint64 size)
+  {
+    return QtConcurrent::run([&source, size]()
+                             { return source.read(size); });
+  }
+}
 
 namespace CryptoUtils
 {
-  QByteArray deriveKeyFromPassword(const QString &password, const QByteArray &salt)
+  KdfParams KdfParams::interactive()
   {
-    QByteArray key(crypto_aead_xchacha20poly1305_ietf_KEYBYTES, 0);
-    if (crypto_pwhash(
-            reinterpret_cast<unsigned char *>(key.data()), key.size(),
-            password.toUtf8().constData(), password.toUtf8().size(),
-            reinterpret_cast<const unsigned char *>(salt.constData()),
-            crypto_pwhash_OPSLIMIT_INTERACTIVE,
-            crypto_pwhash_MEMLIMIT_INTERACTIVE,
-            crypto_pwhash_ALG_DEFAULT) != 0)
+    return {crypto_pwhash_ALG_DEFAULT, crypto_pwhash_OPSLIMIT_INTERACTIVE, crypto_pwhash_MEMLIMIT_INTERACTIVE};
+  }
+
+  bool KdfParams::isValid() const
+  {
+    return (algorithm == crypto_pwhash_ALG_ARGON2ID13 || algorithm == crypto_pwhash_ALG_ARGON2I13) &&
+           opsLimit >= crypto_pwhash_OPSLIMIT_MIN && opsLimit <= crypto_pwhash_OPSLIMIT_MAX &&
+           memLimit >= crypto_pwhash_MEMLIMIT_MIN && memLimit <= crypto_pwhash_MEMLIMIT_MAX;
+  }
+
+  SecureMemory::Buffer deriveKeyFromPassword(const QString &password, const QByteArray &salt)
+  {
+    return deriveKeyFromPassword(password, salt, KdfParams::interactive());
+  }
+
+  SecureMemory::Buffer deriveKeyFromPassword(const QString &password, const QByteArray &salt, const KdfParams &params)
+  {
+    TRACE_SPAN("crypto", "CryptoUtils::deriveKeyFromPassword");
+    if (!params.isValid())
+    {
+      throw CryptoOperationError("Invalid key derivation parameters");
+    }
+    if (salt.size() != crypto_pwhash_SALTBYTES)
+    {
+      throw CryptoOperationError("Invalid salt size for key derivation");
+    }
+
+    SecureMemory::Buffer utf8 = SecureMemory::Buffer::fromString(password);
+    SecureMemory::Buffer key(crypto_aead_xchacha20poly1305_ietf_KEYBYTES);
+    Metrics::increment(Metrics::Counter::KdfInvocations);
+    Metrics::ScopedLatency latency(Metrics::Operation::KeyDerivation);
+    int result = crypto_pwhash(
+        reinterpret_cast<unsigned char *>(key.data()), key.size(),
+        utf8.constData(), utf8.size(),
+        reinterpret_cast<const unsigned char *>(salt.constData()),
+        params.opsLimit,
+        static_cast<size_t>(params.memLimit),
+        params.algorithm);
+
+    if (result != 0)
     {
       qWarning() << "Key derivation failed!";
       throw CryptoOperationError("Key derivation failed");
@@ -22,18 +110,105 @@ namespace CryptoUtils
     return key;
   }
 
-  bool encrypt(const QByteArray &plain, const QByteArray &key, QByteArray &outCiphertext, QByteArray &outNonce)
+  KdfParams calibrateKdf(int targetMilliseconds, quint64 memoryBudget)
+  {
+    TRACE_SPAN("crypto", "CryptoUtils::calibrateKdf");
+    const KdfParams floor = KdfParams::interactive();
+    const QByteArray salt(crypto_pwhash_SALTBYTES, 0);
+
+    // A run that cannot allocate its memory counts as too slow, so the loop below halves it
+    constexpr qint64 OUT_OF_MEMORY = std::numeric_limits<qint64>::max();
+    auto measure = [&salt](const KdfParams &params)
+    {
+      QElapsedTimer timer;
+      timer.start();
+      try
+      {
+        deriveKeyFromPassword(QStringLiteral("calibration"), salt, params);
+      }
+      catch (const CryptoOperationError &)
+      {
+        qWarning() << "Key derivation with memlimit" << params.memLimit << "failed during calibration";
+        return OUT_OF_MEMORY;
+      }
+      return qMax<qint64>(timer.elapsed(), 1);
+    };
+
+    // Memory is the expensive resource for an attacker, so use as much of the
+    // budget as fits into the target with a single pass, then add passes
+    KdfParams params{crypto_pwhash_ALG_ARGON2ID13, crypto_pwhash_OPSLIMIT_MIN,
+                     qBound<quint64>(floor.memLimit, memoryBudget, crypto_pwhash_MEMLIMIT_MAX)};
+    qint64 elapsed = measure(params);
+    while (elapsed > targetMilliseconds && params.memLimit / 2 >= floor.memLimit)
+    {
+      params.memLimit /= 2;
+      elapsed = measure(params);
+    }
+    if (elapsed == OUT_OF_MEMORY)
+    {
+      throw CryptoOperationError("Not enough memory for key derivation");
+    }
+
+    // Argon2 time grows linearly with the number of passes
+    params.opsLimit = qBound<quint64>(crypto_pwhash_OPSLIMIT_MIN, static_cast<quint64>(targetMilliseconds / elapsed),
+                                      crypto_pwhash_OPSLIMIT_MAX);
+
+    // Never trade below the total work of the fixed parameters
+    quint64 floorWork = floor.opsLimit * (floor.memLimit / 1024);
+    quint64 memKiB = params.memLimit / 1024;
+    if (params.opsLimit * memKiB < floorWork)
+    {
+      params.opsLimit = (floorWork + memKiB - 1) / memKiB;
+    }
+
+    qDebug() << "Calibrated key derivation: opslimit" << params.opsLimit << "memlimit" << params.memLimit
+             << "for a target of" << targetMilliseconds << "ms";
+    return params;
+  }
+
+  SecureMemory::Buffer deriveSubkey(QByteArrayView masterKey, quint64 subkeyId, const char *context)
   {
+    if (masterKey.size() != crypto_kdf_KEYBYTES)
+    {
+      throw CryptoOperationError("Invalid master key size for subkey derivation");
+    }
+
+    SecureMemory::Buffer subkey(crypto_aead_xchacha20poly1305_ietf_KEYBYTES);
+    if (crypto_kdf_derive_from_key(
+            reinterpret_cast<unsigned char *>(subkey.data()), subkey.size(),
+            subkeyId, context,
+            reinterpret_cast<const unsigned char *>(masterKey.constData())) != 0)
+    {
+      throw CryptoOperationError("Subkey derivation failed");
+    }
+    return subkey;
+  }
+
+  SecureMemory::Buffer expandRootKey(QByteArrayView rootKey, RootSubkey purpose)
+  {
+    return deriveSubkey(rootKey, static_cast<quint64>(purpose), "pmroot__");
+  }
+
+  bool encrypt(QByteArrayView plain, QByteArrayView key, QByteArray &outCiphertext, QByteArray &outNonce,
+               QByteArrayView associatedData)
+  {
+    TRACE_SPAN("crypto", "CryptoUtils::encrypt");
+    if (key.size() != static_cast<qsizetype>(crypto_aead_xchacha20poly1305_ietf_KEYBYTES))
+    {
+      throw CryptoOperationError("Invalid key size");
+    }
+
     outNonce.resize(crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
     randombytes_buf(outNonce.data(), outNonce.size());
 
-    QByteArray ciphertext(plain.size() + crypto_aead_xchacha20poly1305_ietf_ABYTES, 0);
+    // Encrypt straight into the output instead of copying a temporary buffer
+    outCiphertext.resize(plain.size() + crypto_aead_xchacha20poly1305_ietf_ABYTES);
 
     unsigned long long ciphertext_len;
     if (crypto_aead_xchacha20poly1305_ietf_encrypt(
-            reinterpret_cast<unsigned char *>(ciphertext.data()), &ciphertext_len,
+            reinterpret_cast<unsigned char *>(outCiphertext.data()), &ciphertext_len,
             reinterpret_cast<const unsigned char *>(plain.data()), plain.size(),
-            nullptr, 0, // Additional data (not used)
+            reinterpret_cast<const unsigned char *>(associatedData.constData()), associatedData.size(),
             nullptr,
             reinterpret_cast<const unsigned char *>(outNonce.data()),
             reinterpret_cast<const unsigned char *>(key.data())) != 0)
@@ -41,32 +216,275 @@ namespace CryptoUtils
       throw CryptoOperationError("Failed to encrypt vault data");
     }
 
-    ciphertext.resize(ciphertext_len);
-    outCiphertext = ciphertext;
+    outCiphertext.resize(ciphertext_len);
     return true;
   }
 
-  bool decrypt(const QByteArray &ciphertext, const QByteArray &key, const QByteArray &nonce, QByteArray &outPlain)
+  bool decrypt(QByteArrayView ciphertext, QByteArrayView key, QByteArrayView nonce, QByteArray &outPlain,
+               QByteArrayView associatedData)
   {
-    QByteArray decrypted(ciphertext.size() - crypto_aead_xchacha20poly1305_ietf_ABYTES, 0);
-    unsigned long long decrypted_len;
+    TRACE_SPAN("crypto", "CryptoUtils::decrypt");
+    checkDecryptInputs(ciphertext, key, nonce);
 
-    if (crypto_aead_xchacha20poly1305_ietf_decrypt(
-            reinterpret_cast<unsigned char *>(decrypted.data()), &decrypted_len,
-            nullptr,
-            reinterpret_cast<const unsigned char *>(ciphertext.data()), ciphertext.size(),
-            nullptr, 0,
-            reinterpret_cast<const unsigned char *>(nonce.data()),
-            reinterpret_cast<const unsigned char *>(key.data())) != 0)
+    // Decrypt straight into the output instead of copying a temporary buffer
+    outPlain.resize(ciphertext.size() - crypto_aead_xchacha20poly1305_ietf_ABYTES);
+    try
     {
-      throw CryptoOperationError("Decryption failed - incorrect password or corrupted file");
+      outPlain.resize(decryptInto(ciphertext, key, nonce, outPlain.data(), associatedData));
     }
+    catch (const CryptoOperationError &)
+    {
+      // Leave the buffer allocated, it may be locked memory the caller still has to release
+      outPlain.fill(0);
+      throw;
+    }
+    return true;
+  }
 
-    decrypted.resize(decrypted_len);
-    outPlain = decrypted;
+  bool decrypt(QByteArrayView ciphertext, QByteArrayView key, QByteArrayView nonce, SecureMemory::Buffer &outPlain,
+               QByteArrayView associatedData)
+  {
+    TRACE_SPAN("crypto", "CryptoUtils::decrypt");
+    checkDecryptInputs(ciphertext, key, nonce);
+
+    outPlain.resize(ciphertext.size() - crypto_aead_xchacha20poly1305_ietf_ABYTES);
+    try
+    {
+      outPlain.resize(decryptInto(ciphertext, key, nonce, outPlain.data(), associatedData));
+    }
+    catch (const CryptoOperationError &)
+    {
+      outPlain.clear();
+      throw;
+    }
     return true;
   }
 
+  bool lockMemory(QByteArray &buffer)
+  {
+    if (buffer.isEmpty())
+    {
+      return false;
+    }
+    // data() detaches, so the locked pages belong to this buffer only
+    return sodium_mlock(buffer.data(), buffer.size()) == 0;
+  }
+
+  void unlockMemory(QByteArray &buffer)
+  {
+    if (buffer.isEmpty())
+    {
+      return;
+    }
+    // sodium_munlock zeroes the memory before unlocking it
+    sodium_munlock(buffer.data(), buffer.size());
+    buffer.clear();
+  }
+
+  LockedBytes::LockedBytes(qsizetype size)
+      : m_bytes(size, Qt::Uninitialized)
+  {
+    lockMemory(m_bytes);
+  }
+
+  LockedBytes::LockedBytes(LockedBytes &&other) noexcept
+      : m_bytes(std::exchange(other.m_bytes, QByteArray()))
+  {
+  }
+
+  LockedBytes &LockedBytes::operator=(LockedBytes &&other) noexcept
+  {
+    if (this != &other)
+    {
+      unlockMemory(m_bytes);
+      m_bytes = std::exchange(other.m_bytes, QByteArray());
+    }
+    return *this;
+  }
+
+  LockedBytes::~LockedBytes()
+  {
+    unlockMemory(m_bytes);
+  }
+
+  void LockedBytes::clear()
+  {
+    unlockMemory(m_bytes);
+  }
+
+  qint64 encryptStream(QIODevice &source, qint64 length, QIODevice &target, QByteArrayView key,
+                       const QByteArray &associatedData)
+  {
+    TRACE_SPAN("crypto", "CryptoUtils::encryptStream");
+    if (key.size() != crypto_secretstream_xchacha20poly1305_KEYBYTES || length < 0)
+    {
+      throw CryptoOperationError("Invalid stream encryption parameters");
+    }
+
+    crypto_secretstream_xchacha20poly1305_state state;
+    QByteArray header(STREAM_HEADER_SIZE, 0);
+    crypto_secretstream_xchacha20poly1305_init_push(&state, reinterpret_cast<unsigned char *>(header.data()),
+                                                    reinterpret_cast<const unsigned char *>(key.constData()));
+    if (target.write(header) != header.size())
+    {
+      sodium_memzero(&state, sizeof(state));
+      throw CryptoOperationError("Failed to write encrypted stream header");
+    }
+
+    qint64 written = header.size();
+    qint64 remaining = length;
+    QByteArray cipherChunk(STREAM_CHUNK_SIZE + STREAM_TAG_SIZE, 0);
+    QFuture<QByteArray> next = readChunkAsync(source, qMin(remaining, STREAM_CHUNK_SIZE));
+
+    try
+    {
+      // An empty input still produces one (final) chunk
+      bool first = true;
+      bool last = false;
+      while (!last)
+      {
+        QByteArray chunk = next.result();
+        if (chunk.size() != qMin(remaining, STREAM_CHUNK_SIZE))
+        {
+          chunk.fill(0);
+          throw CryptoOperationError("Unexpected end of stream input");
+        }
+
+        remaining -= chunk.size();
+        last = remaining == 0;
+        if (!last)
+        {
+          next = readChunkAsync(source, qMin(remaining, STREAM_CHUNK_SIZE));
+        }
+
+        // Only the first chunk carries the associated data, the chunks are chained
+        unsigned long long cipherLength = 0;
+        crypto_secretstream_xchacha20poly1305_push(
+            &state, reinterpret_cast<unsigned char *>(cipherChunk.data()), &cipherLength,
+            reinterpret_cast<const unsigned char *>(chunk.constData()), chunk.size(),
+            first ? reinterpret_cast<const unsigned char *>(associatedData.constData()) : nullptr,
+            first ? associatedData.size() : 0,
+            last ? crypto_secretstream_xchacha20poly1305_TAG_FINAL : crypto_secretstream_xchacha20poly1305_TAG_MESSAGE);
+        chunk.fill(0);
+        first = false;
+
+        if (target.write(cipherChunk.constData(), cipherLength) != static_cast<qint64>(cipherLength))
+        {
+          throw CryptoOperationError("Failed to write encrypted stream chunk");
+        }
+        written += cipherLength;
+      }
+    }
+    catch (...)
+    {
+      // The prefetch still references source
+      next.waitForFinished();
+      sodium_memzero(&state, sizeof(state));
+      throw;
+    }
+
+    sodium_memzero(&state, sizeof(state));
+    return written;
+  }
+
+  qint64 decryptStream(QIODevice &source, qint64 length, QIODevice &target, QByteArrayView key,
+                       const QByteArray &associatedData)
+  {
+    TRACE_SPAN("crypto", "CryptoUtils::decryptStream");
+    if (key.size() != crypto_secretstream_xchacha20poly1305_KEYBYTES)
+    {
+      throw CryptoOperationError("Invalid stream decryption key");
+    }
+    if (length < STREAM_HEADER_SIZE + STREAM_TAG_SIZE)
+    {
+      throw CryptoOperationError("Encrypted stream is too short");
+    }
+
+    QByteArray header = source.read(STREAM_HEADER_SIZE);
+    crypto_secretstream_xchacha20poly1305_state state;
+    if (header.size() != STREAM_HEADER_SIZE ||
+        crypto_secretstream_xchacha20poly1305_init_pull(&state, reinterpret_cast<const unsigned char *>(header.constData()),
+                                                        reinterpret_cast<const unsigned char *>(key.constData())) != 0)
+    {
+      throw CryptoOperationError("Invalid encrypted stream header");
+    }
+
+    const qint64 CIPHER_CHUNK_SIZE = STREAM_CHUNK_SIZE + STREAM_TAG_SIZE;
+    qint64 written = 0;
+    qint64 remaining = length - STREAM_HEADER_SIZE;
+    // Locked, the chunks are plaintext
+    SecureMemory::Buffer plainChunk(STREAM_CHUNK_SIZE);
+    QFuture<QByteArray> next = readChunkAsync(source, qMin(remaining, CIPHER_CHUNK_SIZE));
+
+    try
+    {
+      bool first = true;
+      bool last = false;
+      while (!last)
+      {
+        QByteArray chunk = next.result();
+        if (chunk.size() != qMin(remaining, CIPHER_CHUNK_SIZE) || chunk.size() < STREAM_TAG_SIZE)
+        {
+          throw CryptoOperationError("Encrypted stream is truncated");
+        }
+
+        remaining -= chunk.size();
+        last = remaining == 0;
+        if (!last)
+        {
+          next = readChunkAsync(source, qMin(remaining, CIPHER_CHUNK_SIZE));
+        }
+
+        unsigned long long plainLength = 0;
+        unsigned char tag = 0;
+        if (crypto_secretstream_xchacha20poly1305_pull(
+                &state, reinterpret_cast<unsigned char *>(plainChunk.data()), &plainLength, &tag,
+                reinterpret_cast<const unsigned char *>(chunk.constData()), chunk.size(),
+                first ? reinterpret_cast<const unsigned char *>(associatedData.constData()) : nullptr,
+                first ? associatedData.size() : 0) != 0)
+        {
+          throw CryptoOperationError("Decryption failed - incorrect password or corrupted file");
+        }
+        first = false;
+
+        // The final tag must sit exactly on the last chunk, anything else is a truncated or extended stream
+        if ((tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL) != last)
+        {
+          throw CryptoOperationError("Encrypted stream is truncated or has trailing data");
+        }
+
+        if (target.write(plainChunk.constData(), plainLength) != static_cast<qint64>(plainLength))
+        {
+          throw CryptoOperationError("Failed to write decrypted stream chunk");
+        }
+        written += plainLength;
+      }
+    }
+    catch (...)
+    {
+      next.waitForFinished();
+      sodium_memzero(&state, sizeof(state));
+      throw;
+    }
+
+    sodium_memzero(&state, sizeof(state));
+    return written;
+  }
+
+  qint64 streamPlaintextSize(qint64 streamLength)
+  {
+    const qint64 CIPHER_CHUNK_SIZE = STREAM_CHUNK_SIZE + STREAM_TAG_SIZE;
+    qint64 body = streamLength - STREAM_HEADER_SIZE;
+    if (body < STREAM_TAG_SIZE)
+    {
+      return -1;
+    }
+
+    qint64 chunks = (body + CIPHER_CHUNK_SIZE - 1) / CIPHER_CHUNK_SIZE;
+    qint64 plain = body - chunks * STREAM_TAG_SIZE;
+    return plain >= 0 ? plain : -1;
+  }
+
   QString generateRandomPassword(int length)
   {
     const QString validCharacters = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789!@#$%^&*()-_=+";
@@ -2,7 +2,11 @@
 #define CRYPTOUTILS_H
 
 #include <QByteArray>
+#include <QByteArrayView>
 #include <QString>
+#include "securememory.h"
+
+class QIODevice;
 
 namespace CryptoUtils
 {
@@ -16,14 +20,96 @@ namespace CryptoUtils
         : std::runtime_error(message) {}
   };
 
+  /**
+   * @brief Cost parameters of the password hash (crypto_pwhash)
+   */
+  struct KdfParams
+  {
+    int algorithm = 0;     // crypto_pwhash_ALG_* identifier
+    quint64 opsLimit = 0;  // Number of passes
+    quint64 memLimit = 0;  // Memory in bytes
+
+    /**
+     * @brief The fixed INTERACTIVE parameters used before they were stored in the vault
+     */
+    static KdfParams interactive();
+
+    /**
+     * @brief Check the parameters against the limits libsodium accepts
+     */
+    bool isValid() const;
+  };
+
+  /**
+   * @brief Target unlock latency calibrateKdf aims for by default
+   */
+  constexpr int KDF_TARGET_MILLISECONDS = 500;
+
+  /**
+   * @brief Memory calibrateKdf may use by default
+   */
+  constexpr quint64 KDF_MEMORY_BUDGET = 256ull * 1024 * 1024;
+
   /**
    * @brief Derives a cryptographic key from a password and salt using Argon2
+   * Uses the INTERACTIVE parameters, for vaults and entries that do not store their own
    * @param password The user's password
    * @param salt A unique salt for this operation
-   * @return The derived key as QByteArray
+   * @return The derived key in locked memory
    * @throws CryptoOperationError if key derivation fails
    */
-  QByteArray deriveKeyFromPassword(const QString &password, const QByteArray &salt);
+  SecureMemory::Buffer deriveKeyFromPassword(const QString &password, const QByteArray &salt);
+
+  /**
+   * @brief Derives a cryptographic key from a password and salt with explicit cost parameters
+   * @throws CryptoOperationError if the parameters are invalid or key derivation fails
+   */
+  SecureMemory::Buffer deriveKeyFromPassword(const QString &password, const QByteArray &salt, const KdfParams &params);
+
+  /**
+   * @brief Pick the strongest Argon2id parameters that meet a latency target on this machine
+   * Uses as much of the memory budget as the target allows and spends the remaining
+   * time on additional passes. Never returns parameters weaker than interactive(),
+   * even if those miss the target on slow hardware. A memory size that cannot be
+   * allocated is halved like one that misses the target
+   * @param targetMilliseconds Unlock latency to aim for
+   * @param memoryBudget Upper bound for memLimit in bytes
+   * @throws CryptoOperationError if even the memory of interactive() cannot be allocated
+   */
+  KdfParams calibrateKdf(int targetMilliseconds = KDF_TARGET_MILLISECONDS,
+                         quint64 memoryBudget = KDF_MEMORY_BUDGET);
+
+  /**
+   * @brief Derives a subkey from an already stretched master key using the libsodium KDF
+   * Unlike deriveKeyFromPassword this is a single BLAKE2b call and costs microseconds
+   * @param masterKey The master key (crypto_kdf_KEYBYTES long)
+   * @param subkeyId Identifier selecting the subkey
+   * @param context Exactly 8 characters describing what the subkey is used for
+   * @return The derived subkey in locked memory
+   * @throws CryptoOperationError if the master key has the wrong size or derivation fails
+   */
+  SecureMemory::Buffer deriveSubkey(QByteArrayView masterKey, quint64 subkeyId, const char *context);
+
+  /**
+   * @brief Purposes of the keys expanded from the per-unlock root key
+   * The root key is the only key produced by deriveKeyFromPassword, every
+   * other key is an independent KDF subkey of it
+   */
+  enum class RootSubkey : quint64
+  {
+    Vault = 1,    // Encrypts the vault file payload
+    Password = 2, // Master key for per-entry password encryption
+    Journal = 3,  // Encrypts the records of the append-only journal
+  };
+
+  /**
+   * @brief Expands a subkey for the given purpose from the root key
+   * @param rootKey The root key derived from the master password
+   * @param purpose What the subkey will be used for
+   * @return The derived subkey in locked memory
+   * @throws CryptoOperationError if derivation fails
+   */
+  SecureMemory::Buffer expandRootKey(QByteArrayView rootKey, RootSubkey purpose);
 
   /**
    * @brief Encrypts plaintext data using a symmetric key
@@ -31,21 +117,129 @@ namespace CryptoUtils
    * @param key The symmetric key to use for encryption
    * @param outCiphertext The resulting ciphertext
    * @param outNonce The nonce used for encryption
+   * @param associatedData Optional data that is authenticated but not encrypted
    * @return true if encryption was successful, false otherwise
    * * @throws CryptoOperationError if encryption fails
    */
-  bool encrypt(const QByteArray &plain, const QByteArray &key, QByteArray &outCiphertext, QByteArray &outNonce);
+  bool encrypt(QByteArrayView plain, QByteArrayView key, QByteArray &outCiphertext, QByteArray &outNonce,
+               QByteArrayView associatedData = QByteArrayView());
 
   /**
    * @brief Decrypts ciphertext data using a symmetric key
+   * The inputs may be views into a memory mapped file. The plaintext is written
+   * straight into outPlain, which is reused if it already has the right size
+   * (for example a buffer locked with lockMemory)
    * @param ciphertext The data to decrypt
    * @param key The symmetric key to use for decryption
    * @param nonce The nonce used for decryption
    * @param outPlain The resulting plaintext
+   * @param associatedData Optional data that was authenticated during encryption
    * @return true if decryption was successful, false otherwise
    * @throws CryptoOperationError if decryption fails
    */
-  bool decrypt(const QByteArray &ciphertext, const QByteArray &key, const QByteArray &nonce, QByteArray &outPlain);
+  bool decrypt(QByteArrayView ciphertext, QByteArrayView key, QByteArrayView nonce, QByteArray &outPlain,
+               QByteArrayView associatedData = QByteArrayView());
+
+  /**
+   * @brief Decrypts ciphertext data straight into locked memory
+   * For plaintext that is secret itself (entry passwords), see the QByteArray overload
+   * @throws CryptoOperationError if decryption fails
+   */
+  bool decrypt(QByteArrayView ciphertext, QByteArrayView key, QByteArrayView nonce, SecureMemory::Buffer &outPlain,
+               QByteArrayView associatedData = QByteArrayView());
+
+  /**
+   * @brief Keeps the memory of a buffer out of swap (best effort, sodium_mlock)
+   * The buffer must not be resized or shared afterwards, release it with unlockMemory
+   * @param buffer Buffer holding, or about to hold, sensitive data
+   * @return true if the pages were locked
+   */
+  bool lockMemory(QByteArray &buffer);
+
+  /**
+   * @brief Wipes a buffer and unlocks its memory again (sodium_munlock)
+   * Also safe for buffers that were never locked
+   */
+  void unlockMemory(QByteArray &buffer);
+
+  /**
+   * @brief QByteArray held in locked memory for as long as the guard lives
+   * For plaintext that has to be a QByteArray (QBuffer targets, the payload
+   * decoders). The destructor wipes and unlocks it, so an exception between
+   * decryption and use cannot leave the plaintext behind. Move only, do not
+   * keep copies of bytes() past the guard
+   */
+  class LockedBytes
+  {
+  public:
+    LockedBytes() = default;
+
+    /**
+     * @brief Uninitialized buffer of the given size, locked right away
+     */
+    explicit LockedBytes(qsizetype size);
+
+    LockedBytes(LockedBytes &&other) noexcept;
+    LockedBytes &operator=(LockedBytes &&other) noexcept;
+    LockedBytes(const LockedBytes &) = delete;
+    LockedBytes &operator=(const LockedBytes &) = delete;
+    ~LockedBytes();
+
+    QByteArray &bytes() { return m_bytes; }
+    const QByteArray &bytes() const { return m_bytes; }
+    qsizetype size() const { return m_bytes.size(); }
+    bool isEmpty() const { return m_bytes.isEmpty(); }
+
+    /**
+     * @brief Wipe and unlock the contents now instead of at destruction
+     */
+    void clear();
+
+  private:
+    QByteArray m_bytes;
+  };
+
+  /**
+   * @brief Plaintext bytes per chunk of an encrypted stream
+   * Bounds the memory used by encryptStream and decryptStream regardless of the stream size
+   */
+  constexpr qint64 STREAM_CHUNK_SIZE = 64 * 1024;
+
+  /**
+   * @brief Encrypts data from one device to another in chunks (crypto_secretstream)
+   * Layout: stream header | chunks, every chunk but the last holds STREAM_CHUNK_SIZE
+   * plaintext bytes and the last one is tagged as final. The next chunk is read on
+   * the thread pool while the current one is encrypted and written
+   * @param source Device positioned at the plaintext
+   * @param length Number of plaintext bytes to read from source
+   * @param target Device the stream is written to
+   * @param key The symmetric key to use for encryption
+   * @param associatedData Optional data that is authenticated but not encrypted
+   * @return Number of bytes written to target
+   * @throws CryptoOperationError if reading, encryption or writing fails
+   */
+  qint64 encryptStream(QIODevice &source, qint64 length, QIODevice &target, QByteArrayView key,
+                       const QByteArray &associatedData = QByteArray());
+
+  /**
+   * @brief Decrypts a stream written by encryptStream in chunks
+   * Fails if the stream is truncated, reordered or continues after the final chunk
+   * @param source Device positioned at the stream header
+   * @param length Size of the encrypted stream in bytes
+   * @param target Device the plaintext is written to
+   * @param key The symmetric key to use for decryption
+   * @param associatedData Optional data that was authenticated during encryption
+   * @return Number of plaintext bytes written to target
+   * @throws CryptoOperationError if reading, decryption or writing fails
+   */
+  qint64 decryptStream(QIODevice &source, qint64 length, QIODevice &target, QByteArrayView key,
+                       const QByteArray &associatedData = QByteArray());
+
+  /**
+   * @brief Size of the plaintext held by an encrypted stream of the given size
+   * @return Plaintext size, or -1 if no stream has that size
+   */
+  qint64 streamPlaintextSize(qint64 streamLength);
 
   QString generateRandomPassword(int length = 16);
 }
@@ -0,0 +1,276 @@
+#include "securememory.h"
+#include <QMutex>
+#include <QMutexLocker>
+#include <QStringEncoder>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <utility>
+#include <vector>
+#include <sodium.h>
+
+namespace
+{
+  constexpr int CLASS_COUNT = static_cast<int>(std::size(SecureMemory::SIZE_CLASSES));
+
+  int sizeClassFor(qsizetype size)
+  {
+    for (int i = 0; i < CLASS_COUNT; ++i)
+    {
+      if (size <= SecureMemory::SIZE_CLASSES[i])
+      {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  // Free lists per size class over slabs from sodium_malloc. Slabs are kept for
+  // the lifetime of the process, so a block is never handed back to the general
+  // allocator and the hot path only takes a lock and pops a pointer
+  class Arena
+  {
+  public:
+    Arena()
+    {
+      // sodium_malloc needs an initialised library, sodium_init is idempotent
+      if (sodium_init() < 0)
+      {
+        throw std::bad_alloc();
+      }
+    }
+
+    char *allocate(int sizeClass)
+    {
+      QMutexLocker locker(&m_mutex);
+      std::vector<char *> &freeBlocks = m_freeBlocks[sizeClass];
+      if (freeBlocks.empty())
+      {
+        addSlab(sizeClass);
+      }
+
+      char *block = freeBlocks.back();
+      freeBlocks.pop_back();
+      ++m_stats.blocksInUse;
+      return block;
+    }
+
+    void release(int sizeClass, char *block)
+    {
+      sodium_memzero(block, SecureMemory::SIZE_CLASSES[sizeClass]);
+      QMutexLocker locker(&m_mutex);
+      m_freeBlocks[sizeClass].push_back(block);
+      --m_stats.blocksInUse;
+    }
+
+    char *allocateLarge(qsizetype size)
+    {
+      // sodium_malloc fills new memory with garbage bytes
+      char *block = static_cast<char *>(sodium_malloc(size));
+      if (!block)
+      {
+        throw std::bad_alloc();
+      }
+      sodium_memzero(block, size);
+
+      QMutexLocker locker(&m_mutex);
+      ++m_stats.largeAllocations;
+      return block;
+    }
+
+    void releaseLarge(char *block)
+    {
+      // sodium_free wipes the memory before unlocking it
+      sodium_free(block);
+      QMutexLocker locker(&m_mutex);
+      --m_stats.largeAllocations;
+    }
+
+    SecureMemory::ArenaStats stats()
+    {
+      QMutexLocker locker(&m_mutex);
+      return m_stats;
+    }
+
+  private:
+    void addSlab(int sizeClass)
+    {
+      const qsizetype blockSize = SecureMemory::SIZE_CLASSES[sizeClass];
+      const qsizetype blockCount = qMax<qsizetype>(SecureMemory::SLAB_SIZE / blockSize, 1);
+
+      char *slab = static_cast<char *>(sodium_malloc(blockSize * blockCount));
+      if (!slab)
+      {
+        throw std::bad_alloc();
+      }
+      sodium_memzero(slab, blockSize * blockCount);
+
+      std::vector<char *> &freeBlocks = m_freeBlocks[sizeClass];
+      for (qsizetype i = blockCount - 1; i >= 0; --i)
+      {
+        freeBlocks.push_back(slab + i * blockSize);
+      }
+      m_stats.slabBytes += blockSize * blockCount;
+    }
+
+    QMutex m_mutex;
+    std::vector<char *> m_freeBlocks[CLASS_COUNT];
+    SecureMemory::ArenaStats m_stats;
+  };
+
+  Arena &arena()
+  {
+    // Never destroyed: buffers held by static objects may be released after main returns
+    static Arena *instance = new Arena();
+    return *instance;
+  }
+}
+
+namespace SecureMemory
+{
+  char *allocate(qsizetype size, qsizetype &outCapacity)
+  {
+    int sizeClass = sizeClassFor(size);
+    if (sizeClass < 0)
+    {
+      outCapacity = size;
+      return arena().allocateLarge(size);
+    }
+
+    outCapacity = SIZE_CLASSES[sizeClass];
+    return arena().allocate(sizeClass);
+  }
+
+  void release(char *block, qsizetype capacity)
+  {
+    if (!block)
+    {
+      return;
+    }
+
+    int sizeClass = sizeClassFor(capacity);
+    if (sizeClass >= 0 && SIZE_CLASSES[sizeClass] == capacity)
+    {
+      arena().release(sizeClass, block);
+    }
+    else
+    {
+      arena().releaseLarge(block);
+    }
+  }
+
+  ArenaStats stats()
+  {
+    return arena().stats();
+  }
+
+  Buffer::Buffer(qsizetype size)
+  {
+    resize(size);
+  }
+
+  Buffer::Buffer(QByteArrayView data)
+  {
+    resize(data.size());
+    if (m_size > 0)
+    {
+      memcpy(m_data, data.data(), m_size);
+    }
+  }
+
+  Buffer Buffer::fromString(QStringView text)
+  {
+    QStringEncoder encoder(QStringEncoder::Utf8);
+    Buffer buffer(encoder.requiredSpace(text.size()));
+    if (buffer.isEmpty())
+    {
+      return buffer;
+    }
+
+    char *end = encoder.appendToBuffer(buffer.data(), text);
+    buffer.resize(end - buffer.data());
+    return buffer;
+  }
+
+  Buffer::Buffer(const Buffer &other)
+      : Buffer(other.view())
+  {
+  }
+
+  Buffer::Buffer(Buffer &&other) noexcept
+      : m_data(other.m_data), m_size(other.m_size), m_capacity(other.m_capacity)
+  {
+    other.m_data = nullptr;
+    other.m_size = 0;
+    other.m_capacity = 0;
+  }
+
+  Buffer &Buffer::operator=(const Buffer &other)
+  {
+    if (this != &other)
+    {
+      Buffer copy(other);
+      *this = std::move(copy);
+    }
+    return *this;
+  }
+
+  Buffer &Buffer::operator=(Buffer &&other) noexcept
+  {
+    if (this != &other)
+    {
+      clear();
+      m_data = other.m_data;
+      m_size = other.m_size;
+      m_capacity = other.m_capacity;
+      other.m_data = nullptr;
+      other.m_size = 0;
+      other.m_capacity = 0;
+    }
+    return *this;
+  }
+
+  Buffer::~Buffer()
+  {
+    clear();
+  }
+
+  void Buffer::resize(qsizetype size)
+  {
+    if (size <= 0)
+    {
+      clear();
+      return;
+    }
+
+    if (size <= m_capacity)
+    {
+      // Blocks come zeroed and are wiped on shrink, so the tail is already zero
+      if (size < m_size)
+      {
+        sodium_memzero(m_data + size, m_size - size);
+      }
+      m_size = size;
+      return;
+    }
+
+    qsizetype capacity = 0;
+    char *block = allocate(size, capacity);
+    if (m_size > 0)
+    {
+      memcpy(block, m_data, m_size);
+    }
+    release(m_data, m_capacity);
+    m_data = block;
+    m_size = size;
+    m_capacity = capacity;
+  }
+
+  void Buffer::clear()
+  {
+    release(m_data, m_capacity);
+    m_data = nullptr;
+    m_size = 0;
+    m_capacity = 0;
+  }
+}
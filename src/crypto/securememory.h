@@ -0,0 +1,115 @@
+#ifndef SECUREMEMORY_H
+#define SECUREMEMORY_H
+
+#include <QByteArrayView>
+#include <QString>
+#include <QStringView>
+
+namespace SecureMemory
+{
+  /**
+   * @brief Block sizes the arena hands out, larger requests get their own sodium_malloc allocation
+   * Covers keys (32), subkey ids and nonces, entry passwords and small payloads
+   */
+  constexpr qsizetype SIZE_CLASSES[] = {32, 64, 256, 1024, 4096, 16384};
+
+  /**
+   * @brief Bytes requested from sodium_malloc at once to carve blocks of one size class from
+   */
+  constexpr qsizetype SLAB_SIZE = 64 * 1024;
+
+  /**
+   * @brief Counters of the secure arena, for diagnostics and benchmarks
+   */
+  struct ArenaStats
+  {
+    qint64 slabBytes = 0;        // Locked memory reserved for size classes
+    qint64 blocksInUse = 0;      // Size class blocks currently handed out
+    qint64 largeAllocations = 0; // Live allocations above the largest size class
+  };
+
+  /**
+   * @brief Take a zeroed block of at least size bytes from the locked arena
+   * Blocks live in sodium_malloc memory, which is mlocked and excluded from core dumps.
+   * Thread safe, freed blocks are reused instead of going back to the system
+   * @param size Requested size, must be positive
+   * @param outCapacity Usable size of the returned block
+   * @throws std::bad_alloc if no locked memory can be allocated
+   */
+  char *allocate(qsizetype size, qsizetype &outCapacity);
+
+  /**
+   * @brief Wipe a block and return it to the arena
+   * @param block Block from allocate, may be nullptr
+   * @param capacity Capacity allocate reported for the block
+   */
+  void release(char *block, qsizetype capacity);
+
+  ArenaStats stats();
+
+  /**
+   * @brief Owning buffer for key material and transient plaintext
+   * Lives in the locked arena and is wiped when it is destroyed, cleared or
+   * shrinks, so callers no longer fill(0) by hand. Copies are deep, each one
+   * holds its own arena block. Converts to QByteArrayView for the crypto API
+   */
+  class Buffer
+  {
+  public:
+    Buffer() = default;
+
+    /**
+     * @brief Zero filled buffer of the given size
+     */
+    explicit Buffer(qsizetype size);
+
+    /**
+     * @brief Copy of data in locked memory
+     */
+    explicit Buffer(QByteArrayView data);
+
+    /**
+     * @brief UTF-8 encoding of text, written straight into locked memory
+     */
+    static Buffer fromString(QStringView text);
+
+    Buffer(const Buffer &other);
+    Buffer(Buffer &&other) noexcept;
+    Buffer &operator=(const Buffer &other);
+    Buffer &operator=(Buffer &&other) noexcept;
+    ~Buffer();
+
+    char *data() { return m_data; }
+    const char *data() const { return m_data; }
+    const char *constData() const { return m_data; }
+    qsizetype size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+
+    /**
+     * @brief Change the size, keeping the contents
+     * Bytes cut off are wiped, new bytes are zero. Moves to a larger block only
+     * if the current one is too small
+     */
+    void resize(qsizetype size);
+
+    /**
+     * @brief Wipe the contents and give the block back to the arena
+     */
+    void clear();
+
+    QByteArrayView view() const { return QByteArrayView(m_data, m_size); }
+    operator QByteArrayView() const { return view(); }
+
+    /**
+     * @brief Decode the contents as UTF-8
+     */
+    QString toString() const { return QString::fromUtf8(m_data, m_size); }
+
+  private:
+    char *m_data = nullptr;
+    qsizetype m_size = 0;
+    qsizetype m_capacity = 0;
+  };
+}
+
+#endif // SECUREMEMORY_H
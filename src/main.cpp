@@ -1,4 +1,6 @@
 #include "ui/mainwindow.h"
+#include "utils/metrics.h"
+#include "utils/tracing.h"
 
 #include <QApplication>
 #include <QLocale>
@@ -9,6 +11,11 @@ int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
 
+    // --trace <file> or PASSWORDMANAGER_TRACE=<file> records spans and writes them at exit
+    Tracing::configure(a.arguments());
+    // --metrics <file> or PASSWORDMANAGER_METRICS=<file> writes the latency histograms at exit
+    Metrics::configure(a.arguments());
+
     if (sodium_init() < 0)
     {
         qFatal("libsodium initialization failed!");
@@ -27,5 +34,8 @@ int main(int argc, char *argv[])
     }
     MainWindow w;
     w.show();
-    return a.exec();
+    int result = a.exec();
+    Tracing::dump();
+    Metrics::dump();
+    return result;
 }
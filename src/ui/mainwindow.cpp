@@ -1,7 +1,14 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include "stackedwidget.h"
+#include "../utils/tracing.h"
 #include <QDebug>
+#include <QShortcut>
+
+namespace
+{
+  const QString VAULT_FILE = QStringLiteral("vault.txt");
+}
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent), ui(new Ui::MainWindow)
@@ -10,6 +17,7 @@ MainWindow::MainWindow(QWidget *parent)
 
   connect(ui->pushButton_2, &QPushButton::clicked, this, &MainWindow::onButtonClicked);
   connect(ui->lineEdit_2, &QLineEdit::returnPressed, this, &MainWindow::onPasswordEntered);
+  connect(ui->lineEdit_2, &QLineEdit::textEdited, this, &MainWindow::onPasswordEdited);
 
   ui->label->setVisible(false);
 
@@ -18,10 +26,32 @@ MainWindow::MainWindow(QWidget *parent)
 
   connect(lockButton, &QPushButton::clicked, this, &MainWindow::lockVault);
 
+  // Shown while the vault is being unlocked in the background
+  m_unlockProgress = new QProgressBar(this);
+  m_unlockProgress->setRange(0, 100);
+  m_unlockProgress->setVisible(false);
+  ui->statusbar->addPermanentWidget(m_unlockProgress);
+
   // ✅ Connect VaultManager signals to MainWindow slots
   connect(&m_vaultManager, &VaultManager::vaultOpened, this, &MainWindow::onVaultOpened);
   connect(&m_vaultManager, &VaultManager::vaultClosed, this, &MainWindow::onVaultClosed);
   connect(&m_vaultManager, &VaultManager::entryAdded, this, &MainWindow::onEntryAdded);
+  connect(&m_vaultManager, &VaultManager::unlockProgress, m_unlockProgress, &QProgressBar::setValue);
+  connect(&m_vaultManager, &VaultManager::vaultOpenFailed, this, &MainWindow::onVaultOpenFailed);
+  connect(&m_vaultManager, &VaultManager::vaultOpenCanceled, this, &MainWindow::onVaultOpenCanceled);
+  connect(&m_vaultManager, &VaultManager::writeFailed, this, [this](const QString &error)
+          { ui->statusbar->showMessage(tr("Changes not saved yet, retrying: %1").arg(error)); });
+
+  // The login page is showing, get the vault file ready while the password is typed
+  m_vaultManager.prefetchVault(VAULT_FILE);
+
+  // With tracing on, write the spans recorded so far without quitting
+  if (Tracing::isEnabled())
+  {
+    QShortcut *dumpTrace = new QShortcut(QKeySequence(tr("Ctrl+Alt+T")), this);
+    connect(dumpTrace, &QShortcut::activated, this, []()
+            { Tracing::dump(); });
+  }
 }
 
 MainWindow::~MainWindow()
@@ -36,17 +66,33 @@ void MainWindow::onButtonClicked()
 
 void MainWindow::openPasswordlist()
 {
+  // One list per unlock, its model follows the VaultManager signals until it is deleted
+  closePasswordlist();
+
   // Create the widget first
-  StackedWidget *passwordWidget = new StackedWidget(this);
+  m_passwordWidget = new StackedWidget(this);
 
   // Pass the VaultManager instance to the child widget
-  passwordWidget->setVaultManager(&m_vaultManager);
+  m_passwordWidget->setVaultManager(&m_vaultManager);
 
   // Add to stack and switch
-  ui->stackedWidget->insertWidget(1, passwordWidget);
+  ui->stackedWidget->insertWidget(1, m_passwordWidget);
   ui->stackedWidget->setCurrentIndex(1);
 }
 
+void MainWindow::closePasswordlist()
+{
+  if (!m_passwordWidget)
+  {
+    return;
+  }
+
+  // Deleted later, the widget may still be handling the event that locked the vault
+  ui->stackedWidget->removeWidget(m_passwordWidget);
+  m_passwordWidget->deleteLater();
+  m_passwordWidget = nullptr;
+}
+
 void MainWindow::onPasswordEntered()
 {
 
@@ -56,26 +102,28 @@ void MainWindow::onPasswordEntered()
 
   ui->label->setVisible(false);
 
-  // writeEncryptedFile("vault.txt", text);
+  // Unlock in the background, the result arrives through the VaultManager signals
+  m_unlockProgress->setValue(0);
+  m_unlockProgress->setVisible(true);
+  m_vaultManager.openVaultAsync(VAULT_FILE, password);
 
-  try
-  {
-    m_vaultManager.openVault("vault.txt", password);
+  password.fill(QChar(0));
+}
 
-    openPasswordlist();
-  }
-  catch (...)
+void MainWindow::onPasswordEdited()
+{
+  // Typing a new password abandons the unlock that is still running
+  if (m_vaultManager.isUnlocking())
   {
-    ui->label->setText("Wrong password");
-    ui->label->setVisible(true);
-    return;
+    m_vaultManager.cancelOpenVault();
   }
 }
 
 void MainWindow::lockVault()
 {
-  ui->stackedWidget->setCurrentIndex(0);
-  m_vaultManager.closeVault(); // This will emit vaultClosed("manual")
+  // vaultClosed switches to the login page. A vault whose changes cannot be
+  // written stays open, writeFailed has told the user why
+  m_vaultManager.closeVault();
 }
 
 // ============================================================================
@@ -85,6 +133,25 @@ void MainWindow::lockVault()
 void MainWindow::onVaultOpened(const QString &filePath)
 {
   qDebug() << "Vault opened successfully:" << filePath;
+
+  m_unlockProgress->setVisible(false);
+  openPasswordlist();
+}
+
+void MainWindow::onVaultOpenFailed(const QString &error)
+{
+  qDebug() << "Failed to open vault:" << error;
+
+  m_unlockProgress->setVisible(false);
+  ui->label->setText("Wrong password");
+  ui->label->setVisible(true);
+}
+
+void MainWindow::onVaultOpenCanceled()
+{
+  qDebug() << "Vault unlock canceled";
+
+  m_unlockProgress->setVisible(false);
 }
 
 void MainWindow::onVaultClosed(const QString &reason)
@@ -96,11 +163,14 @@ void MainWindow::onVaultClosed(const QString &reason)
 
   // Switch back to login screen
   ui->stackedWidget->setCurrentIndex(0);
+  closePasswordlist();
+  m_vaultManager.prefetchVault(VAULT_FILE);
 }
 
-void MainWindow::onEntryAdded(const VaultEntry &entry)
+void MainWindow::onEntryAdded(EntryId id)
 {
-  qDebug() << "New entry added:" << entry.username;
+  const VaultEntry *entry = m_vaultManager.findEntry(id);
+  qDebug() << "New entry added:" << (entry ? entry->username : QString());
 
   // You could show a notification, update counters, etc.
   // The password list will auto-refresh through other mechanisms
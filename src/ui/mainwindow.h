@@ -2,6 +2,7 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QProgressBar>
 #include "../vault/vaultmanager.h"
 
 QT_BEGIN_NAMESPACE
@@ -11,6 +12,8 @@ namespace Ui
 }
 QT_END_NAMESPACE
 
+class StackedWidget;
+
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -22,17 +25,23 @@ public:
 private:
     Ui::MainWindow *ui;
     VaultManager m_vaultManager;
-    // StackedWidget *stackedWidget;
+    QProgressBar *m_unlockProgress;
+    StackedWidget *m_passwordWidget = nullptr; // Exists while the vault is open
+
+    void closePasswordlist();
 
 private slots:
     void onButtonClicked();
     void onPasswordEntered();
+    void onPasswordEdited();
     void openPasswordlist();
     void lockVault();
 
     // VaultManager event handlers
     void onVaultOpened(const QString &filePath);
     void onVaultClosed(const QString &reason);
-    void onEntryAdded(const VaultEntry &entry);
+    void onVaultOpenFailed(const QString &error);
+    void onVaultOpenCanceled();
+    void onEntryAdded(EntryId id);
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,160 @@
+#include "passworditemdelegate.h"
+#include "passwordtablemodel.h"
+#include <QAbstractItemView>
+#include <QApplication>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QStyle>
+#include <QStyleOptionButton>
+
+namespace
+{
+    constexpr int BUTTON_MARGIN = 2;
+
+    QStyle *styleFor(const QStyleOptionViewItem &option)
+    {
+        return option.widget ? option.widget->style() : QApplication::style();
+    }
+}
+
+PasswordItemDelegate::PasswordItemDelegate(QObject *parent)
+    : QStyledItemDelegate(parent)
+{
+}
+
+void PasswordItemDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    if (!isActionsColumn(index))
+    {
+        QStyledItemDelegate::paint(painter, option, index);
+        return;
+    }
+
+    // Cell background and selection, then the two buttons on top
+    QStyleOptionViewItem cell = option;
+    initStyleOption(&cell, index);
+    QStyle *style = styleFor(option);
+    style->drawPrimitive(QStyle::PE_PanelItemViewItem, &cell, painter, option.widget);
+
+    bool revealed = index.data(PasswordTableModel::RevealedRole).toBool();
+    const QList<QPair<Action, QString>> buttons = {
+        {Action::Reveal, revealed ? tr("Hide") : tr("Reveal")},
+        {Action::Copy, tr("Copy")},
+    };
+
+    for (const auto &[action, text] : buttons)
+    {
+        QStyleOptionButton button;
+        button.rect = actionRect(option.rect, action);
+        button.text = text;
+        button.state = QStyle::State_Enabled;
+        bool pressed = m_pressedAction == action && m_pressedIndex == index;
+        button.state |= pressed ? QStyle::State_Sunken : QStyle::State_Raised;
+        style->drawControl(QStyle::CE_PushButton, &button, painter, option.widget);
+    }
+}
+
+QSize PasswordItemDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    if (!isActionsColumn(index))
+    {
+        return QStyledItemDelegate::sizeHint(option, index);
+    }
+    return actionsSizeHint(option);
+}
+
+QSize PasswordItemDelegate::actionsSizeHint(const QStyleOptionViewItem &option) const
+{
+    // Wide enough for the longer of Reveal and Hide, so the column does not jump
+    QStyleOptionButton button;
+    button.text = tr("Reveal");
+    QSize textSize = option.fontMetrics.size(Qt::TextShowMnemonic, button.text);
+    QSize buttonSize = styleFor(option)->sizeFromContents(QStyle::CT_PushButton, &button, textSize, option.widget);
+    return QSize(2 * buttonSize.width() + 3 * BUTTON_MARGIN, buttonSize.height() + 2 * BUTTON_MARGIN);
+}
+
+bool PasswordItemDelegate::editorEvent(QEvent *event, QAbstractItemModel *model, const QStyleOptionViewItem &option,
+                                       const QModelIndex &index)
+{
+    if (!isActionsColumn(index))
+    {
+        return QStyledItemDelegate::editorEvent(event, model, option, index);
+    }
+
+    auto *view = qobject_cast<QAbstractItemView *>(const_cast<QWidget *>(option.widget));
+    switch (event->type())
+    {
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonDblClick:
+    {
+        auto *mouseEvent = static_cast<QMouseEvent *>(event);
+        Action action = actionAt(option.rect, mouseEvent->position().toPoint());
+        if (mouseEvent->button() != Qt::LeftButton || action == Action::None)
+        {
+            return false;
+        }
+
+        m_pressedIndex = index;
+        m_pressedAction = action;
+        if (view)
+        {
+            view->update(index);
+        }
+        return true;
+    }
+    case QEvent::MouseButtonRelease:
+    {
+        auto *mouseEvent = static_cast<QMouseEvent *>(event);
+        Action pressed = m_pressedIndex == index ? m_pressedAction : Action::None;
+        m_pressedIndex = QPersistentModelIndex();
+        m_pressedAction = Action::None;
+        if (view)
+        {
+            view->update(index);
+        }
+
+        // A click counts only if it is released over the button it started on
+        if (pressed == Action::None || actionAt(option.rect, mouseEvent->position().toPoint()) != pressed)
+        {
+            return false;
+        }
+
+        EntryId id = index.data(PasswordTableModel::EntryIdRole).value<EntryId>();
+        if (pressed == Action::Reveal)
+        {
+            emit revealClicked(id);
+        }
+        else
+        {
+            emit copyClicked(id);
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+bool PasswordItemDelegate::isActionsColumn(const QModelIndex &index)
+{
+    return index.isValid() && index.column() == PasswordTableModel::ActionsColumn;
+}
+
+QRect PasswordItemDelegate::actionRect(const QRect &cell, Action action)
+{
+    int width = (cell.width() - 3 * BUTTON_MARGIN) / 2;
+    int left = cell.left() + BUTTON_MARGIN + (action == Action::Copy ? width + BUTTON_MARGIN : 0);
+    return QRect(left, cell.top() + BUTTON_MARGIN, width, cell.height() - 2 * BUTTON_MARGIN);
+}
+
+PasswordItemDelegate::Action PasswordItemDelegate::actionAt(const QRect &cell, const QPoint &position)
+{
+    for (Action action : {Action::Reveal, Action::Copy})
+    {
+        if (actionRect(cell, action).contains(position))
+        {
+            return action;
+        }
+    }
+    return Action::None;
+}
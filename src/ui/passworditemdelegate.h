@@ -0,0 +1,60 @@
+#ifndef PASSWORDITEMDELEGATE_H
+#define PASSWORDITEMDELEGATE_H
+
+#include <QStyledItemDelegate>
+#include <QPersistentModelIndex>
+#include "../vault/vaultentry.h"
+
+/**
+ * @brief Paints the Reveal and Copy actions of a password row as buttons
+ * The buttons are drawn with the widget style and hit-tested on mouse
+ * events, so rows carry no widgets or connections of their own
+ */
+class PasswordItemDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+
+public:
+    explicit PasswordItemDelegate(QObject *parent = nullptr);
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+
+    /**
+     * @brief Size of the actions cell, the same for every row
+     * Lets views use one fixed row height instead of asking each row
+     */
+    QSize actionsSizeHint(const QStyleOptionViewItem &option) const;
+
+signals:
+    /**
+     * @brief Emitted when the Reveal (or Hide) button of a row is clicked
+     */
+    void revealClicked(EntryId id);
+
+    /**
+     * @brief Emitted when the Copy button of a row is clicked
+     */
+    void copyClicked(EntryId id);
+
+protected:
+    bool editorEvent(QEvent *event, QAbstractItemModel *model, const QStyleOptionViewItem &option,
+                     const QModelIndex &index) override;
+
+private:
+    enum class Action
+    {
+        None,
+        Reveal,
+        Copy
+    };
+
+    QPersistentModelIndex m_pressedIndex;
+    Action m_pressedAction = Action::None;
+
+    static bool isActionsColumn(const QModelIndex &index);
+    static QRect actionRect(const QRect &cell, Action action);
+    static Action actionAt(const QRect &cell, const QPoint &position);
+};
+
+#endif // PASSWORDITEMDELEGATE_H
@@ -0,0 +1,291 @@
+#include "passwordtablemodel.h"
+#include "../utils/tracing.h"
+#include <QTimer>
+
+namespace
+{
+    const QString MASKED_PASSWORD = QStringLiteral("••••••••");
+}
+
+PasswordTableModel::PasswordTableModel(QObject *parent)
+    : QAbstractTableModel(parent)
+{
+}
+
+PasswordTableModel::~PasswordTableModel()
+{
+    clearRevealed();
+}
+
+void PasswordTableModel::setVaultManager(VaultManager *vaultManager)
+{
+    if (m_vaultManager)
+    {
+        disconnect(m_vaultManager, nullptr, this, nullptr);
+    }
+
+    beginResetModel();
+    clearRevealed();
+    m_vaultManager = vaultManager;
+    m_ids = storeIds();
+    m_filteredIds = m_vaultManager && isFiltered() ? m_vaultManager->searchEntries(m_filter) : QList<EntryId>();
+    endResetModel();
+
+    if (!m_vaultManager)
+    {
+        return;
+    }
+
+    // Signals arrive after the store changed, so rows are found by id in the
+    // model's own list, never by the store row the signal reports
+    connect(m_vaultManager, &VaultManager::entryAdded, this, &PasswordTableModel::onEntryAdded);
+    connect(m_vaultManager, &VaultManager::entryUpdated, this, &PasswordTableModel::onEntryUpdated);
+    connect(m_vaultManager, &VaultManager::entryRemoved, this, &PasswordTableModel::onEntryRemoved);
+    connect(m_vaultManager, &VaultManager::entriesReset, this, &PasswordTableModel::reload);
+}
+
+int PasswordTableModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+    {
+        return 0;
+    }
+    return static_cast<int>(shownIds().size());
+}
+
+int PasswordTableModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant PasswordTableModel::data(const QModelIndex &index, int role) const
+{
+    const VaultEntry *entryPtr = index.isValid() ? entryForRow(index.row()) : nullptr;
+    if (!entryPtr)
+    {
+        return QVariant();
+    }
+
+    const VaultEntry &entry = *entryPtr;
+    switch (role)
+    {
+    case Qt::DisplayRole:
+        if (index.column() == UsernameColumn)
+        {
+            return entry.username;
+        }
+        if (index.column() == PasswordColumn)
+        {
+            // Only decrypted on user interaction, never to paint the list
+            return m_revealed.value(entry.id, MASKED_PASSWORD);
+        }
+        return QVariant();
+    case EntryIdRole:
+        return QVariant::fromValue(entry.id);
+    case RevealedRole:
+        return m_revealed.contains(entry.id);
+    default:
+        return QVariant();
+    }
+}
+
+QVariant PasswordTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+    {
+        return QAbstractTableModel::headerData(section, orientation, role);
+    }
+
+    switch (section)
+    {
+    case UsernameColumn:
+        return tr("Username");
+    case PasswordColumn:
+        return tr("Password");
+    case ActionsColumn:
+        return tr("Actions");
+    default:
+        return QVariant();
+    }
+}
+
+void PasswordTableModel::setRevealedPassword(EntryId id, const QString &password)
+{
+    m_revealed.insert(id, password);
+    emitEntryChanged(id);
+}
+
+void PasswordTableModel::hidePassword(EntryId id)
+{
+    if (!m_revealed.contains(id))
+    {
+        return;
+    }
+
+    forgetRevealed(id);
+    emitEntryChanged(id);
+}
+
+void PasswordTableModel::setFilter(const QString &filter)
+{
+    TRACE_SPAN("ui", "PasswordTableModel::setFilter");
+    if (filter == m_filter)
+    {
+        return;
+    }
+
+    // Revealed passwords stay revealed, the entries did not change
+    beginResetModel();
+    m_filter = filter;
+    m_filteredIds = m_vaultManager && isFiltered() ? m_vaultManager->searchEntries(m_filter) : QList<EntryId>();
+    m_refilterPending = false;
+    endResetModel();
+}
+
+void PasswordTableModel::reload()
+{
+    TRACE_SPAN("ui", "PasswordTableModel::reload");
+    beginResetModel();
+    clearRevealed();
+    m_ids = storeIds();
+    m_filteredIds = m_vaultManager && isFiltered() ? m_vaultManager->searchEntries(m_filter) : QList<EntryId>();
+    m_refilterPending = false;
+    endResetModel();
+}
+
+QList<EntryId> PasswordTableModel::storeIds() const
+{
+    QList<EntryId> ids;
+    if (!m_vaultManager)
+    {
+        return ids;
+    }
+
+    ids.reserve(m_vaultManager->entryCount());
+    for (qsizetype row = 0; row < m_vaultManager->entryCount(); ++row)
+    {
+        ids.append(m_vaultManager->entryAt(row).id);
+    }
+    return ids;
+}
+
+const VaultEntry *PasswordTableModel::entryForRow(int row) const
+{
+    const QList<EntryId> &ids = shownIds();
+    if (!m_vaultManager || row < 0 || row >= ids.size())
+    {
+        return nullptr;
+    }
+    return m_vaultManager->findEntry(ids.at(row));
+}
+
+void PasswordTableModel::refilter()
+{
+    TRACE_SPAN("ui", "PasswordTableModel::refilter");
+    m_refilterPending = false;
+    if (!isFiltered())
+    {
+        return;
+    }
+
+    beginResetModel();
+    m_filteredIds = m_vaultManager ? m_vaultManager->searchEntries(m_filter) : QList<EntryId>();
+    endResetModel();
+}
+
+void PasswordTableModel::scheduleRefilter()
+{
+    // A batch of additions costs one search and one reset instead of one per entry
+    if (!m_refilterPending)
+    {
+        m_refilterPending = true;
+        QTimer::singleShot(0, this, &PasswordTableModel::refilter);
+    }
+}
+
+void PasswordTableModel::onEntryAdded(EntryId id, qsizetype)
+{
+    if (isFiltered())
+    {
+        m_ids.append(id);
+        scheduleRefilter();
+        return;
+    }
+
+    int row = static_cast<int>(m_ids.size());
+    beginInsertRows(QModelIndex(), row, row);
+    m_ids.append(id);
+    endInsertRows();
+}
+
+void PasswordTableModel::onEntryUpdated(EntryId id, qsizetype)
+{
+    // A password shown in clear would be stale now
+    forgetRevealed(id);
+
+    // Only the password changed, so the entry keeps its place
+    qsizetype row = shownIds().indexOf(id);
+    if (row < 0)
+    {
+        return;
+    }
+    emit dataChanged(index(static_cast<int>(row), 0), index(static_cast<int>(row), ColumnCount - 1));
+}
+
+void PasswordTableModel::onEntryRemoved(EntryId id)
+{
+    forgetRevealed(id);
+
+    // The rows below close the gap, the entry the store moved into the freed
+    // slot stays where the user saw it
+    if (isFiltered())
+    {
+        // Not shown while filtered, kept in step for when the filter is cleared
+        m_ids.removeOne(id);
+    }
+
+    QList<EntryId> &ids = isFiltered() ? m_filteredIds : m_ids;
+    qsizetype row = ids.indexOf(id);
+    if (row < 0)
+    {
+        return;
+    }
+    beginRemoveRows(QModelIndex(), static_cast<int>(row), static_cast<int>(row));
+    ids.removeAt(row);
+    endRemoveRows();
+}
+
+void PasswordTableModel::forgetRevealed(EntryId id)
+{
+    auto it = m_revealed.find(id);
+    if (it == m_revealed.end())
+    {
+        return;
+    }
+
+    it.value().fill(QChar(0));
+    m_revealed.erase(it);
+}
+
+void PasswordTableModel::clearRevealed()
+{
+    for (QString &password : m_revealed)
+    {
+        password.fill(QChar(0));
+    }
+    m_revealed.clear();
+}
+
+void PasswordTableModel::emitEntryChanged(EntryId id)
+{
+    if (!m_vaultManager)
+    {
+        return;
+    }
+
+    qsizetype row = shownIds().indexOf(id);
+    if (row >= 0)
+    {
+        emit dataChanged(index(static_cast<int>(row), PasswordColumn), index(static_cast<int>(row), ActionsColumn));
+    }
+}
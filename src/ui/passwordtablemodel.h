@@ -0,0 +1,86 @@
+#ifndef PASSWORDTABLEMODEL_H
+#define PASSWORDTABLEMODEL_H
+
+#include <QAbstractTableModel>
+#include <QHash>
+#include "../vault/vaultmanager.h"
+
+/**
+ * @brief Table model reading the entries straight from the VaultManager store
+ * Only the entry ids are copied, in the order the rows were announced, and
+ * views only ask for the rows they show. A removed entry closes its gap, the
+ * other rows keep their order even though the store swap-removes. Single
+ * mutations are mirrored as row inserts, changes and removals. With a filter
+ * set, the rows are the search results in rank order instead
+ */
+class PasswordTableModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column
+    {
+        UsernameColumn,
+        PasswordColumn,
+        ActionsColumn,
+        ColumnCount
+    };
+
+    enum Role
+    {
+        EntryIdRole = Qt::UserRole + 1, // EntryId of the row
+        RevealedRole,                   // Whether the password of the row is shown in clear
+    };
+
+    explicit PasswordTableModel(QObject *parent = nullptr);
+    ~PasswordTableModel();
+
+    void setVaultManager(VaultManager *vaultManager);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    /**
+     * @brief Show a decrypted password in its row until hidePassword is called
+     */
+    void setRevealedPassword(EntryId id, const QString &password);
+
+    /**
+     * @brief Mask the password of an entry again and wipe the clear text copy
+     */
+    void hidePassword(EntryId id);
+    bool isRevealed(EntryId id) const { return m_revealed.contains(id); }
+
+    /**
+     * @brief Show only the entries matching a search, best match first
+     * @param filter Search text, an empty filter shows every entry in store order
+     */
+    void setFilter(const QString &filter);
+    QString filter() const { return m_filter; }
+
+private:
+    VaultManager *m_vaultManager = nullptr;
+    QList<EntryId> m_ids;               // Rows announced to views while unfiltered, in display order
+    QString m_filter;                   // Current search, empty when unfiltered
+    QList<EntryId> m_filteredIds;       // Search results shown as rows while filtered
+    bool m_refilterPending = false;     // Additions while filtered are searched again once per event loop turn
+    QHash<EntryId, QString> m_revealed; // Passwords currently shown in clear
+
+    void reload();
+    bool isFiltered() const { return !m_filter.isEmpty(); }
+    const QList<EntryId> &shownIds() const { return isFiltered() ? m_filteredIds : m_ids; }
+    QList<EntryId> storeIds() const;
+    const VaultEntry *entryForRow(int row) const;
+    void refilter();
+    void scheduleRefilter();
+    void onEntryAdded(EntryId id, qsizetype row);
+    void onEntryUpdated(EntryId id, qsizetype row);
+    void onEntryRemoved(EntryId id);
+    void forgetRevealed(EntryId id);
+    void clearRevealed();
+    void emitEntryChanged(EntryId id);
+};
+
+#endif // PASSWORDTABLEMODEL_H
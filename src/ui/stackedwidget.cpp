@@ -1,25 +1,44 @@
 #include "stackedwidget.h"
 #include "ui_stackedwidget.h"
 #include "newlogindialog.h"
+#include "passwordtablemodel.h"
+#include "passworditemdelegate.h"
+#include "../utils/metrics.h"
+#include "../utils/tracing.h"
 #include <QDebug>
-#include <QJsonDocument>
-#include <QJsonArray>
-#include <QJsonObject>
-#include <QPalette>
 #include <QPushButton>
+#include <QLineEdit>
 #include <QMessageBox>
 #include <QTimer>
-#include <QHBoxLayout>
-#include <QWidget>
+#include <QHeaderView>
 #include <QApplication>
 #include <QClipboard>
 
 StackedWidget::StackedWidget(QWidget *parent)
-    : QStackedWidget(parent), ui(new Ui::StackedWidget)
+    : QStackedWidget(parent), ui(new Ui::StackedWidget),
+      m_model(new PasswordTableModel(this)), m_delegate(new PasswordItemDelegate(this))
 {
     ui->setupUi(this);
 
+    // The view only creates and paints the visible rows. Fixed row heights and
+    // column modes keep it from measuring every entry of a large vault
+    ui->tableView->setModel(m_model);
+    ui->tableView->setItemDelegate(m_delegate);
+    ui->tableView->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    QStyleOptionViewItem rowOption;
+    rowOption.initFrom(ui->tableView);
+    rowOption.widget = ui->tableView;
+    ui->tableView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    ui->tableView->verticalHeader()->setDefaultSectionSize(m_delegate->actionsSizeHint(rowOption).height());
+    ui->tableView->horizontalHeader()->setSectionResizeMode(PasswordTableModel::UsernameColumn, QHeaderView::Stretch);
+    ui->tableView->horizontalHeader()->setSectionResizeMode(PasswordTableModel::PasswordColumn, QHeaderView::Stretch);
+    ui->tableView->horizontalHeader()->setSectionResizeMode(PasswordTableModel::ActionsColumn, QHeaderView::ResizeToContents);
+
     connect(ui->addLoginButton, &QPushButton::clicked, this, &StackedWidget::openNewPasswordDialog);
+    // Every keystroke narrows the list through the vault's search index
+    connect(ui->searchEdit, &QLineEdit::textChanged, m_model, &PasswordTableModel::setFilter);
+    connect(m_delegate, &PasswordItemDelegate::revealClicked, this, &StackedWidget::revealPasswordSecurely);
+    connect(m_delegate, &PasswordItemDelegate::copyClicked, this, &StackedWidget::copyPasswordToClipboard);
 }
 
 StackedWidget::~StackedWidget()
@@ -29,89 +48,31 @@ StackedWidget::~StackedWidget()
 
 void StackedWidget::setVaultManager(VaultManager *vaultManager)
 {
+    TRACE_SPAN("ui", "StackedWidget::setVaultManager");
     m_vaultManager = vaultManager;
-    populatePasswordList();
+    m_model->setVaultManager(vaultManager);
 }
 
-void StackedWidget::populatePasswordList()
+void StackedWidget::revealPasswordSecurely(EntryId id)
 {
-    // Safety check: ensure we have a valid VaultManager
+    TRACE_SPAN("ui", "StackedWidget::revealPasswordSecurely");
+    Metrics::ScopedLatency latency(Metrics::Operation::Reveal);
     if (!m_vaultManager)
     {
-        qDebug() << "No vault manager or vault not open";
-        ui->tableWidget->clear();
-        ui->tableWidget->setRowCount(0);
+        qWarning() << "No vault manager available";
         return;
     }
 
-    auto entries = m_vaultManager->getEntries(); // Use -> for pointer access
-
-    ui->tableWidget->clear();        // Clear existing items
-    ui->tableWidget->setRowCount(0); // Reset row count
-
-    // Set up table headers for better UX
-    ui->tableWidget->setColumnCount(3);
-    QStringList headers;
-    headers << "Username" << "Password" << "Actions";
-    ui->tableWidget->setHorizontalHeaderLabels(headers);
-
-    for (int i = 0; i < entries.size(); ++i)
-    {
-        const VaultEntry &entry = entries[i];
-        int row = ui->tableWidget->rowCount();
-        ui->tableWidget->insertRow(row);
-
-        // Set username
-        ui->tableWidget->setItem(row, 0, new QTableWidgetItem(entry.username));
-
-        // For security: Show masked password initially - only decrypt on user interaction
-        ui->tableWidget->setItem(row, 1, new QTableWidgetItem("••••••••"));
-
-        // Add a button to reveal/copy password securely
-        QPushButton *revealButton = new QPushButton("Reveal", this);
-        revealButton->setProperty("username", entry.username); // Store username for retrieval
-
-        // Add copy button for secure clipboard operations
-        QPushButton *copyButton = new QPushButton("Copy", this);
-        copyButton->setProperty("username", entry.username);
-
-        // Create a widget to hold both buttons
-        QWidget *buttonWidget = new QWidget();
-        QHBoxLayout *buttonLayout = new QHBoxLayout(buttonWidget);
-        buttonLayout->addWidget(revealButton);
-        buttonLayout->addWidget(copyButton);
-        buttonLayout->setContentsMargins(0, 0, 0, 0);
-
-        // Connect reveal button
-        connect(revealButton, &QPushButton::clicked, this, [this, revealButton]()
-                {
-            QString username = revealButton->property("username").toString();
-            revealPasswordSecurely(username, revealButton); });
-
-        // Connect copy button for secure clipboard copy
-        connect(copyButton, &QPushButton::clicked, this, [this, copyButton]()
-                {
-            QString username = copyButton->property("username").toString();
-            copyPasswordToClipboard(username); });
-
-        ui->tableWidget->setCellWidget(row, 2, buttonWidget);
-    }
-
-    ui->tableWidget->resizeColumnsToContents(); // Adjust column widths
-}
-
-void StackedWidget::revealPasswordSecurely(const QString &username, QPushButton *button)
-{
-    if (!m_vaultManager)
+    if (m_model->isRevealed(id))
     {
-        qWarning() << "No vault manager available";
+        m_model->hidePassword(id);
         return;
     }
 
     try
     {
         // Get the password securely (this also extends the session)
-        QString password = m_vaultManager->getPasswordSecure(username);
+        QString password = m_vaultManager->getPasswordSecure(id);
 
         if (password.isEmpty())
         {
@@ -119,48 +80,13 @@ void StackedWidget::revealPasswordSecurely(const QString &username, QPushButton
             return;
         }
 
-        // Find the row for this username to update the password cell
-        for (int row = 0; row < ui->tableWidget->rowCount(); ++row)
-        {
-            QTableWidgetItem *usernameItem = ui->tableWidget->item(row, 0);
-            if (usernameItem && usernameItem->text() == username)
-            {
+        // Show password temporarily, the model keeps its own copy until hidden
+        m_model->setRevealedPassword(id, password);
 
-                // Show password temporarily
-                ui->tableWidget->setItem(row, 1, new QTableWidgetItem(password));
-
-                // Change button to "Hide" and update its function
-                button->setText("Hide");
-                button->disconnect(); // Remove old connections
-
-                connect(button, &QPushButton::clicked, this, [this, username, button, row]()
-                        {
-                    // Hide password again
-                    ui->tableWidget->setItem(row, 1, new QTableWidgetItem("••••••••"));
-                    button->setText("Reveal");
-                    button->disconnect();
-
-                    // Reconnect reveal function
-                    connect(button, &QPushButton::clicked, this, [this, username, button]() {
-                        revealPasswordSecurely(username, button);
-                    }); });
-
-                // Optional: Auto-hide password after a timeout for additional security
-                QTimer::singleShot(30000, this, [this, username, button, row]() { // 30 seconds
-                    if (button->text() == "Hide")
-                    {
-                        ui->tableWidget->setItem(row, 1, new QTableWidgetItem("••••••••"));
-                        button->setText("Reveal");
-                        button->disconnect();
-
-                        connect(button, &QPushButton::clicked, this, [this, username, button]()
-                                { revealPasswordSecurely(username, button); });
-                    }
-                });
-
-                break;
-            }
-        }
+        // Auto-hide password after a timeout for additional security
+        QTimer::singleShot(30000, m_model, [this, id]() { // 30 seconds
+            m_model->hidePassword(id);
+        });
 
         // Securely clear the password from memory
         password.fill(QChar(0));
@@ -181,25 +107,30 @@ void StackedWidget::openNewPasswordDialog()
 
     connect(newLoginDialog, &QDialog::accepted, this, [this, newLoginDialog, vaultManager]()
             {
-                qDebug() << "data";
-
                 QString password = newLoginDialog->getPassword();
                 QString username = newLoginDialog->getUsername();
 
-                qDebug() << username << "\n";
-                qDebug() << password << "\n";
-
                 VaultEntry entry = {username, password};
 
-                (*vaultManager)->addEntry(entry);
-
-                this->populatePasswordList(); });
+                // The model picks the new entry up through entryAdded
+                try
+                {
+                    (*vaultManager)->addEntry(entry);
+                }
+                catch (const std::exception &e)
+                {
+                    QMessageBox::warning(this, "Error", QString("Failed to add entry: %1").arg(e.what()));
+                }
+                entry.clearSensitiveData();
+                password.fill(QChar(0)); });
 
     newLoginDialog->exec();
 }
 
-void StackedWidget::copyPasswordToClipboard(const QString &username)
+void StackedWidget::copyPasswordToClipboard(EntryId id)
 {
+    TRACE_SPAN("ui", "StackedWidget::copyPasswordToClipboard");
+    Metrics::ScopedLatency latency(Metrics::Operation::Copy);
     if (!m_vaultManager)
     {
         qWarning() << "No vault manager available";
@@ -209,7 +140,7 @@ void StackedWidget::copyPasswordToClipboard(const QString &username)
     try
     {
         // Get the password securely
-        QString password = m_vaultManager->getPasswordSecure(username);
+        QString password = m_vaultManager->getPasswordSecure(id);
 
         if (password.isEmpty())
         {
@@ -217,6 +148,9 @@ void StackedWidget::copyPasswordToClipboard(const QString &username)
             return;
         }
 
+        const VaultEntry *entry = m_vaultManager->findEntry(id);
+        QString username = entry ? entry->username : QString();
+
         // Copy to clipboard
         QClipboard *clipboard = QApplication::clipboard();
         clipboard->setText(password);
@@ -2,9 +2,11 @@
 #define STACKEDWIDGET_H
 
 #include <QStackedWidget>
-#include <QPushButton>
 #include "../vault/vaultmanager.h"
 
+class PasswordTableModel;
+class PasswordItemDelegate;
+
 namespace Ui
 {
     class StackedWidget;
@@ -23,16 +25,17 @@ public:
 
 private:
     Ui::StackedWidget *ui;
-    VaultManager *m_vaultManager;
+    VaultManager *m_vaultManager = nullptr;
+    PasswordTableModel *m_model;      // Reads the entries from m_vaultManager on demand
+    PasswordItemDelegate *m_delegate; // Paints and hit-tests the row actions
 
-    void populatePasswordList();
     void openNewPasswordDialog();
 
-    // Secure password reveal method
-    void revealPasswordSecurely(const QString &username, QPushButton *button);
+    // Secure password reveal method, hides the password again if it is shown
+    void revealPasswordSecurely(EntryId id);
 
     // Secure clipboard copy method
-    void copyPasswordToClipboard(const QString &username);
+    void copyPasswordToClipboard(EntryId id);
 };
 
 #endif // STACKEDWIDGET_H
@@ -1,9 +1,85 @@
 #include "fileutils.h"
 #include "../crypto/cryptoutils.h"
+#include "../vault/vaultformat.h"
+#include "metrics.h"
+#include "tracing.h"
 #include <QFile>
 #include <QFileInfo>
+#include <QBuffer>
 #include <QDebug>
+#include <QtEndian>
+#include <cstdio>
+#include <cstring>
 #include <sodium.h>
+#if defined(Q_OS_WIN)
+#include <QDir>
+#include <io.h>
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+  // Segmented layout: header | blocks... | index stream | index length (4)
+  // Header: magic (4) | version (2) | salt | [kdf algorithm (1) | opslimit (8) | memlimit (8)]
+  // Version 1 stored the index as a single nonce | ciphertext, version 2 as a chunked stream,
+  // version 3 adds the password hash parameters to the header
+  constexpr char SEGMENTED_MAGIC[] = "PMVS";
+  constexpr qint64 SEGMENTED_MAGIC_SIZE = 4;
+  constexpr quint16 SEGMENTED_VERSION_SINGLE_INDEX = 1;
+  constexpr quint16 SEGMENTED_VERSION_KDF_PARAMS = 3;
+  constexpr quint16 SEGMENTED_VERSION = 3;
+  constexpr qint64 SEGMENTED_SALT_OFFSET = SEGMENTED_MAGIC_SIZE + sizeof(quint16);
+  constexpr qint64 SEGMENTED_BASE_HEADER_SIZE = SEGMENTED_SALT_OFFSET + crypto_pwhash_SALTBYTES;
+  constexpr qint64 KDF_PARAMS_SIZE = sizeof(quint8) + 2 * sizeof(quint64);
+  constexpr qint64 SEGMENTED_MAX_HEADER_SIZE = SEGMENTED_BASE_HEADER_SIZE + KDF_PARAMS_SIZE;
+  constexpr qint64 INDEX_LENGTH_SIZE = sizeof(quint32);
+
+  qint64 segmentedHeaderSize(quint16 version)
+  {
+    return version >= SEGMENTED_VERSION_KDF_PARAMS ? SEGMENTED_MAX_HEADER_SIZE : SEGMENTED_BASE_HEADER_SIZE;
+  }
+
+  QByteArray blockAssociatedData(quint64 id)
+  {
+    QByteArray ad(sizeof(quint64), 0);
+    qToLittleEndian(id, ad.data());
+    return ad;
+  }
+
+  // Copies raw bytes in bounded chunks, so large blocks never sit in memory whole
+  void copyRange(QIODevice &source, QIODevice &target, qint64 length)
+  {
+    QByteArray chunk;
+    while (length > 0)
+    {
+      chunk = source.read(qMin(length, CryptoUtils::STREAM_CHUNK_SIZE));
+      if (chunk.isEmpty() || target.write(chunk) != chunk.size())
+      {
+        throw FileUtils::FileOperationError("Failed to copy record block");
+      }
+      length -= chunk.size();
+    }
+  }
+
+  QByteArray segmentedHeader(const FileUtils::KeyDerivation &keyDerivation)
+  {
+    QByteArray header(SEGMENTED_MAGIC, SEGMENTED_MAGIC_SIZE);
+    header.resize(SEGMENTED_MAX_HEADER_SIZE);
+    char *data = header.data();
+    qToLittleEndian(SEGMENTED_VERSION, data + SEGMENTED_MAGIC_SIZE);
+    memcpy(data + SEGMENTED_SALT_OFFSET, keyDerivation.salt.constData(), crypto_pwhash_SALTBYTES);
+    data += SEGMENTED_BASE_HEADER_SIZE;
+    *data = static_cast<char>(keyDerivation.params.algorithm);
+    qToLittleEndian(keyDerivation.params.opsLimit, data + sizeof(quint8));
+    qToLittleEndian(keyDerivation.params.memLimit, data + sizeof(quint8) + sizeof(quint64));
+    return header;
+  }
+}
 
 namespace FileUtils
 {
@@ -19,22 +95,26 @@ namespace FileUtils
       throw CryptoUtils::CryptoOperationError("Password cannot be empty");
     }
 
+    // New salt and parameters calibrated for this machine
+    KeyDerivation keyDerivation{generateSalt(), CryptoUtils::calibrateKdf()};
+    SecureMemory::Buffer rootKey = CryptoUtils::deriveKeyFromPassword(password, keyDerivation.salt, keyDerivation.params);
+    return createVault(filePath, keyDerivation, rootKey, data);
+  }
+
+  bool createVault(const QString &filePath, const KeyDerivation &keyDerivation,
+                   QByteArrayView rootKey, const QByteArray &data)
+  {
     try
     {
-      // Generate new salt for new vault
-      QByteArray salt = generateSalt();
-      QByteArray key = CryptoUtils::deriveKeyFromPassword(password, salt);
-
-      // Encrypt the data
-      QByteArray nonce, ciphertext;
-      CryptoUtils::encrypt(data, key, ciphertext, nonce);
-
-      // Write to file
-      if (!Detail::writeVaultToFile(filePath, salt, nonce, ciphertext))
-      {
-        throw FileOperationError("Failed to write vault file: " + filePath.toStdString());
-      }
-
+      // A segmented vault without record blocks, the data is its index. Written
+      // aside first, so a crash never leaves a half written vault under the name
+      QByteArray payload = data.isEmpty() ? VaultFormat::emptyPayload() : data;
+      QString tempPath = filePath + ".tmp";
+      writeSegmentedVault(tempPath, QString(), rootKey, {},
+                          [&payload](const QList<BlockLocation> &)
+                          { return payload; },
+                          keyDerivation);
+      replaceVault(tempPath, filePath);
       return true;
     }
     catch (const std::exception &e)
@@ -44,11 +124,12 @@ namespace FileUtils
     }
   }
 
-  QByteArray readVault(const QString &filePath, const QString &password)
+  CryptoUtils::LockedBytes readVault(const QString &filePath, QByteArrayView rootKey, bool *outLegacyKeySchedule)
   {
-    if (password.isEmpty())
+    TRACE_SPAN("file", "FileUtils::readVault");
+    if (rootKey.isEmpty())
     {
-      throw CryptoUtils::CryptoOperationError("Password cannot be empty");
+      throw CryptoUtils::CryptoOperationError("Root key cannot be empty");
     }
 
     if (!exists(filePath))
@@ -56,60 +137,129 @@ namespace FileUtils
       throw FileOperationError("Vault file does not exist: " + filePath.toStdString());
     }
 
-    if (!Detail::isValidVaultFile(filePath))
+    try
+    {
+      // One mapping serves the format checks, the header fields and the ciphertext
+      Detail::MappedVaultFile mapped(filePath);
+      return Detail::decryptVaultData(mapped.bytes(), rootKey, outLegacyKeySchedule);
+    }
+    catch (const std::exception &e)
+    {
+      qWarning() << "readVault failed:" << e.what();
+      throw;
+    }
+  }
+
+  CryptoUtils::LockedBytes readVault(const PreparedVault &prepared, QByteArrayView rootKey, bool *outLegacyKeySchedule)
+  {
+    TRACE_SPAN("file", "FileUtils::readVault(prepared)");
+    if (rootKey.isEmpty())
+    {
+      throw CryptoUtils::CryptoOperationError("Root key cannot be empty");
+    }
+    if (!prepared.mapping)
     {
-      throw FileOperationError("Invalid vault file format: " + filePath.toStdString());
+      throw FileOperationError("Vault was not prepared: " + prepared.filePath.toStdString());
     }
 
     try
     {
-      QFile file(filePath);
-      if (!file.open(QIODevice::ReadOnly))
-      {
-        throw FileOperationError("Cannot open vault file for reading: " + filePath.toStdString());
-      }
+      return Detail::decryptVaultData(prepared.mapping->bytes(), rootKey, outLegacyKeySchedule);
+    }
+    catch (const std::exception &e)
+    {
+      qWarning() << "readVault failed:" << e.what();
+      throw;
+    }
+  }
+
+  PreparedVault prepareVault(const QString &filePath)
+  {
+    TRACE_SPAN("file", "FileUtils::prepareVault");
+    PreparedVault prepared;
+    prepared.filePath = filePath;
 
-      // Read file components
-      QByteArray salt = Detail::readSaltFromFile(file);
-      QByteArray nonce = file.read(crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
-      QByteArray ciphertext = file.readAll();
-      file.close();
+    QFileInfo info(filePath);
+    prepared.exists = info.exists();
+    if (!prepared.exists)
+    {
+      return prepared;
+    }
+    prepared.size = info.size();
+    prepared.lastModified = info.lastModified();
 
-      // Validate components
-      if (salt.size() != crypto_pwhash_SALTBYTES)
+    try
+    {
+      std::shared_ptr<const Detail::MappedVaultFile> mapping = std::make_shared<Detail::MappedVaultFile>(filePath);
+      QByteArrayView data = mapping->bytes();
+      if (!Detail::isValidVaultData(data))
       {
-        throw FileOperationError("Invalid salt size in vault file");
+        qWarning() << "Invalid vault file format:" << filePath;
+        return prepared;
       }
-      if (nonce.size() != crypto_aead_xchacha20poly1305_ietf_NPUBBYTES)
+
+      prepared.keyDerivation = Detail::keyDerivationFromVaultData(data);
+      if (prepared.keyDerivation.salt.isEmpty())
       {
-        throw FileOperationError("Invalid nonce size in vault file");
+        return prepared;
       }
-      if (ciphertext.isEmpty())
+
+      // Fault every page in now, decryption after the password hash then never waits for the disk
+      constexpr qsizetype PAGE_SIZE = 4096;
+      volatile char sink = 0;
+      for (qsizetype offset = 0; offset < data.size(); offset += PAGE_SIZE)
       {
-        throw FileOperationError("No encrypted data found in vault file");
+        sink = sink ^ data[offset];
       }
 
-      // Decrypt
-      QByteArray key = CryptoUtils::deriveKeyFromPassword(password, salt);
-      QByteArray decrypted;
-      CryptoUtils::decrypt(ciphertext, key, nonce, decrypted);
-
-      return decrypted;
+      prepared.mapping = std::move(mapping);
     }
     catch (const std::exception &e)
     {
-      qWarning() << "readVault failed:" << e.what();
-      throw;
+      qWarning() << "prepareVault failed:" << e.what();
     }
+    return prepared;
   }
 
-  bool updateVault(const QString &filePath, const QByteArray &sessionKey, const QByteArray &data)
+  bool PreparedVault::isUsable() const
   {
-    if (sessionKey.isEmpty())
+    QFileInfo info(filePath);
+    if (!exists)
     {
-      throw CryptoUtils::CryptoOperationError("Session key cannot be empty");
+      // A vault yet to be created needs the parameters calibrated for it
+      return !info.exists() && !keyDerivation.salt.isEmpty();
     }
+    return mapping && !keyDerivation.salt.isEmpty() && info.exists() && info.size() == size &&
+           info.lastModified() == lastModified;
+  }
+
+  std::shared_ptr<QLockFile> lockVault(const QString &filePath)
+  {
+    auto lock = std::make_shared<QLockFile>(filePath + ".lock");
+    // Holders are told apart by process, not by age, a session may stay open for hours
+    lock->setStaleLockTime(0);
+    if (lock->tryLock(0))
+    {
+      return lock;
+    }
+
+    if (lock->error() == QLockFile::LockFailedError)
+    {
+      qint64 pid = 0;
+      QString hostName;
+      QString appName;
+      lock->getLockInfo(&pid, &hostName, &appName);
+      throw FileOperationError(QString("Vault is open in another process (%1, pid %2): %3")
+                                   .arg(appName.isEmpty() ? QString("unknown") : appName)
+                                   .arg(pid)
+                                   .arg(filePath)
+                                   .toStdString());
+    }
+    throw FileOperationError("Cannot create the lock file of vault: " + filePath.toStdString());
+  }
 
+  bool updateVault(const QString &filePath, QByteArrayView rootKey, const QByteArray &data)
+  {
     if (!exists(filePath))
     {
       throw FileOperationError("Vault file does not exist: " + filePath.toStdString());
@@ -117,42 +267,270 @@ namespace FileUtils
 
     try
     {
-      // Get existing salt (must preserve it!)
-      QByteArray salt = extractSalt(filePath);
-      if (salt.isEmpty())
+      // Keep the salt and parameters the root key was derived with (must preserve them!)
+      KeyDerivation keyDerivation = extractKeyDerivation(filePath);
+      if (keyDerivation.salt.isEmpty())
       {
         throw FileOperationError("Cannot extract salt from existing vault file");
       }
 
-      // Encrypt with session key
-      QByteArray nonce, ciphertext;
-      CryptoUtils::encrypt(data, sessionKey, ciphertext, nonce);
+      QString tempPath = filePath + ".tmp";
+      writeSegmentedVault(tempPath, QString(), rootKey, {},
+                          [&data](const QList<BlockLocation> &)
+                          { return data; },
+                          keyDerivation);
+      replaceVault(tempPath, filePath);
+      return true;
+    }
+    catch (const std::exception &e)
+    {
+      qWarning() << "updateVault failed:" << e.what();
+      throw;
+    }
+  }
+
+  QList<BlockLocation> writeSegmentedVault(const QString &targetPath, const QString &sourcePath,
+                                           QByteArrayView rootKey, const QList<RecordBlock> &blocks,
+                                           const std::function<QByteArray(const QList<BlockLocation> &)> &buildIndex,
+                                           const KeyDerivation &keyDerivation)
+  {
+    TRACE_SPAN("file", "FileUtils::writeSegmentedVault");
+    if (rootKey.isEmpty())
+    {
+      throw CryptoUtils::CryptoOperationError("Root key cannot be empty");
+    }
+
+    // The source is only needed for its key derivation and for copied blocks
+    QFile source(sourcePath);
+    if (!sourcePath.isEmpty() && !source.open(QIODevice::ReadOnly))
+    {
+      throw FileOperationError("Cannot open vault file for reading: " + sourcePath.toStdString());
+    }
+
+    KeyDerivation headerKeyDerivation = keyDerivation.salt.isEmpty() && source.isOpen()
+                                            ? Detail::readKeyDerivationFromFile(source)
+                                            : keyDerivation;
+    if (headerKeyDerivation.salt.size() != crypto_pwhash_SALTBYTES || !headerKeyDerivation.params.isValid())
+    {
+      throw FileOperationError("Invalid key derivation for vault header");
+    }
+    QByteArray header = segmentedHeader(headerKeyDerivation);
+
+    QFile target(targetPath);
+    if (!target.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+      throw FileOperationError("Cannot open file for writing: " + targetPath.toStdString());
+    }
+
+    SecureMemory::Buffer key = CryptoUtils::expandRootKey(rootKey, CryptoUtils::RootSubkey::Vault);
+    QList<BlockLocation> locations;
+    locations.reserve(blocks.size());
+
+    try
+    {
+      if (target.write(header) != header.size())
+      {
+        throw FileOperationError("Failed to write vault header");
+      }
+
+      for (const RecordBlock &block : blocks)
+      {
+        BlockLocation location;
+        location.offset = target.pos();
+
+        if (block.plain.isEmpty())
+        {
+          // Unchanged block, copy the ciphertext without decrypting it
+          if (!source.isOpen() || block.source.offset < SEGMENTED_BASE_HEADER_SIZE || !source.seek(block.source.offset))
+          {
+            throw FileOperationError("Invalid record block location");
+          }
+          copyRange(source, target, block.source.length);
+          location.length = block.source.length;
+        }
+        else
+        {
+          QByteArray nonce, ciphertext;
+          CryptoUtils::encrypt(block.plain, key, ciphertext, nonce, blockAssociatedData(block.id));
+          if (target.write(nonce) != nonce.size() || target.write(ciphertext) != ciphertext.size())
+          {
+            throw FileOperationError("Failed to write record block");
+          }
+          location.length = static_cast<quint32>(nonce.size() + ciphertext.size());
+        }
+
+        locations.append(location);
+      }
 
-      // Write updated vault
-      if (!Detail::writeVaultToFile(filePath, salt, nonce, ciphertext))
+      // The index is streamed into the file in chunks and authenticated
+      // together with the header it belongs to
+      QByteArray index = buildIndex(locations);
+      QBuffer indexBuffer(&index);
+      indexBuffer.open(QIODevice::ReadOnly);
+      qint64 indexLength = 0;
+      try
+      {
+        indexLength = CryptoUtils::encryptStream(indexBuffer, index.size(), target, key, header);
+      }
+      catch (...)
       {
-        throw FileOperationError("Failed to write updated vault file");
+        index.fill(0);
+        throw;
       }
+      index.fill(0);
 
-      return true;
+      QByteArray trailer(INDEX_LENGTH_SIZE, 0);
+      qToLittleEndian(static_cast<quint32>(indexLength), trailer.data());
+      if (target.write(trailer) != trailer.size())
+      {
+        throw FileOperationError("Failed to write vault index");
+      }
     }
     catch (const std::exception &e)
     {
-      qWarning() << "updateVault failed:" << e.what();
+      target.close();
+      QFile::remove(targetPath);
+      qWarning() << "writeSegmentedVault failed:" << e.what();
       throw;
     }
+
+    Metrics::increment(Metrics::Counter::BytesWritten, target.pos());
+    target.close();
+    return locations;
+  }
+
+  QByteArray readRecordBlock(const QString &filePath, QByteArrayView rootKey,
+                             quint64 id, const BlockLocation &location)
+  {
+    TRACE_SPAN("file", "FileUtils::readRecordBlock");
+    const qint64 NONCE_SIZE = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+
+    if (location.offset < SEGMENTED_BASE_HEADER_SIZE || location.length < NONCE_SIZE)
+    {
+      throw FileOperationError("Invalid record block location");
+    }
+
+    // Map just the block, repeated reads are served from the page cache
+    Detail::MappedVaultFile mapped(filePath, location.offset, location.length);
+    QByteArrayView block = mapped.bytes();
+
+    SecureMemory::Buffer key = CryptoUtils::expandRootKey(rootKey, CryptoUtils::RootSubkey::Vault);
+    QByteArray plain;
+    CryptoUtils::decrypt(block.sliced(NONCE_SIZE), key, block.first(NONCE_SIZE), plain, blockAssociatedData(id));
+    return plain;
+  }
+
+  void replaceVault(const QString &tempPath, const QString &filePath, bool sync)
+  {
+    TRACE_SPAN("file", "FileUtils::replaceVault");
+    // The contents have to reach the disk before the rename does, otherwise a
+    // crash can leave the new name pointing at an empty or partial file
+    if (sync)
+    {
+      try
+      {
+        syncFile(tempPath);
+      }
+      catch (...)
+      {
+        QFile::remove(tempPath);
+        throw;
+      }
+    }
+
+    // QFile::rename refuses to overwrite. On POSIX rename() replaces the destination
+    // atomically, on Windows it fails if the destination exists, MoveFileEx does not
+#if defined(Q_OS_WIN)
+    bool replaced = MoveFileExW(reinterpret_cast<const wchar_t *>(QDir::toNativeSeparators(tempPath).utf16()),
+                                reinterpret_cast<const wchar_t *>(QDir::toNativeSeparators(filePath).utf16()),
+                                MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    bool replaced = std::rename(QFile::encodeName(tempPath).constData(), QFile::encodeName(filePath).constData()) == 0;
+#endif
+    if (!replaced)
+    {
+      QFile::remove(tempPath);
+      throw FileOperationError("Failed to replace vault file: " + filePath.toStdString());
+    }
+
+    if (sync)
+    {
+      syncDirectory(filePath);
+    }
   }
 
   // =============================================================================
   // LOW-LEVEL API IMPLEMENTATION
   // =============================================================================
 
+  void syncFile(QFile &file)
+  {
+    TRACE_SPAN("file", "FileUtils::syncFile");
+    if (!file.flush())
+    {
+      throw FileOperationError("Cannot flush file: " + file.fileName().toStdString());
+    }
+
+#if defined(Q_OS_WIN)
+    int result = _commit(file.handle());
+#elif defined(Q_OS_DARWIN)
+    // fsync only reaches the drive cache on macOS, F_FULLFSYNC flushes the drive as well
+    int result = fcntl(file.handle(), F_FULLFSYNC);
+    if (result != 0)
+    {
+      result = fsync(file.handle());
+    }
+#else
+    int result = fsync(file.handle());
+#endif
+    if (result != 0)
+    {
+      throw FileOperationError("Cannot sync file: " + file.fileName().toStdString());
+    }
+  }
+
+  void syncFile(const QString &filePath)
+  {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::ExistingOnly))
+    {
+      throw FileOperationError("Cannot open file for syncing: " + filePath.toStdString());
+    }
+    syncFile(file);
+  }
+
+  void syncDirectory(const QString &filePath)
+  {
+    TRACE_SPAN("file", "FileUtils::syncDirectory");
+#if defined(Q_OS_WIN)
+    Q_UNUSED(filePath);
+#else
+    QByteArray directory = QFile::encodeName(QFileInfo(filePath).absolutePath());
+    int fd = ::open(directory.constData(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw FileOperationError("Cannot open directory for syncing: " + directory.toStdString());
+    }
+    int result = fsync(fd);
+    ::close(fd);
+    if (result != 0)
+    {
+      throw FileOperationError("Cannot sync directory: " + directory.toStdString());
+    }
+#endif
+  }
+
   bool exists(const QString &filePath)
   {
     return QFileInfo::exists(filePath);
   }
 
   QByteArray extractSalt(const QString &filePath)
+  {
+    return extractKeyDerivation(filePath).salt;
+  }
+
+  KeyDerivation extractKeyDerivation(const QString &filePath)
   {
     if (!exists(filePath))
     {
@@ -162,20 +540,17 @@ namespace FileUtils
 
     try
     {
-      QFile file(filePath);
-      if (!file.open(QIODevice::ReadOnly))
+      Detail::MappedVaultFile mapped(filePath);
+      KeyDerivation keyDerivation = Detail::keyDerivationFromVaultData(mapped.bytes());
+      if (keyDerivation.salt.isEmpty())
       {
-        qWarning() << "Cannot open file to extract salt:" << filePath;
-        return {};
+        qWarning() << "Vault file has no valid key derivation header:" << filePath;
       }
-
-      QByteArray salt = Detail::readSaltFromFile(file);
-      file.close();
-      return salt;
+      return keyDerivation;
     }
     catch (const std::exception &e)
     {
-      qWarning() << "extractSalt failed:" << e.what();
+      qWarning() << "extractKeyDerivation failed:" << e.what();
       return {};
     }
   }
@@ -195,116 +570,270 @@ namespace FileUtils
   namespace Detail
   {
 
-    bool isValidVaultFile(const QString &filePath)
+    MappedVaultFile::MappedVaultFile(const QString &filePath, qint64 offset, qint64 length)
+        : m_file(filePath)
     {
-      QFile file(filePath);
-      if (!file.open(QIODevice::ReadOnly))
+      if (!m_file.open(QIODevice::ReadOnly))
       {
-        return false;
+        throw FileOperationError("Cannot open vault file for reading: " + filePath.toStdString());
       }
 
-      // Check minimum file size
-      qint64 minSize = crypto_pwhash_SALTBYTES +
-                       crypto_aead_xchacha20poly1305_ietf_NPUBBYTES +
-                       crypto_aead_xchacha20poly1305_ietf_ABYTES; // Minimum for empty data
+      qint64 fileSize = m_file.size();
+      if (length < 0)
+      {
+        length = fileSize - offset;
+      }
+      if (offset < 0 || length < 0 || offset + length > fileSize)
+      {
+        throw FileOperationError("Vault file range out of bounds: " + filePath.toStdString());
+      }
 
-      bool valid = file.size() >= minSize;
-      file.close();
-      return valid;
+      if (length > 0)
+      {
+        m_mapping = m_file.map(offset, length);
+      }
+
+      if (m_mapping)
+      {
+        m_bytes = QByteArrayView(reinterpret_cast<const char *>(m_mapping), length);
+      }
+      else
+      {
+        // Empty ranges and file systems without mmap support take the copying path
+        m_file.seek(offset);
+        m_fallback = m_file.read(length);
+        if (m_fallback.size() != length)
+        {
+          throw FileOperationError("Failed to read vault file: " + filePath.toStdString());
+        }
+        m_bytes = m_fallback;
+      }
     }
 
-    QByteArray readSaltFromFile(QFile &file)
+    MappedVaultFile::~MappedVaultFile()
     {
-      if (!file.isOpen() || !file.isReadable())
+      if (m_mapping)
       {
-        throw FileOperationError("File is not open for reading");
+        m_file.unmap(m_mapping);
       }
+    }
 
-      // Ensure we're at the beginning
-      file.seek(0);
+    CryptoUtils::LockedBytes decryptVaultData(QByteArrayView data, QByteArrayView rootKey, bool *outLegacyKeySchedule)
+    {
+      if (!Detail::isValidVaultData(data))
+      {
+        throw FileOperationError("Invalid vault file format");
+      }
 
-      QByteArray salt = file.read(crypto_pwhash_SALTBYTES);
-      if (salt.size() != crypto_pwhash_SALTBYTES)
+      // Segmented vaults only decrypt the index here
+      if (Detail::isSegmentedVaultData(data))
       {
-        throw FileOperationError("Failed to read complete salt from file");
+        SecureMemory::Buffer key = CryptoUtils::expandRootKey(rootKey, CryptoUtils::RootSubkey::Vault);
+        CryptoUtils::LockedBytes index = Detail::readSegmentedIndex(data, key);
+
+        if (outLegacyKeySchedule)
+        {
+          *outLegacyKeySchedule = false;
+        }
+        return index;
+      }
+
+      // Monolithic layout: salt | nonce | ciphertext, all views into the mapping
+      const qsizetype NONCE_OFFSET = crypto_pwhash_SALTBYTES;
+      const qsizetype CIPHERTEXT_OFFSET = NONCE_OFFSET + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+      QByteArrayView nonce = data.sliced(NONCE_OFFSET, crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
+      QByteArrayView ciphertext = data.sliced(CIPHERTEXT_OFFSET);
+      if (ciphertext.size() <= static_cast<qsizetype>(crypto_aead_xchacha20poly1305_ietf_ABYTES))
+      {
+        throw FileOperationError("No encrypted data found in vault file");
       }
 
-      return salt;
+      // Decrypt straight from the mapping into locked memory
+      CryptoUtils::LockedBytes decrypted(ciphertext.size() - crypto_aead_xchacha20poly1305_ietf_ABYTES);
+
+      SecureMemory::Buffer key = CryptoUtils::expandRootKey(rootKey, CryptoUtils::RootSubkey::Vault);
+      bool legacyKeySchedule = false;
+      try
+      {
+        CryptoUtils::decrypt(ciphertext, key, nonce, decrypted.bytes());
+      }
+      catch (const CryptoUtils::CryptoOperationError &)
+      {
+        // Vaults written before the key schedule existed are encrypted with
+        // the password hash itself. Trying it costs one AEAD pass, not a KDF run
+        CryptoUtils::decrypt(ciphertext, rootKey, nonce, decrypted.bytes());
+        legacyKeySchedule = true;
+      }
+
+      if (outLegacyKeySchedule)
+      {
+        *outLegacyKeySchedule = legacyKeySchedule;
+      }
+
+      return decrypted;
     }
 
-    bool writeVaultToFile(const QString &filePath, const QByteArray &salt,
-                          const QByteArray &nonce, const QByteArray &ciphertext)
+    bool isValidVaultFile(const QString &filePath)
     {
-      // Validate inputs
-      if (salt.size() != crypto_pwhash_SALTBYTES)
+      try
+      {
+        MappedVaultFile mapped(filePath);
+        return isValidVaultData(mapped.bytes());
+      }
+      catch (const FileOperationError &)
       {
-        qWarning() << "Invalid salt size:" << salt.size() << "expected:" << crypto_pwhash_SALTBYTES;
         return false;
       }
+    }
 
-      if (nonce.size() != crypto_aead_xchacha20poly1305_ietf_NPUBBYTES)
+    bool isValidVaultData(QByteArrayView data)
+    {
+      // Check minimum file size
+      qsizetype minSize = crypto_pwhash_SALTBYTES +
+                          crypto_aead_xchacha20poly1305_ietf_NPUBBYTES +
+                          crypto_aead_xchacha20poly1305_ietf_ABYTES; // Minimum for empty data
+      if (isSegmentedVaultData(data))
       {
-        qWarning() << "Invalid nonce size:" << nonce.size() << "expected:" << crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
-        return false;
+        quint16 version = qFromLittleEndian<quint16>(data.constData() + SEGMENTED_MAGIC_SIZE);
+        minSize += segmentedHeaderSize(version) - crypto_pwhash_SALTBYTES + INDEX_LENGTH_SIZE;
       }
 
-      if (ciphertext.isEmpty())
+      return data.size() >= minSize;
+    }
+
+    bool isSegmentedVaultData(QByteArrayView data)
+    {
+      if (data.size() < SEGMENTED_MAGIC_SIZE + static_cast<qsizetype>(sizeof(quint16)) ||
+          !data.startsWith(QByteArrayView(SEGMENTED_MAGIC, SEGMENTED_MAGIC_SIZE)))
       {
-        qWarning() << "Ciphertext cannot be empty";
         return false;
       }
 
-      QFile file(filePath);
-      if (!file.open(QIODevice::WriteOnly))
+      quint16 version = qFromLittleEndian<quint16>(data.constData() + SEGMENTED_MAGIC_SIZE);
+      return version >= SEGMENTED_VERSION_SINGLE_INDEX && version <= SEGMENTED_VERSION;
+    }
+
+    KeyDerivation keyDerivationFromVaultData(QByteArrayView data)
+    {
+      // Monolithic files and older segmented files used the fixed parameters
+      KeyDerivation keyDerivation;
+      keyDerivation.params = CryptoUtils::KdfParams::interactive();
+
+      qsizetype saltOffset = 0;
+      if (isSegmentedVaultData(data))
       {
-        qWarning() << "Cannot open file for writing:" << filePath;
-        return false;
+        // Segmented files store the salt after their magic and version
+        saltOffset = SEGMENTED_SALT_OFFSET;
+        quint16 version = qFromLittleEndian<quint16>(data.constData() + SEGMENTED_MAGIC_SIZE);
+        if (version >= SEGMENTED_VERSION_KDF_PARAMS)
+        {
+          if (data.size() < SEGMENTED_MAX_HEADER_SIZE)
+          {
+            return {};
+          }
+          const char *params = data.constData() + SEGMENTED_BASE_HEADER_SIZE;
+          keyDerivation.params.algorithm = static_cast<quint8>(*params);
+          keyDerivation.params.opsLimit = qFromLittleEndian<quint64>(params + sizeof(quint8));
+          keyDerivation.params.memLimit = qFromLittleEndian<quint64>(params + sizeof(quint8) + sizeof(quint64));
+          if (!keyDerivation.params.isValid())
+          {
+            return {};
+          }
+        }
       }
 
-      // Write components in order
-      if (file.write(salt) != salt.size() ||
-          file.write(nonce) != nonce.size() ||
-          file.write(ciphertext) != ciphertext.size())
+      if (data.size() < saltOffset + static_cast<qsizetype>(crypto_pwhash_SALTBYTES))
       {
-        qWarning() << "Failed to write complete data to file";
-        file.close();
-        return false;
+        return {};
+      }
+      keyDerivation.salt = data.sliced(saltOffset, crypto_pwhash_SALTBYTES).toByteArray();
+      return keyDerivation;
+    }
+
+    KeyDerivation readKeyDerivationFromFile(QFile &file)
+    {
+      if (!file.isOpen() || !file.isReadable())
+      {
+        throw FileOperationError("File is not open for reading");
       }
 
-      file.close();
+      file.seek(0);
+      KeyDerivation keyDerivation = keyDerivationFromVaultData(file.read(SEGMENTED_MAX_HEADER_SIZE));
+      if (keyDerivation.salt.size() != crypto_pwhash_SALTBYTES)
+      {
+        throw FileOperationError("Failed to read complete salt from file");
+      }
 
-      // Write to file atomically (write to temp, then rename)
-      // QString tempPath = filePath + ".tmp";
+      return keyDerivation;
+    }
 
-      // QFile file(tempPath);
-      // if (!file.open(QIODevice::WriteOnly))
-      // {
-      //   qWarning() << "Cannot create temporary file:" << tempPath;
-      //   return false;
-      // }
+    bool isSegmentedVaultFile(QFile &file)
+    {
+      if (!file.isOpen() || !file.isReadable())
+      {
+        throw FileOperationError("File is not open for reading");
+      }
 
-      // // Write components in order
-      // if (file.write(salt) != salt.size() ||
-      //     file.write(nonce) != nonce.size() ||
-      //     file.write(ciphertext) != ciphertext.size())
-      // {
-      //   qWarning() << "Failed to write complete data to temporary file";
-      //   file.close();
-      //   QFile::remove(tempPath);
-      //   return false;
-      // }
+      file.seek(0);
+      return isSegmentedVaultData(file.read(SEGMENTED_MAGIC_SIZE + sizeof(quint16)));
+    }
 
-      // file.close();
+    CryptoUtils::LockedBytes readSegmentedIndex(QByteArrayView data, QByteArrayView key)
+    {
+      TRACE_SPAN("file", "FileUtils::readSegmentedIndex");
+      const qint64 NONCE_SIZE = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
 
-      // // Atomic rename
-      // if (!QFile::rename(tempPath, filePath))
-      // {
-      //   qWarning() << "Failed to rename temporary file to final location";
-      //   QFile::remove(tempPath);
-      //   return false;
-      // }
+      quint16 version = qFromLittleEndian<quint16>(data.constData() + SEGMENTED_MAGIC_SIZE);
+      const qint64 HEADER_SIZE = segmentedHeaderSize(version);
+      if (data.size() < HEADER_SIZE + INDEX_LENGTH_SIZE)
+      {
+        throw FileOperationError("Invalid segmented vault header");
+      }
+      QByteArrayView header = data.first(HEADER_SIZE);
 
-      return true;
+      // The index sits at the end of the file, its length is the last field
+      qint64 indexLength = qFromLittleEndian<quint32>(data.constData() + data.size() - INDEX_LENGTH_SIZE);
+      qint64 indexOffset = data.size() - INDEX_LENGTH_SIZE - indexLength;
+      if (indexLength < NONCE_SIZE || indexOffset < HEADER_SIZE)
+      {
+        throw FileOperationError("Invalid segmented vault index");
+      }
+      QByteArrayView body = data.sliced(indexOffset, indexLength);
+
+      if (version == SEGMENTED_VERSION_SINGLE_INDEX)
+      {
+        if (indexLength < NONCE_SIZE + static_cast<qint64>(crypto_aead_xchacha20poly1305_ietf_ABYTES))
+        {
+          throw FileOperationError("Invalid segmented vault index");
+        }
+
+        CryptoUtils::LockedBytes index(indexLength - NONCE_SIZE - crypto_aead_xchacha20poly1305_ietf_ABYTES);
+        CryptoUtils::decrypt(body.sliced(NONCE_SIZE), key, body.first(NONCE_SIZE), index.bytes(), header.toByteArray());
+        return index;
+      }
+
+      qint64 indexSize = CryptoUtils::streamPlaintextSize(indexLength);
+      if (indexSize < 0)
+      {
+        throw FileOperationError("Invalid segmented vault index");
+      }
+
+      // Decrypt chunk by chunk from the mapping into a locked buffer sized up front.
+      // fromRawData wraps the mapping without copying it
+      QByteArray stream = QByteArray::fromRawData(body.constData(), body.size());
+      QBuffer source(&stream);
+      source.open(QIODevice::ReadOnly);
+
+      CryptoUtils::LockedBytes index(indexSize);
+      {
+        QBuffer target(&index.bytes());
+        target.open(QIODevice::WriteOnly); // Without Truncate the buffer is overwritten in place
+        if (CryptoUtils::decryptStream(source, indexLength, target, key, header.toByteArray()) != indexSize)
+        {
+          throw FileOperationError("Invalid segmented vault index");
+        }
+      }
+      return index;
     }
 
   } // namespace Detail
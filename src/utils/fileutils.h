@@ -2,9 +2,16 @@
 #define FILEUTILS_H
 
 #include <QByteArray>
+#include <QByteArrayView>
+#include <QDateTime>
 #include <QString>
 #include <QFile>
+#include <QLockFile>
+#include <QList>
+#include <functional>
+#include <memory>
 #include <stdexcept>
+#include "../crypto/cryptoutils.h"
 
 namespace FileUtils
 {
@@ -19,44 +26,204 @@ namespace FileUtils
         : std::runtime_error(message) {}
   };
 
+  /**
+   * @brief Salt and password hash parameters the root key of a vault is derived with
+   * Stored in the vault header, so every vault can carry its own calibrated cost
+   */
+  struct KeyDerivation
+  {
+    QByteArray salt;
+    CryptoUtils::KdfParams params;
+  };
+
+  /**
+   * @brief How far a committed write is pushed towards the disk before it counts as done
+   */
+  enum class Durability
+  {
+    Strict,  // Every commit is written and fsynced before the mutating call returns
+    Grouped, // Commits of one write-behind window share a single write and fsync
+    Relaxed, // Writes are grouped, nothing is fsynced. Files are still replaced atomically
+  };
+
+  /**
+   * @brief Location of an encrypted record block inside a segmented vault file
+   */
+  struct BlockLocation
+  {
+    qint64 offset = -1; // Absolute file offset, -1 if the block is not on disk
+    quint32 length = 0; // Nonce + ciphertext
+  };
+
+  namespace Detail
+  {
+    class MappedVaultFile;
+  }
+
+  /**
+   * @brief Vault file read, validated and mapped ahead of the unlock (see prepareVault)
+   */
+  struct PreparedVault
+  {
+    QString filePath;
+    bool exists = false;         // false if the vault is created by the first unlock
+    KeyDerivation keyDerivation; // From the header, or calibrated by the caller for a vault yet to be created
+    std::shared_ptr<const Detail::MappedVaultFile> mapping; // Whole file, null if it is missing or invalid
+    qint64 size = -1;
+    QDateTime lastModified;
+
+    /**
+     * @brief Whether the unlock can start from this instead of the file
+     * False if the file is invalid, or was created, replaced or changed since it was prepared
+     */
+    bool isUsable() const;
+  };
+
+  /**
+   * @brief One record block to store in a segmented vault file
+   * Either plaintext to encrypt, or an existing block copied verbatim from the source file
+   */
+  struct RecordBlock
+  {
+    quint64 id = 0;       // Authenticated with the block so blocks cannot be swapped
+    QByteArray plain;     // Block contents to encrypt
+    BlockLocation source; // Used instead of plain when plain is empty
+  };
+
   // =============================================================================
   // HIGH-LEVEL API (Recommended for most use cases)
   // =============================================================================
 
   /**
    * @brief Create a new encrypted vault file
+   * The password hash parameters are calibrated for this machine (CryptoUtils::calibrateKdf)
    * @param filePath Path to the vault file to create
    * @param password Master password for encryption
-   * @param data Initial data (default: empty JSON array)
+   * @param data Initial data (default: empty binary vault payload)
    * @return true if successful
    * @throws FileOperationError if file creation fails
    * @throws CryptoOperationError if encryption fails
    */
   bool createVault(const QString &filePath, const QString &password,
-                   const QByteArray &data = "[]");
+                   const QByteArray &data = QByteArray());
+
+  /**
+   * @brief Create a new encrypted vault file from an already derived root key
+   * @param filePath Path to the vault file to create
+   * @param keyDerivation Salt and parameters the root key was derived with (stored in the header)
+   * @param rootKey Root key derived from the master password
+   * @param data Initial data (default: empty binary vault payload)
+   * @return true if successful
+   * @throws FileOperationError if file creation fails
+   * @throws CryptoOperationError if encryption fails
+   */
+  bool createVault(const QString &filePath, const KeyDerivation &keyDerivation,
+                   QByteArrayView rootKey, const QByteArray &data = QByteArray());
 
   /**
-   * @brief Read and decrypt an entire vault file
+   * @brief Read and decrypt a vault file
+   * For a segmented vault only the index is decrypted, record blocks are read
+   * on demand with readRecordBlock
    * @param filePath Path to the vault file
-   * @param password Master password for decryption
-   * @return Decrypted data
+   * @param rootKey Root key derived from the master password and the vault salt
+   * @param outLegacyKeySchedule Set to true if the file was encrypted directly
+   *        with the root key (vaults written before the key schedule existed)
+   * @return Decrypted data (the index of a segmented vault) in locked memory,
+   *         wiped when the guard goes out of scope
    * @throws FileOperationError if file reading fails
    * @throws CryptoOperationError if decryption fails (wrong password)
    */
-  QByteArray readVault(const QString &filePath, const QString &password);
+  CryptoUtils::LockedBytes readVault(const QString &filePath, QByteArrayView rootKey,
+                                     bool *outLegacyKeySchedule = nullptr);
+
+  /**
+   * @brief Decrypt a vault prepared by prepareVault, without touching the file again
+   * Same contract as readVault(filePath, ...), the caller checks isUsable first
+   */
+  CryptoUtils::LockedBytes readVault(const PreparedVault &prepared, QByteArrayView rootKey,
+                                     bool *outLegacyKeySchedule = nullptr);
+
+  /**
+   * @brief Map and validate a vault file and read its key derivation header, before the password is known
+   * The pages of the mapping are faulted in, so the decryption after the password
+   * hash reads from memory. Runs before the login screen is answered
+   * @param filePath Path to the vault file
+   * @return Prepared vault, never throws. Invalid or unreadable files come back without a mapping
+   */
+  PreparedVault prepareVault(const QString &filePath);
+
+  /**
+   * @brief Take the lock that keeps other processes from writing the vault
+   * The lock file next to the vault (<vault>.lock) names the owning process. A
+   * lock left behind by a process that died is taken over, a live owner never
+   * loses it however long it keeps the vault open
+   * @param filePath Path to the vault file
+   * @return Lock held until the last copy of the pointer is released
+   * @throws FileOperationError if another process has the vault open, or the lock file cannot be created
+   */
+  std::shared_ptr<QLockFile> lockVault(const QString &filePath);
 
   /**
    * @brief Update an existing vault file with new data
+   * Rewrites the file through a temporary file, keeping its key derivation header
    * @param filePath Path to the vault file
-   * @param sessionKey Pre-derived encryption key
+   * @param rootKey Root key derived from the master password and the vault salt
    * @param data New data to encrypt and save
    * @return true if successful
    * @throws FileOperationError if file operations fail
    * @throws CryptoOperationError if encryption fails
    */
-  bool updateVault(const QString &filePath, const QByteArray &sessionKey,
+  bool updateVault(const QString &filePath, QByteArrayView rootKey,
                    const QByteArray &data);
 
+  /**
+   * @brief Write a segmented vault: header, independently encrypted record blocks, encrypted index
+   *
+   * Layout: magic (4) | version (2) | salt | kdf algorithm (1) | opslimit (8) | memlimit (8) |
+   *         blocks... | index stream | index length (4)
+   *
+   * The index is written with CryptoUtils::encryptStream, so neither the index
+   * ciphertext nor unchanged blocks copied from the source are held in memory whole.
+   *
+   * @param targetPath File to write, must not be the source file
+   * @param sourcePath Existing vault providing the key derivation and blocks copied by location,
+   *        may be empty if every block has plaintext and keyDerivation is given
+   * @param rootKey Root key derived from the master password and the vault salt
+   * @param blocks Record blocks in the order they are written
+   * @param buildIndex Builds the index plaintext once the block locations are known
+   * @param keyDerivation Header to store instead of the source's, for a root key derived anew
+   * @return Locations of the written blocks, in the order of blocks
+   * @throws FileOperationError if file operations fail
+   * @throws CryptoOperationError if encryption fails
+   */
+  QList<BlockLocation> writeSegmentedVault(const QString &targetPath, const QString &sourcePath,
+                                           QByteArrayView rootKey, const QList<RecordBlock> &blocks,
+                                           const std::function<QByteArray(const QList<BlockLocation> &)> &buildIndex,
+                                           const KeyDerivation &keyDerivation = KeyDerivation());
+
+  /**
+   * @brief Read and decrypt one record block of a segmented vault
+   * @param filePath Path to the vault file
+   * @param rootKey Root key derived from the master password and the vault salt
+   * @param id Id the block was written with
+   * @param location Location of the block from the index
+   * @return Decrypted block contents
+   * @throws FileOperationError if the block cannot be read
+   * @throws CryptoOperationError if the block fails authentication
+   */
+  QByteArray readRecordBlock(const QString &filePath, QByteArrayView rootKey,
+                             quint64 id, const BlockLocation &location);
+
+  /**
+   * @brief Atomically replace a vault file with a fully written temporary file
+   * Uses rename() on POSIX and MoveFileEx with MOVEFILE_REPLACE_EXISTING on Windows.
+   * With sync the temporary file is flushed to disk before the rename and the
+   * directory after it, so a crash leaves either the old or the new vault
+   * @param sync Whether to fsync, see Durability
+   * @throws FileOperationError if the sync or the rename fails, the temporary file is removed then
+   */
+  void replaceVault(const QString &tempPath, const QString &filePath, bool sync = true);
+
   // =============================================================================
   // LOW-LEVEL API (For advanced use cases)
   // =============================================================================
@@ -73,6 +240,33 @@ namespace FileUtils
    */
   QByteArray extractSalt(const QString &filePath);
 
+  /**
+   * @brief Extract salt and password hash parameters from a vault file
+   * Vaults written before the parameters were stored report CryptoUtils::KdfParams::interactive()
+   * @param filePath Path to the vault file
+   * @return Key derivation, with an empty salt if the file doesn't exist or has no valid header
+   */
+  KeyDerivation extractKeyDerivation(const QString &filePath);
+
+  /**
+   * @brief Flush an open file through the OS caches to the disk (fsync, F_FULLFSYNC on macOS)
+   * @throws FileOperationError if the file cannot be synced
+   */
+  void syncFile(QFile &file);
+
+  /**
+   * @brief Flush a file by path through the OS caches to the disk
+   * @throws FileOperationError if the file cannot be opened or synced
+   */
+  void syncFile(const QString &filePath);
+
+  /**
+   * @brief Flush the directory containing filePath, which makes a rename or a new file durable
+   * A no-op on Windows, where the directory cannot be opened for syncing
+   * @throws FileOperationError if the directory cannot be synced
+   */
+  void syncDirectory(const QString &filePath);
+
   /**
    * @brief Generate a new random salt
    * @return Random salt of appropriate size
@@ -85,21 +279,78 @@ namespace FileUtils
 
   namespace Detail
   {
+    /**
+     * @brief Read-only memory mapping of a vault file or a range of it
+     * Header fields and ciphertext are handed out as views into the mapping, so
+     * nothing is copied out of the page cache and repeated opens of a large vault
+     * stay cheap. Falls back to reading the range where it cannot be mapped
+     */
+    class MappedVaultFile
+    {
+    public:
+      /**
+       * @param filePath Path to the vault file
+       * @param offset Start of the mapped range
+       * @param length Length of the mapped range, -1 for the rest of the file
+       * @throws FileOperationError if the file cannot be opened or the range is out of bounds
+       */
+      explicit MappedVaultFile(const QString &filePath, qint64 offset = 0, qint64 length = -1);
+      ~MappedVaultFile();
+
+      MappedVaultFile(const MappedVaultFile &) = delete;
+      MappedVaultFile &operator=(const MappedVaultFile &) = delete;
+
+      QByteArrayView bytes() const { return m_bytes; }
+
+    private:
+      QFile m_file;
+      uchar *m_mapping = nullptr;
+      QByteArray m_fallback;
+      QByteArrayView m_bytes;
+    };
+
+    /**
+     * @brief Decrypt mapped vault file contents (the index of a segmented vault)
+     * @throws FileOperationError if the contents are not a vault
+     * @throws CryptoOperationError if decryption fails (wrong password)
+     */
+    CryptoUtils::LockedBytes decryptVaultData(QByteArrayView data, QByteArrayView rootKey, bool *outLegacyKeySchedule);
+
     /**
      * @brief Validate vault file format
      */
     bool isValidVaultFile(const QString &filePath);
 
     /**
-     * @brief Read salt from an open file handle
+     * @brief Validate the contents of a vault file (monolithic or segmented layout)
+     */
+    bool isValidVaultData(QByteArrayView data);
+
+    /**
+     * @brief Check whether vault file contents use the segmented layout
+     */
+    bool isSegmentedVaultData(QByteArrayView data);
+
+    /**
+     * @brief Key derivation stored in vault file contents, empty salt if the header is invalid
+     */
+    KeyDerivation keyDerivationFromVaultData(QByteArrayView data);
+
+    /**
+     * @brief Decrypt the index of a segmented vault from the file contents
+     * The index is decrypted into locked memory that is wiped when the guard goes out of scope
+     */
+    CryptoUtils::LockedBytes readSegmentedIndex(QByteArrayView data, QByteArrayView key);
+
+    /**
+     * @brief Read the key derivation from an open file handle (monolithic or segmented layout)
      */
-    QByteArray readSaltFromFile(QFile &file);
+    KeyDerivation readKeyDerivationFromFile(QFile &file);
 
     /**
-     * @brief Write vault data to file with proper format
+     * @brief Check whether an open vault file uses the segmented layout
      */
-    bool writeVaultToFile(const QString &filePath, const QByteArray &salt,
-                          const QByteArray &nonce, const QByteArray &ciphertext);
+    bool isSegmentedVaultFile(QFile &file);
   }
 
 } // namespace FileUtils
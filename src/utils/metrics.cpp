@@ -0,0 +1,270 @@
+#include "metrics.h"
+#include <QDebug>
+#include <QFile>
+#include <QJsonDocument>
+#include <QtAlgorithms>
+#include <cmath>
+
+namespace
+{
+  constexpr int OPERATION_COUNT = static_cast<int>(Metrics::Operation::OperationCount);
+  constexpr int COUNTER_COUNT = static_cast<int>(Metrics::Counter::CounterCount);
+
+  struct Registry
+  {
+    Metrics::LatencyHistogram histograms[OPERATION_COUNT];
+    std::atomic<qint64> counters[COUNTER_COUNT] = {};
+  };
+
+  Registry &registry()
+  {
+    // Never destroyed, worker threads may still record while static objects go away
+    static Registry *instance = new Registry;
+    return *instance;
+  }
+
+  // Set once at startup by configure
+  QString s_outputPath;
+
+  Metrics::HistogramSnapshot summarize(const Metrics::LatencyHistogram &histogram)
+  {
+    using Metrics::LatencyHistogram;
+
+    // Copy the buckets first, percentiles are computed on one consistent view of them
+    quint64 buckets[LatencyHistogram::BUCKET_COUNT];
+    quint64 count = 0;
+    for (int i = 0; i < LatencyHistogram::BUCKET_COUNT; ++i)
+    {
+      buckets[i] = histogram.bucketCount(i);
+      count += buckets[i];
+    }
+
+    Metrics::HistogramSnapshot summary;
+    if (count == 0)
+    {
+      return summary;
+    }
+
+    summary.count = count;
+    summary.minNanoseconds = histogram.min();
+    summary.maxNanoseconds = histogram.max();
+    summary.totalNanoseconds = histogram.total();
+    summary.meanNanoseconds = summary.totalNanoseconds / static_cast<qint64>(qMax<quint64>(histogram.count(), 1));
+
+    auto percentile = [&](double fraction)
+    {
+      quint64 rank = qMax<quint64>(1, static_cast<quint64>(std::ceil(fraction * count)));
+      quint64 seen = 0;
+      for (int i = 0; i < LatencyHistogram::BUCKET_COUNT; ++i)
+      {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+          return qMin(LatencyHistogram::bucketUpperBound(i), summary.maxNanoseconds);
+        }
+      }
+      return summary.maxNanoseconds;
+    };
+
+    summary.p50Nanoseconds = percentile(0.50);
+    summary.p90Nanoseconds = percentile(0.90);
+    summary.p99Nanoseconds = percentile(0.99);
+    summary.p999Nanoseconds = percentile(0.999);
+    return summary;
+  }
+}
+
+namespace Metrics
+{
+  const char *operationName(Operation operation)
+  {
+    switch (operation)
+    {
+    case Operation::Unlock:
+      return "unlock";
+    case Operation::Lock:
+      return "lock";
+    case Operation::Add:
+      return "add";
+    case Operation::Update:
+      return "update";
+    case Operation::Remove:
+      return "remove";
+    case Operation::Reveal:
+      return "reveal";
+    case Operation::Copy:
+      return "copy";
+    case Operation::Save:
+      return "save";
+    case Operation::Commit:
+      return "commit";
+    case Operation::KeyDerivation:
+      return "key_derivation";
+    default:
+      return "unknown";
+    }
+  }
+
+  const char *counterName(Counter counter)
+  {
+    switch (counter)
+    {
+    case Counter::BytesWritten:
+      return "bytes_written";
+    case Counter::KdfInvocations:
+      return "kdf_invocations";
+    case Counter::SecretCacheHits:
+      return "secret_cache_hits";
+    case Counter::SecretCacheMisses:
+      return "secret_cache_misses";
+    default:
+      return "unknown";
+    }
+  }
+
+  void LatencyHistogram::record(qint64 nanoseconds)
+  {
+    nanoseconds = qMax<qint64>(nanoseconds, 0);
+    m_buckets[bucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_total.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    qint64 current = m_min.load(std::memory_order_relaxed);
+    while (nanoseconds < current && !m_min.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed))
+    {
+    }
+    current = m_max.load(std::memory_order_relaxed);
+    while (nanoseconds > current && !m_max.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed))
+    {
+    }
+  }
+
+  int LatencyHistogram::bucketOf(qint64 nanoseconds)
+  {
+    quint64 value = nanoseconds > 0 ? static_cast<quint64>(nanoseconds) : 0;
+    if (value < SUB_BUCKETS)
+    {
+      return static_cast<int>(value);
+    }
+
+    // The top SUB_BUCKET_BITS + 1 bits select the bucket, lower bits are the precision given up
+    int exponent = 63 - qCountLeadingZeroBits(value);
+    int shift = exponent - SUB_BUCKET_BITS;
+    int subBucket = static_cast<int>(value >> shift) - SUB_BUCKETS;
+    return SUB_BUCKETS + shift * SUB_BUCKETS + subBucket;
+  }
+
+  qint64 LatencyHistogram::bucketUpperBound(int bucket)
+  {
+    if (bucket < SUB_BUCKETS)
+    {
+      return bucket;
+    }
+
+    int shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+    int subBucket = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+    quint64 lower = static_cast<quint64>(SUB_BUCKETS + subBucket) << shift;
+    return static_cast<qint64>(lower + ((quint64(1) << shift) - 1));
+  }
+
+  QJsonObject Snapshot::toJson() const
+  {
+    QJsonObject histogramsJson;
+    for (int i = 0; i < histograms.size(); ++i)
+    {
+      const HistogramSnapshot &summary = histograms[i];
+      histogramsJson[operationName(static_cast<Operation>(i))] = QJsonObject{
+          {"count", static_cast<qint64>(summary.count)},
+          {"min_ns", summary.minNanoseconds},
+          {"mean_ns", summary.meanNanoseconds},
+          {"total_ns", summary.totalNanoseconds},
+          {"p50_ns", summary.p50Nanoseconds},
+          {"p90_ns", summary.p90Nanoseconds},
+          {"p99_ns", summary.p99Nanoseconds},
+          {"p999_ns", summary.p999Nanoseconds},
+          {"max_ns", summary.maxNanoseconds},
+      };
+    }
+
+    QJsonObject countersJson;
+    for (int i = 0; i < counters.size(); ++i)
+    {
+      countersJson[counterName(static_cast<Counter>(i))] = counters[i];
+    }
+
+    return QJsonObject{{"histograms", histogramsJson}, {"counters", countersJson}};
+  }
+
+  void recordLatency(Operation operation, qint64 nanoseconds)
+  {
+    registry().histograms[static_cast<int>(operation)].record(nanoseconds);
+  }
+
+  void increment(Counter counter, qint64 amount)
+  {
+    registry().counters[static_cast<int>(counter)].fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  Snapshot snapshot()
+  {
+    Registry &instance = registry();
+    Snapshot result;
+    result.histograms.reserve(OPERATION_COUNT);
+    for (const LatencyHistogram &histogram : instance.histograms)
+    {
+      result.histograms.append(summarize(histogram));
+    }
+    result.counters.reserve(COUNTER_COUNT);
+    for (const std::atomic<qint64> &counter : instance.counters)
+    {
+      result.counters.append(counter.load(std::memory_order_relaxed));
+    }
+    return result;
+  }
+
+  bool writeSnapshot(const QString &filePath)
+  {
+    QFile file(filePath);
+    QByteArray json = QJsonDocument(snapshot().toJson()).toJson();
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size())
+    {
+      qWarning() << "Cannot write metrics file:" << filePath;
+      return false;
+    }
+    return true;
+  }
+
+  QString configure(const QStringList &arguments)
+  {
+    QString filePath;
+    const QString flag = QString::fromLatin1(COMMAND_LINE_FLAG);
+    for (qsizetype i = 0; i < arguments.size(); ++i)
+    {
+      if (arguments[i] == flag && i + 1 < arguments.size())
+      {
+        filePath = arguments[i + 1];
+      }
+      else if (arguments[i].startsWith(flag + '='))
+      {
+        filePath = arguments[i].mid(flag.size() + 1);
+      }
+    }
+
+    if (filePath.isEmpty())
+    {
+      filePath = qEnvironmentVariable(ENVIRONMENT_VARIABLE);
+    }
+
+    s_outputPath = filePath;
+    return filePath;
+  }
+
+  bool dump()
+  {
+    if (s_outputPath.isEmpty())
+    {
+      return false;
+    }
+    return writeSnapshot(s_outputPath);
+  }
+}
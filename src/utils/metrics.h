@@ -0,0 +1,176 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <limits>
+
+/**
+ * @brief Process wide latency histograms and counters of the vault operations
+ *
+ * Histograms are log-linear like HdrHistogram: every power of two of
+ * nanoseconds is split into 16 buckets, so a recorded latency is kept with
+ * about 6% precision from 1 ns up to the range of qint64. Recording is a few
+ * relaxed atomic increments and never takes a lock, from any thread.
+ *
+ * Read the numbers with snapshot() (or VaultManager::metricsSnapshot), or set
+ * --metrics <file> / PASSWORDMANAGER_METRICS=<file> to write them as JSON at exit
+ */
+namespace Metrics
+{
+  /**
+   * @brief Environment variable naming the file the metrics are written to at exit
+   */
+  constexpr char ENVIRONMENT_VARIABLE[] = "PASSWORDMANAGER_METRICS";
+
+  /**
+   * @brief Command line flag naming the file the metrics are written to at exit
+   */
+  constexpr char COMMAND_LINE_FLAG[] = "--metrics";
+
+  enum class Operation
+  {
+    Unlock,        // Unlock pipeline from password to decrypted entries
+    Lock,          // closeVault, including the final flush
+    Add,           // addEntry / addEntries call
+    Update,        // updateEntry / updateEntries call
+    Remove,        // removeEntry / removeEntries call
+    Reveal,        // Revealing a password in the list
+    Copy,          // Copying a password to the clipboard
+    Save,          // Full snapshot of the vault
+    Commit,        // Journal write or snapshot made durable (see FileUtils::Durability)
+    KeyDerivation, // One Argon2 run, part of every unlock
+    OperationCount
+  };
+
+  enum class Counter
+  {
+    BytesWritten,      // Vault, snapshot and journal bytes written
+    KdfInvocations,    // Argon2 runs, including calibration probes
+    SecretCacheHits,   // Passwords answered from the decrypted password cache
+    SecretCacheMisses, // Passwords that had to be decrypted
+    CounterCount
+  };
+
+  const char *operationName(Operation operation);
+  const char *counterName(Counter counter);
+
+  /**
+   * @brief Lock-free log-linear latency histogram
+   */
+  class LatencyHistogram
+  {
+  public:
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int BUCKET_COUNT = SUB_BUCKETS + (63 - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+    void record(qint64 nanoseconds);
+
+    /**
+     * @brief Bucket a value falls into
+     */
+    static int bucketOf(qint64 nanoseconds);
+
+    /**
+     * @brief Largest value that falls into a bucket
+     */
+    static qint64 bucketUpperBound(int bucket);
+
+    quint64 bucketCount(int bucket) const { return m_buckets[bucket].load(std::memory_order_relaxed); }
+    quint64 count() const { return m_count.load(std::memory_order_relaxed); }
+    qint64 total() const { return m_total.load(std::memory_order_relaxed); }
+    qint64 min() const { return m_min.load(std::memory_order_relaxed); }
+    qint64 max() const { return m_max.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<quint64> m_buckets[BUCKET_COUNT] = {};
+    std::atomic<quint64> m_count{0};
+    std::atomic<qint64> m_total{0};
+    std::atomic<qint64> m_min{std::numeric_limits<qint64>::max()};
+    std::atomic<qint64> m_max{0};
+  };
+
+  /**
+   * @brief Summary of one histogram at the time of the snapshot
+   * Percentiles are the upper bound of the bucket they fall into, capped at max
+   */
+  struct HistogramSnapshot
+  {
+    quint64 count = 0;
+    qint64 minNanoseconds = 0;
+    qint64 maxNanoseconds = 0;
+    qint64 meanNanoseconds = 0;
+    qint64 totalNanoseconds = 0;
+    qint64 p50Nanoseconds = 0;
+    qint64 p90Nanoseconds = 0;
+    qint64 p99Nanoseconds = 0;
+    qint64 p999Nanoseconds = 0;
+  };
+
+  struct Snapshot
+  {
+    QList<HistogramSnapshot> histograms; // Indexed by Operation
+    QList<qint64> counters;              // Indexed by Counter
+
+    const HistogramSnapshot &histogram(Operation operation) const { return histograms[static_cast<int>(operation)]; }
+    qint64 counter(Counter counter) const { return counters[static_cast<int>(counter)]; }
+    QJsonObject toJson() const;
+  };
+
+  void recordLatency(Operation operation, qint64 nanoseconds);
+  void increment(Counter counter, qint64 amount = 1);
+
+  /**
+   * @brief Current state of every histogram and counter
+   */
+  Snapshot snapshot();
+
+  /**
+   * @brief Write snapshot().toJson() to a file
+   * @return false if the file cannot be written
+   */
+  bool writeSnapshot(const QString &filePath);
+
+  /**
+   * @brief Remember the dump file given by --metrics <file> or PASSWORDMANAGER_METRICS=<file>
+   * The command line wins over the environment. Recording is always on
+   * @return File dump writes to, empty if none was requested
+   */
+  QString configure(const QStringList &arguments);
+
+  /**
+   * @brief Write the metrics to the file chosen by configure
+   * @return false if no file was chosen or it cannot be written
+   */
+  bool dump();
+
+  /**
+   * @brief Records the latency of the enclosing scope into an operation histogram
+   */
+  class ScopedLatency
+  {
+  public:
+    explicit ScopedLatency(Operation operation)
+        : m_operation(operation)
+    {
+      m_timer.start();
+    }
+
+    ~ScopedLatency() { recordLatency(m_operation, m_timer.nsecsElapsed()); }
+
+    ScopedLatency(const ScopedLatency &) = delete;
+    ScopedLatency &operator=(const ScopedLatency &) = delete;
+
+  private:
+    Operation m_operation;
+    QElapsedTimer m_timer;
+  };
+}
+
+#endif // METRICS_H
@@ -0,0 +1,239 @@
+#include "tracing.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QThread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace
+{
+  struct Event
+  {
+    const char *category;
+    const char *name;
+    qint64 start;
+    qint64 duration;
+  };
+
+  // One ring slot guarded by a seqlock. Span n is written under sequence
+  // 2n + 1 and published as 2n + 2, so a reader that sees the same published
+  // sequence before and after its copy knows the copy is span n, untorn
+  struct Slot
+  {
+    std::atomic<quint64> sequence{0};
+    std::atomic<const char *> category{nullptr};
+    std::atomic<const char *> name{nullptr};
+    std::atomic<qint64> start{0};
+    std::atomic<qint64> duration{0};
+  };
+
+  // Written by its thread only. head counts every span ever recorded, the next
+  // one goes to head % RING_CAPACITY
+  struct ThreadBuffer
+  {
+    int threadId = 0;
+    QString threadName;
+    std::unique_ptr<Slot[]> slots{new Slot[Tracing::RING_CAPACITY]};
+    std::atomic<quint64> head{0};
+  };
+
+  quint64 publishedSequence(quint64 index)
+  {
+    return 2 * index + 2;
+  }
+
+  // Buffers outlive their threads, so spans of finished pool threads still end up in the trace
+  struct Registry
+  {
+    QMutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+  };
+
+  Registry &registry()
+  {
+    // Never destroyed, threads may still record while static objects go away
+    static Registry *instance = new Registry;
+    return *instance;
+  }
+
+  thread_local ThreadBuffer *t_buffer = nullptr;
+
+  ThreadBuffer *threadBuffer()
+  {
+    if (t_buffer)
+    {
+      return t_buffer;
+    }
+
+    auto buffer = std::make_unique<ThreadBuffer>();
+    QThread *thread = QThread::currentThread();
+    buffer->threadName = thread ? thread->objectName() : QString();
+
+    Registry &instance = registry();
+    QMutexLocker locker(&instance.mutex);
+    buffer->threadId = static_cast<int>(instance.buffers.size()) + 1;
+    if (buffer->threadName.isEmpty())
+    {
+      bool isMainThread = QCoreApplication::instance() && thread == QCoreApplication::instance()->thread();
+      buffer->threadName = isMainThread ? QStringLiteral("main") : QStringLiteral("thread %1").arg(buffer->threadId);
+    }
+    t_buffer = buffer.get();
+    instance.buffers.push_back(std::move(buffer));
+    return t_buffer;
+  }
+
+  const std::chrono::steady_clock::time_point TRACE_EPOCH = std::chrono::steady_clock::now();
+
+  // Set once at startup by configure, before other threads record
+  QString s_outputPath;
+
+  QJsonObject threadNameEvent(qint64 pid, const ThreadBuffer &buffer)
+  {
+    return QJsonObject{
+        {"name", "thread_name"},
+        {"ph", "M"},
+        {"pid", pid},
+        {"tid", buffer.threadId},
+        {"args", QJsonObject{{"name", buffer.threadName}}},
+    };
+  }
+}
+
+namespace Tracing
+{
+  std::atomic<bool> Detail::enabled{false};
+
+  void setEnabled(bool enabled)
+  {
+    Detail::enabled.store(enabled, std::memory_order_relaxed);
+  }
+
+  QString configure(const QStringList &arguments)
+  {
+    QString filePath;
+    const QString flag = QString::fromLatin1(COMMAND_LINE_FLAG);
+    for (qsizetype i = 0; i < arguments.size(); ++i)
+    {
+      if (arguments[i] == flag && i + 1 < arguments.size())
+      {
+        filePath = arguments[i + 1];
+      }
+      else if (arguments[i].startsWith(flag + '='))
+      {
+        filePath = arguments[i].mid(flag.size() + 1);
+      }
+    }
+
+    if (filePath.isEmpty())
+    {
+      filePath = qEnvironmentVariable(ENVIRONMENT_VARIABLE);
+    }
+
+    s_outputPath = filePath;
+    setEnabled(!filePath.isEmpty());
+    return filePath;
+  }
+
+  QString outputPath()
+  {
+    return s_outputPath;
+  }
+
+  bool dump()
+  {
+    if (!isEnabled() || s_outputPath.isEmpty())
+    {
+      return false;
+    }
+    return writeChromeTrace(s_outputPath);
+  }
+
+  qint64 now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - TRACE_EPOCH).count();
+  }
+
+  void record(const char *category, const char *name, qint64 start, qint64 duration)
+  {
+    ThreadBuffer *buffer = threadBuffer();
+    quint64 head = buffer->head.load(std::memory_order_relaxed);
+    Slot &slot = buffer->slots[head % RING_CAPACITY];
+
+    // Odd while the fields change, the fence keeps the field stores behind it
+    slot.sequence.store(publishedSequence(head) - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.category.store(category, std::memory_order_relaxed);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.duration.store(duration, std::memory_order_relaxed);
+    slot.sequence.store(publishedSequence(head), std::memory_order_release);
+
+    buffer->head.store(head + 1, std::memory_order_release);
+  }
+
+  QByteArray toChromeTraceJson()
+  {
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray traceEvents;
+
+    Registry &instance = registry();
+    QMutexLocker locker(&instance.mutex);
+    for (const std::unique_ptr<ThreadBuffer> &buffer : instance.buffers)
+    {
+      traceEvents.append(threadNameEvent(pid, *buffer));
+
+      quint64 head = buffer->head.load(std::memory_order_acquire);
+      quint64 first = head > quint64(RING_CAPACITY) ? head - RING_CAPACITY : 0;
+      for (quint64 i = first; i < head; ++i)
+      {
+        // The thread keeps recording meanwhile. A slot it is writing, or has
+        // already reused for a later span, fails the sequence check and is left out
+        const Slot &slot = buffer->slots[i % RING_CAPACITY];
+        const quint64 sequence = publishedSequence(i);
+        if (slot.sequence.load(std::memory_order_acquire) != sequence)
+        {
+          continue;
+        }
+        Event event{slot.category.load(std::memory_order_relaxed), slot.name.load(std::memory_order_relaxed),
+                    slot.start.load(std::memory_order_relaxed), slot.duration.load(std::memory_order_relaxed)};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+        {
+          continue;
+        }
+
+        traceEvents.append(QJsonObject{
+            {"name", QString::fromLatin1(event.name)},
+            {"cat", QString::fromLatin1(event.category)},
+            {"ph", "X"},
+            {"ts", event.start / 1000.0},
+            {"dur", event.duration / 1000.0},
+            {"pid", pid},
+            {"tid", buffer->threadId},
+        });
+      }
+    }
+
+    QJsonObject trace{{"traceEvents", traceEvents}, {"displayTimeUnit", "ms"}};
+    return QJsonDocument(trace).toJson(QJsonDocument::Compact);
+  }
+
+  bool writeChromeTrace(const QString &filePath)
+  {
+    QFile file(filePath);
+    QByteArray json = toChromeTraceJson();
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size())
+    {
+      qWarning() << "Cannot write trace file:" << filePath;
+      return false;
+    }
+    return true;
+  }
+}
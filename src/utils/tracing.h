@@ -0,0 +1,124 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+
+/**
+ * @brief Scoped timing spans for the hot paths, exported as Chrome trace JSON
+ *
+ * Every thread records into its own fixed size ring buffer, so recording takes
+ * no lock and never allocates after the first span of a thread. When the ring
+ * is full the oldest spans are overwritten. A disabled span costs one relaxed
+ * atomic load. The trace opens in chrome://tracing or ui.perfetto.dev
+ *
+ * Usage: TRACE_SPAN("crypto", "CryptoUtils::decrypt"); at the top of a scope.
+ * Category and name must be string literals, only the pointers are stored
+ */
+namespace Tracing
+{
+  /**
+   * @brief Spans kept per thread before the oldest are overwritten
+   */
+  constexpr qsizetype RING_CAPACITY = 16384;
+
+  /**
+   * @brief Environment variable naming the file the trace is written to at exit
+   */
+  constexpr char ENVIRONMENT_VARIABLE[] = "PASSWORDMANAGER_TRACE";
+
+  /**
+   * @brief Command line flag naming the file the trace is written to at exit
+   */
+  constexpr char COMMAND_LINE_FLAG[] = "--trace";
+
+  namespace Detail
+  {
+    extern std::atomic<bool> enabled;
+  }
+
+  inline bool isEnabled()
+  {
+    return Detail::enabled.load(std::memory_order_relaxed);
+  }
+
+  void setEnabled(bool enabled);
+
+  /**
+   * @brief Turn tracing on if requested by --trace <file> or PASSWORDMANAGER_TRACE=<file>
+   * The command line wins over the environment
+   * @param arguments Command line arguments of the process
+   * @return File the trace is written to by dump, empty if tracing stays off
+   */
+  QString configure(const QStringList &arguments);
+
+  /**
+   * @brief File chosen by configure, empty if none
+   */
+  QString outputPath();
+
+  /**
+   * @brief Write the trace so far to the file chosen by configure (at exit or on demand)
+   * @return false if tracing is off or the file cannot be written
+   */
+  bool dump();
+
+  /**
+   * @brief Monotonic nanoseconds since the process started
+   */
+  qint64 now();
+
+  /**
+   * @brief Store a finished span in the ring buffer of the calling thread
+   */
+  void record(const char *category, const char *name, qint64 start, qint64 duration);
+
+  /**
+   * @brief Spans of every thread in the Chrome trace event format
+   * Safe to call while other threads keep recording, spans overwritten during
+   * the copy are left out
+   */
+  QByteArray toChromeTraceJson();
+
+  /**
+   * @brief Write toChromeTraceJson to a file
+   * @return false if the file cannot be written
+   */
+  bool writeChromeTrace(const QString &filePath);
+
+  /**
+   * @brief Times the enclosing scope if tracing is enabled when it starts
+   */
+  class Span
+  {
+  public:
+    Span(const char *category, const char *name)
+        : m_category(category), m_name(name), m_start(isEnabled() ? now() : -1)
+    {
+    }
+
+    ~Span()
+    {
+      if (m_start >= 0)
+      {
+        record(m_category, m_name, m_start, now() - m_start);
+      }
+    }
+
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+  private:
+    const char *m_category;
+    const char *m_name;
+    qint64 m_start;
+  };
+}
+
+#define TRACE_SPAN_CONCAT_INNER(a, b) a##b
+#define TRACE_SPAN_CONCAT(a, b) TRACE_SPAN_CONCAT_INNER(a, b)
+#define TRACE_SPAN(category, name) Tracing::Span TRACE_SPAN_CONCAT(traceSpan, __LINE__)(category, name)
+
+#endif // TRACING_H
@@ -0,0 +1,234 @@
+#include "searchindex.h"
+#include "../utils/tracing.h"
+#include <algorithm>
+
+namespace
+{
+  // Score bands, the position of the match is subtracted within a band
+  constexpr int EXACT_SCORE = 4000;
+  constexpr int PREFIX_SCORE = 3000;
+  constexpr int WORD_SCORE = 2000;
+  constexpr int SUBSTRING_SCORE = 1000;
+  constexpr qsizetype MAX_POSITION_PENALTY = 999;
+
+  struct RankedMatch
+  {
+    EntryId id;
+    int score;
+    const QString *text;
+  };
+
+  int positionPenalty(qsizetype position)
+  {
+    return static_cast<int>(qMin(position, MAX_POSITION_PENALTY));
+  }
+}
+
+void SearchIndex::rebuild(const QList<VaultEntry> &entries)
+{
+  TRACE_SPAN("vault", "SearchIndex::rebuild");
+  clear();
+  m_texts.reserve(entries.size());
+  for (const VaultEntry &entry : entries)
+  {
+    insert(entry.id, entry.username);
+  }
+}
+
+void SearchIndex::insert(EntryId id, const QString &text)
+{
+  remove(id);
+
+  QString folded = fold(text);
+  for (quint64 trigram : trigramsOf(folded))
+  {
+    m_postings[trigram].insert(id);
+  }
+  m_texts.insert(id, folded);
+
+  m_lastQuery.clear();
+  m_lastMatches.clear();
+}
+
+void SearchIndex::remove(EntryId id)
+{
+  auto it = m_texts.find(id);
+  if (it == m_texts.end())
+  {
+    return;
+  }
+
+  for (quint64 trigram : trigramsOf(it.value()))
+  {
+    auto posting = m_postings.find(trigram);
+    if (posting == m_postings.end())
+    {
+      continue;
+    }
+    posting->remove(id);
+    if (posting->isEmpty())
+    {
+      m_postings.erase(posting);
+    }
+  }
+  m_texts.erase(it);
+
+  m_lastQuery.clear();
+  m_lastMatches.clear();
+}
+
+void SearchIndex::clear()
+{
+  m_texts.clear();
+  m_postings.clear();
+  m_lastQuery.clear();
+  m_lastMatches.clear();
+}
+
+QList<EntryId> SearchIndex::search(const QString &query, qsizetype limit) const
+{
+  TRACE_SPAN("vault", "SearchIndex::search");
+  QString folded = fold(query);
+  if (folded.isEmpty())
+  {
+    return QList<EntryId>();
+  }
+
+  const QList<EntryId> pool = candidates(folded);
+  QList<EntryId> matches;
+  QList<RankedMatch> ranked;
+  for (EntryId id : pool)
+  {
+    auto it = m_texts.constFind(id);
+    if (it == m_texts.constEnd())
+    {
+      continue;
+    }
+
+    // Trigrams only preselect, the text has to contain the whole query
+    int matchScore = score(it.value(), folded);
+    if (matchScore >= 0)
+    {
+      matches.append(id);
+      ranked.append({id, matchScore, &it.value()});
+    }
+  }
+
+  m_lastQuery = folded;
+  m_lastMatches = matches;
+
+  // Best score first, then the shorter (tighter) text, then alphabetical. The
+  // id settles equal texts, the candidate pool comes out of a hash in any order
+  auto better = [](const RankedMatch &a, const RankedMatch &b)
+  {
+    if (a.score != b.score)
+    {
+      return a.score > b.score;
+    }
+    if (a.text->size() != b.text->size())
+    {
+      return a.text->size() < b.text->size();
+    }
+    if (*a.text != *b.text)
+    {
+      return *a.text < *b.text;
+    }
+    return a.id < b.id;
+  };
+
+  qsizetype count = limit >= 0 ? qMin(limit, ranked.size()) : ranked.size();
+  std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(), better);
+
+  QList<EntryId> result;
+  result.reserve(count);
+  for (qsizetype i = 0; i < count; ++i)
+  {
+    result.append(ranked[i].id);
+  }
+  return result;
+}
+
+QString SearchIndex::fold(const QString &text)
+{
+  return text.toCaseFolded();
+}
+
+quint64 SearchIndex::trigramAt(const QString &text, qsizetype position)
+{
+  return (quint64(text.at(position).unicode()) << 32) |
+         (quint64(text.at(position + 1).unicode()) << 16) |
+         quint64(text.at(position + 2).unicode());
+}
+
+QList<quint64> SearchIndex::trigramsOf(const QString &text)
+{
+  QList<quint64> trigrams;
+  if (text.size() < TRIGRAM_SIZE)
+  {
+    return trigrams;
+  }
+
+  trigrams.reserve(text.size() - TRIGRAM_SIZE + 1);
+  for (qsizetype i = 0; i + TRIGRAM_SIZE <= text.size(); ++i)
+  {
+    trigrams.append(trigramAt(text, i));
+  }
+
+  // A repeated trigram lists the entry only once
+  std::sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+  return trigrams;
+}
+
+int SearchIndex::score(const QString &text, const QString &query)
+{
+  qsizetype position = text.indexOf(query);
+  if (position < 0)
+  {
+    return -1;
+  }
+  if (position == 0)
+  {
+    return text.size() == query.size() ? EXACT_SCORE : PREFIX_SCORE;
+  }
+
+  // Prefer an occurrence at the start of a word, e.g. "mail" in "user@mail.com"
+  for (qsizetype at = position; at >= 0; at = text.indexOf(query, at + 1))
+  {
+    if (!text.at(at - 1).isLetterOrNumber())
+    {
+      return WORD_SCORE - positionPenalty(at);
+    }
+  }
+  return SUBSTRING_SCORE - positionPenalty(position);
+}
+
+QList<EntryId> SearchIndex::candidates(const QString &query) const
+{
+  // As-you-type: every entry containing the longer query also contained the shorter one
+  if (!m_lastQuery.isEmpty() && query.contains(m_lastQuery))
+  {
+    return m_lastMatches;
+  }
+
+  if (query.size() < TRIGRAM_SIZE)
+  {
+    return m_texts.keys();
+  }
+
+  // Only entries that contain every trigram can match, the rarest one bounds them
+  const QSet<EntryId> *rarest = nullptr;
+  for (quint64 trigram : trigramsOf(query))
+  {
+    auto it = m_postings.constFind(trigram);
+    if (it == m_postings.constEnd())
+    {
+      return QList<EntryId>();
+    }
+    if (!rarest || it->size() < rarest->size())
+    {
+      rarest = &it.value();
+    }
+  }
+  return QList<EntryId>(rarest->cbegin(), rarest->cend());
+}
@@ -0,0 +1,67 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include "vaultentry.h"
+
+/**
+ * @brief In-memory trigram index over the searchable text of the entries
+ *
+ * Every entry contributes its case folded username. Queries of three or more
+ * characters only look at the entries listed under the rarest trigram of the
+ * query, shorter ones scan the folded texts. A query that extends the previous
+ * one (as-you-type) is answered from the previous matches instead.
+ *
+ * Results are ranked by match quality: exact match, prefix, start of a word,
+ * anywhere else, with earlier and tighter matches first.
+ */
+class SearchIndex
+{
+public:
+  /**
+   * @brief Index the given entries, replacing the current contents
+   */
+  void rebuild(const QList<VaultEntry> &entries);
+
+  /**
+   * @brief Add an entry or replace its text
+   */
+  void insert(EntryId id, const QString &text);
+
+  /**
+   * @brief Drop an entry, unknown ids are ignored
+   */
+  void remove(EntryId id);
+
+  void clear();
+  qsizetype size() const { return m_texts.size(); }
+
+  /**
+   * @brief Find the entries whose text contains query, ignoring case
+   * @param query Text to look for, an empty query matches nothing
+   * @param limit Maximum number of results, -1 for all
+   * @return Matching entry ids, best match first
+   */
+  QList<EntryId> search(const QString &query, qsizetype limit = -1) const;
+
+private:
+  static constexpr qsizetype TRIGRAM_SIZE = 3;
+
+  QHash<EntryId, QString> m_texts;             // Case folded text per entry
+  QHash<quint64, QSet<EntryId>> m_postings;    // Trigram -> entries containing it, O(1) removal
+
+  // Matches of the last query, reused while the user keeps typing
+  mutable QString m_lastQuery;
+  mutable QList<EntryId> m_lastMatches;
+
+  static QString fold(const QString &text);
+  static quint64 trigramAt(const QString &text, qsizetype position);
+  static QList<quint64> trigramsOf(const QString &text);
+  static int score(const QString &text, const QString &query);
+  QList<EntryId> candidates(const QString &query) const;
+};
+
+#endif // SEARCHINDEX_H
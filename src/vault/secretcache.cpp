@@ -0,0 +1,79 @@
+#include "secretcache.h"
+
+SecretCache::SecretCache(qsizetype capacity, qint64 ttlMilliseconds)
+    : m_capacity(capacity), m_ttlMilliseconds(ttlMilliseconds)
+{
+  m_slots.reserve(capacity);
+}
+
+QString SecretCache::find(EntryId id)
+{
+  qsizetype index = indexOf(id);
+  if (index < 0)
+  {
+    ++m_stats.misses;
+    return QString();
+  }
+
+  if (m_slots[index].expiry.hasExpired())
+  {
+    // Removing the slot releases the buffer, which wipes it
+    m_slots.removeAt(index);
+    ++m_stats.evictions;
+    ++m_stats.misses;
+    return QString();
+  }
+
+  m_slots.move(index, 0);
+  ++m_stats.hits;
+  return m_slots.first().secret.toString();
+}
+
+void SecretCache::insert(EntryId id, QStringView secret)
+{
+  if (m_capacity <= 0)
+  {
+    return;
+  }
+
+  remove(id);
+  if (m_slots.size() >= m_capacity)
+  {
+    m_slots.removeLast();
+    ++m_stats.evictions;
+  }
+  m_slots.prepend({id, SecureMemory::Buffer::fromString(secret), QDeadlineTimer(m_ttlMilliseconds)});
+}
+
+void SecretCache::remove(EntryId id)
+{
+  qsizetype index = indexOf(id);
+  if (index >= 0)
+  {
+    m_slots.removeAt(index);
+  }
+}
+
+void SecretCache::purgeExpired()
+{
+  qsizetype before = m_slots.size();
+  m_slots.removeIf([](const Slot &slot) { return slot.expiry.hasExpired(); });
+  m_stats.evictions += before - m_slots.size();
+}
+
+void SecretCache::clear()
+{
+  m_slots.clear();
+}
+
+qsizetype SecretCache::indexOf(EntryId id) const
+{
+  for (qsizetype i = 0; i < m_slots.size(); ++i)
+  {
+    if (m_slots[i].id == id)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
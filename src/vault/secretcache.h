@@ -0,0 +1,82 @@
+#ifndef SECRETCACHE_H
+#define SECRETCACHE_H
+
+#include <QString>
+#include <QList>
+#include <QDeadlineTimer>
+#include "vaultentry.h"
+#include "../crypto/securememory.h"
+
+/**
+ * @brief Counters of the decrypted secret cache, for diagnostics and benchmarks
+ */
+struct SecretCacheStats
+{
+  qint64 hits = 0;      // Lookups answered from the cache
+  qint64 misses = 0;    // Lookups that had to decrypt
+  qint64 evictions = 0; // Secrets dropped for capacity or age before they were invalidated
+};
+
+/**
+ * @brief Small LRU cache of recently decrypted passwords
+ *
+ * Secrets are kept as UTF-8 in the locked arena and wiped on eviction. Each
+ * one expires a fixed time after it was decrypted, however often it is hit,
+ * so a revealed password does not linger in memory. The capacity is a few
+ * dozen entries, a recency ordered list beats hashing at that size.
+ */
+class SecretCache
+{
+public:
+  /**
+   * @param capacity Maximum number of cached secrets
+   * @param ttlMilliseconds Lifetime of a secret from the moment it was stored
+   */
+  SecretCache(qsizetype capacity, qint64 ttlMilliseconds);
+
+  /**
+   * @brief Look up the secret of an entry and mark it most recently used
+   * @return The secret, or a null string on a miss or if it expired
+   */
+  QString find(EntryId id);
+
+  /**
+   * @brief Store a freshly decrypted secret, evicting the least recently used one if full
+   */
+  void insert(EntryId id, QStringView secret);
+
+  /**
+   * @brief Wipe the secret of an entry, e.g. because its password changed
+   */
+  void remove(EntryId id);
+
+  /**
+   * @brief Wipe the secrets whose lifetime is over
+   */
+  void purgeExpired();
+
+  /**
+   * @brief Wipe every secret, the counters are kept
+   */
+  void clear();
+
+  qsizetype size() const { return m_slots.size(); }
+  SecretCacheStats stats() const { return m_stats; }
+
+private:
+  struct Slot
+  {
+    EntryId id;
+    SecureMemory::Buffer secret;
+    QDeadlineTimer expiry;
+  };
+
+  qsizetype m_capacity;
+  qint64 m_ttlMilliseconds;
+  QList<Slot> m_slots; // Most recently used first
+  SecretCacheStats m_stats;
+
+  qsizetype indexOf(EntryId id) const;
+};
+
+#endif // SECRETCACHE_H
@@ -0,0 +1,254 @@
+#ifndef VAULTENTRY_H
+#define VAULTENTRY_H
+
+#include <QString>
+#include <QByteArray>
+#include <QtEndian>
+#include <QJsonObject>
+#include <sodium.h>
+#include "../crypto/cryptoutils.h"
+#include "../utils/fileutils.h"
+
+/**
+ * @brief Stable identifier of a vault entry, never 0 for a stored entry
+ */
+using EntryId = quint64;
+
+struct VaultEntry
+{
+  /**
+   * @brief Per-entry encryption formats
+   * V1: individual_salt + nonce + ciphertext, key = Argon2(masterKey, individual_salt)
+   * V2: subkey_id + nonce + ciphertext, key = KDF(masterKey, subkey_id)
+   * V3: same layout as V2, the entry id and format version are associated data,
+   *     so a blob copied onto another entry no longer decrypts
+   */
+  enum FormatVersion
+  {
+    FormatV1 = 1,
+    FormatV2 = 2,
+    FormatV3 = 3,
+    CurrentFormatVersion = FormatV3
+  };
+
+  // Context string for crypto_kdf_derive_from_key (exactly crypto_kdf_CONTEXTBYTES long)
+  static constexpr const char *SubkeyContext = "pmentry_";
+
+  QString username;
+  QString password;             // Temporary plaintext storage - will be cleared after encryption
+  QByteArray encryptedPassword; // Binary encrypted storage, layout depends on formatVersion
+  int formatVersion = CurrentFormatVersion;
+  EntryId id = 0; // Assigned by VaultManager when the entry is stored
+  FileUtils::BlockLocation block; // Record block holding encryptedPassword in a segmented vault
+
+  /**
+   * @brief Generate a random, non-zero entry id
+   */
+  static EntryId generateId()
+  {
+    EntryId newId = 0;
+    while (newId == 0)
+    {
+      randombytes_buf(&newId, sizeof(newId));
+    }
+    return newId;
+  }
+
+  /**
+   * @brief Read an entry from a legacy JSON vault payload
+   * @param obj The serialized entry
+   * @param outEntry The parsed entry
+   * @return false if the object does not hold an encrypted entry
+   */
+  static bool fromJson(const QJsonObject &obj, VaultEntry &outEntry)
+  {
+    // Check for new format (encrypted password)
+    if (!obj.contains("encryptedPassword"))
+    {
+      return false;
+    }
+
+    outEntry.username = obj.value("username").toString();
+    outEntry.encryptedPassword = QByteArray::fromBase64(obj.value("encryptedPassword").toString().toUtf8());
+    // Entries written before the version field existed use the V1 format
+    outEntry.formatVersion = obj.value("version").toInt(FormatV1);
+    outEntry.id = obj.value("id").toString().toULongLong();
+    return true;
+  }
+
+  /**
+   * @brief Encrypts the plaintext password with a per-entry subkey
+   * The subkey is derived from the master key with a random subkey id, so no
+   * password hashing is needed per entry. The ciphertext is bound to the entry id,
+   * which therefore has to be assigned first
+   * @param masterKey The derived master key for encryption
+   */
+  void encryptPassword(QByteArrayView masterKey)
+  {
+    if (password.isEmpty())
+    {
+      throw CryptoUtils::CryptoOperationError("Cannot encrypt empty password");
+    }
+    if (id == 0)
+    {
+      throw CryptoUtils::CryptoOperationError("Cannot encrypt an entry without id");
+    }
+
+    // Pick a random subkey id for this specific password entry
+    quint64 subkeyId = 0;
+    randombytes_buf(&subkeyId, sizeof(subkeyId));
+
+    // Key and UTF-8 plaintext stay in locked memory and are wiped on scope exit
+    SecureMemory::Buffer derivedKey = CryptoUtils::deriveSubkey(masterKey, subkeyId, SubkeyContext);
+    SecureMemory::Buffer plain = SecureMemory::Buffer::fromString(password);
+
+    QByteArray nonce, ciphertext;
+    CryptoUtils::encrypt(plain, derivedKey, ciphertext, nonce, associatedData(FormatV3));
+
+    // Store format: subkey_id (8 bytes, little endian) + nonce (24 bytes) + ciphertext
+    QByteArray idBytes(sizeof(subkeyId), 0);
+    qToLittleEndian(subkeyId, idBytes.data());
+    encryptedPassword = idBytes + nonce + ciphertext;
+    formatVersion = FormatV3;
+
+    // Securely clear sensitive data from memory
+    clearSensitiveData();
+  }
+
+  /**
+   * @brief Decrypts the password on-demand
+   * @param masterKey The derived master key for decryption
+   * @return Decrypted password as QString
+   */
+  QString decryptPassword(QByteArrayView masterKey) const
+  {
+    if (encryptedPassword.isEmpty())
+    {
+      throw CryptoUtils::CryptoOperationError("No encrypted password data");
+    }
+
+    if (formatVersion == FormatV1)
+    {
+      return decryptPasswordV1(masterKey);
+    }
+
+    if (formatVersion != FormatV2 && formatVersion != FormatV3)
+    {
+      throw CryptoUtils::CryptoOperationError("Unsupported entry format version");
+    }
+
+    // Parse encrypted data format: subkey_id + nonce + ciphertext
+    const int ID_SIZE = sizeof(quint64);
+    const int NONCE_SIZE = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+
+    if (encryptedPassword.size() < ID_SIZE + NONCE_SIZE)
+    {
+      throw CryptoUtils::CryptoOperationError("Invalid encrypted password format");
+    }
+
+    QByteArrayView blob(encryptedPassword);
+    quint64 subkeyId = qFromLittleEndian<quint64>(blob.data());
+    SecureMemory::Buffer derivedKey = CryptoUtils::deriveSubkey(masterKey, subkeyId, SubkeyContext);
+
+    // V2 blobs predate the associated data and are re-encrypted by migrate
+    QByteArray ad = formatVersion == FormatV3 ? associatedData(FormatV3) : QByteArray();
+    return decryptWithKey(blob.sliced(ID_SIZE + NONCE_SIZE), derivedKey, blob.sliced(ID_SIZE, NONCE_SIZE), ad);
+  }
+
+  /**
+   * @brief Decrypts a legacy (V1) password blob
+   * Every call runs a full Argon2 derivation, only used to read and migrate old vaults
+   * @param masterKey The derived master key for decryption
+   * @return Decrypted password as QString
+   */
+  QString decryptPasswordV1(QByteArrayView masterKey) const
+  {
+    // Parse encrypted data format: individual_salt + nonce + ciphertext
+    const int SALT_SIZE = crypto_pwhash_SALTBYTES;
+    const int NONCE_SIZE = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+
+    if (encryptedPassword.size() < SALT_SIZE + NONCE_SIZE)
+    {
+      throw CryptoUtils::CryptoOperationError("Invalid encrypted password format");
+    }
+
+    QByteArrayView blob(encryptedPassword);
+    QByteArray individualSalt = blob.first(SALT_SIZE).toByteArray();
+
+    // Use the same key derivation as during encryption
+    SecureMemory::Buffer derivedKey = CryptoUtils::deriveKeyFromPassword(QString::fromUtf8(masterKey), individualSalt);
+
+    return decryptWithKey(blob.sliced(SALT_SIZE + NONCE_SIZE), derivedKey, blob.sliced(SALT_SIZE, NONCE_SIZE));
+  }
+
+  /**
+   * @brief Re-encrypt a legacy entry in the current format
+   * @param masterKey The derived master key
+   * @return true if the entry was migrated, false if it already used the current format
+   */
+  bool migrate(QByteArrayView masterKey)
+  {
+    if (formatVersion == CurrentFormatVersion)
+    {
+      return false;
+    }
+
+    rekey(masterKey, masterKey);
+    return true;
+  }
+
+  /**
+   * @brief Decrypt the password with one master key and re-encrypt it with another
+   * The result always uses the current format
+   * @param oldMasterKey The master key the entry is currently encrypted with
+   * @param newMasterKey The master key to encrypt the entry with
+   */
+  void rekey(QByteArrayView oldMasterKey, QByteArrayView newMasterKey)
+  {
+    password = decryptPassword(oldMasterKey);
+    encryptPassword(newMasterKey);
+  }
+
+  /**
+   * @brief Check if this entry contains encrypted password data
+   * @return true if password is encrypted, false otherwise
+   */
+  bool isEncrypted() const { return !encryptedPassword.isEmpty(); }
+
+  /**
+   * @brief Check if the encrypted password still has to be read from its record block
+   */
+  bool isPayloadPending() const { return encryptedPassword.isEmpty() && block.offset >= 0; }
+
+  /**
+   * @brief Securely clear all sensitive data from memory
+   * Call this when the entry is no longer needed
+   */
+  void clearSensitiveData()
+  {
+    password.fill(QChar(0));
+    password.clear();
+    // Note: We don't clear encryptedPassword as it's needed for storage
+  }
+
+private:
+  // Associated data of the password ciphertext: entry id (8, little endian) | format version (1)
+  QByteArray associatedData(int version) const
+  {
+    QByteArray ad(sizeof(quint64) + sizeof(quint8), 0);
+    qToLittleEndian(id, ad.data());
+    ad[sizeof(quint64)] = static_cast<char>(version);
+    return ad;
+  }
+
+  static QString decryptWithKey(QByteArrayView ciphertext, QByteArrayView derivedKey, QByteArrayView nonce,
+                                QByteArrayView associatedData = QByteArrayView())
+  {
+    // The UTF-8 plaintext never leaves locked memory, only the returned QString does
+    SecureMemory::Buffer decrypted;
+    CryptoUtils::decrypt(ciphertext, derivedKey, nonce, decrypted, associatedData);
+    return decrypted.toString();
+  }
+};
+
+#endif // VAULTENTRY_H
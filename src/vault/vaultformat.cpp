@@ -0,0 +1,270 @@
+#include "vaultformat.h"
+#include "../utils/fileutils.h"
+#include <QtEndian>
+
+namespace
+{
+  constexpr char PAYLOAD_MAGIC[] = "PMVB";
+  constexpr char INDEX_MAGIC[] = "PMVI";
+  constexpr qsizetype MAGIC_SIZE = 4;
+  constexpr qsizetype HEADER_SIZE = MAGIC_SIZE + sizeof(quint16) + sizeof(quint64) + sizeof(quint32);
+  constexpr qsizetype LENGTH_SIZE = sizeof(quint32);
+
+  // Fixed parts of the entry records after the record length
+  constexpr qsizetype ENTRY_PREFIX_SIZE = sizeof(quint64) + sizeof(quint8) + sizeof(quint16);
+  constexpr qsizetype ENTRY_FIXED_SIZE = ENTRY_PREFIX_SIZE + sizeof(quint32);
+  constexpr qsizetype INDEX_ENTRY_FIXED_SIZE = ENTRY_PREFIX_SIZE + sizeof(quint64) + sizeof(quint32);
+
+  template <typename T>
+  void appendInt(QByteArray &out, T value)
+  {
+    char buffer[sizeof(T)];
+    qToLittleEndian(value, buffer);
+    out.append(buffer, sizeof(T));
+  }
+
+  template <typename T>
+  T readInt(const char *data)
+  {
+    return qFromLittleEndian<T>(data);
+  }
+
+  void appendHeader(QByteArray &out, const char *magic, quint64 journalGeneration, qsizetype count)
+  {
+    out.append(magic, MAGIC_SIZE);
+    appendInt<quint16>(out, VaultFormat::CurrentVersion);
+    appendInt<quint64>(out, journalGeneration);
+    appendInt<quint32>(out, static_cast<quint32>(count));
+  }
+
+  quint32 readHeader(const QByteArray &payload, const char *magic, qsizetype minEntrySize,
+                     quint64 &outJournalGeneration)
+  {
+    if (payload.size() < HEADER_SIZE || !payload.startsWith(magic))
+    {
+      throw FileUtils::FileOperationError("Malformed vault payload header");
+    }
+
+    const char *data = payload.constData();
+    quint16 version = readInt<quint16>(data + MAGIC_SIZE);
+    if (version > VaultFormat::CurrentVersion)
+    {
+      throw FileUtils::FileOperationError("Vault payload was written by a newer version");
+    }
+
+    outJournalGeneration = readInt<quint64>(data + MAGIC_SIZE + sizeof(quint16));
+    quint32 count = readInt<quint32>(data + MAGIC_SIZE + sizeof(quint16) + sizeof(quint64));
+
+    // Every entry takes at least its fixed part, a bogus count must not force a huge reservation
+    if (count > (payload.size() - HEADER_SIZE) / (LENGTH_SIZE + minEntrySize))
+    {
+      throw FileUtils::FileOperationError("Malformed vault payload entry count");
+    }
+    return count;
+  }
+
+  // Reads the fields shared by payload and index records, returns the offset of the
+  // first type specific field relative to the record body, or -1 if malformed
+  qsizetype readEntryPrefix(const char *record, qsizetype recordLength, VaultEntry &outEntry)
+  {
+    qsizetype usernameLength = readInt<quint16>(record + sizeof(quint64) + sizeof(quint8));
+    if (ENTRY_PREFIX_SIZE + usernameLength > recordLength)
+    {
+      return -1;
+    }
+
+    outEntry.id = readInt<quint64>(record);
+    outEntry.formatVersion = readInt<quint8>(record + sizeof(quint64));
+    outEntry.username = QString::fromUtf8(record + ENTRY_PREFIX_SIZE, usernameLength);
+    return ENTRY_PREFIX_SIZE + usernameLength;
+  }
+
+  void appendEntryPrefix(QByteArray &out, const VaultEntry &entry, const QByteArray &username, quint32 recordLength)
+  {
+    appendInt<quint32>(out, recordLength);
+    appendInt<quint64>(out, entry.id);
+    appendInt<quint8>(out, static_cast<quint8>(entry.formatVersion));
+    appendInt<quint16>(out, static_cast<quint16>(username.size()));
+    out.append(username);
+  }
+
+  QByteArray encodeUsername(const QString &username)
+  {
+    // VaultManager rejects longer names, this only guards entries from legacy JSON
+    // vaults. Cut before a continuation byte so no UTF-8 sequence is split
+    QByteArray utf8 = username.toUtf8();
+    if (utf8.size() > VaultFormat::MaxUsernameSize)
+    {
+      qsizetype size = VaultFormat::MaxUsernameSize;
+      while (size > 0 && (static_cast<quint8>(utf8[size]) & 0xC0) == 0x80)
+      {
+        --size;
+      }
+      utf8.truncate(size);
+    }
+    return utf8;
+  }
+}
+
+namespace VaultFormat
+{
+  bool isUsernameStorable(const QString &username)
+  {
+    // Every UTF-16 unit takes at most 3 UTF-8 bytes, skip the conversion for short names
+    return username.size() * 3 <= MaxUsernameSize || username.toUtf8().size() <= MaxUsernameSize;
+  }
+
+  bool isBinaryPayload(const QByteArray &payload)
+  {
+    return payload.startsWith(PAYLOAD_MAGIC);
+  }
+
+  bool isIndexPayload(const QByteArray &payload)
+  {
+    return payload.startsWith(INDEX_MAGIC);
+  }
+
+  QByteArray emptyPayload()
+  {
+    return encodePayload({}, 0);
+  }
+
+  QByteArray encodePayload(const QList<VaultEntry> &entries, quint64 journalGeneration)
+  {
+    // Size the buffer once instead of growing it per entry
+    qsizetype size = HEADER_SIZE;
+    for (const VaultEntry &entry : entries)
+    {
+      size += LENGTH_SIZE + ENTRY_FIXED_SIZE + entry.username.size() * 3 + entry.encryptedPassword.size();
+    }
+
+    QByteArray out;
+    out.reserve(size);
+    appendHeader(out, PAYLOAD_MAGIC, journalGeneration, entries.size());
+    for (const VaultEntry &entry : entries)
+    {
+      appendEntry(out, entry);
+    }
+    return out;
+  }
+
+  void decodePayload(const QByteArray &payload, QList<VaultEntry> &outEntries, quint64 &outJournalGeneration)
+  {
+    quint32 count = readHeader(payload, PAYLOAD_MAGIC, ENTRY_FIXED_SIZE, outJournalGeneration);
+
+    outEntries.clear();
+    outEntries.reserve(count);
+
+    qsizetype offset = HEADER_SIZE;
+    for (quint32 i = 0; i < count; ++i)
+    {
+      VaultEntry entry;
+      if (!readEntry(payload, offset, entry))
+      {
+        throw FileUtils::FileOperationError("Malformed vault payload entry");
+      }
+      outEntries.append(entry);
+    }
+  }
+
+  QByteArray encodeIndex(const QList<VaultEntry> &entries, const QList<FileUtils::BlockLocation> &locations,
+                         quint64 journalGeneration)
+  {
+    Q_ASSERT(entries.size() == locations.size());
+
+    qsizetype size = HEADER_SIZE;
+    for (const VaultEntry &entry : entries)
+    {
+      size += LENGTH_SIZE + INDEX_ENTRY_FIXED_SIZE + entry.username.size() * 3;
+    }
+
+    QByteArray out;
+    out.reserve(size);
+    appendHeader(out, INDEX_MAGIC, journalGeneration, entries.size());
+    for (qsizetype i = 0; i < entries.size(); ++i)
+    {
+      QByteArray username = encodeUsername(entries[i].username);
+      appendEntryPrefix(out, entries[i], username, INDEX_ENTRY_FIXED_SIZE + username.size());
+      appendInt<quint64>(out, static_cast<quint64>(locations[i].offset));
+      appendInt<quint32>(out, locations[i].length);
+    }
+    return out;
+  }
+
+  void decodeIndex(const QByteArray &payload, QList<VaultEntry> &outEntries, quint64 &outJournalGeneration)
+  {
+    quint32 count = readHeader(payload, INDEX_MAGIC, INDEX_ENTRY_FIXED_SIZE, outJournalGeneration);
+
+    outEntries.clear();
+    outEntries.reserve(count);
+
+    const char *data = payload.constData();
+    qsizetype offset = HEADER_SIZE;
+    for (quint32 i = 0; i < count; ++i)
+    {
+      qsizetype recordLength = payload.size() - offset >= LENGTH_SIZE ? readInt<quint32>(data + offset) : -1;
+      if (recordLength < INDEX_ENTRY_FIXED_SIZE || recordLength > payload.size() - offset - LENGTH_SIZE)
+      {
+        throw FileUtils::FileOperationError("Malformed vault index entry");
+      }
+
+      const char *record = data + offset + LENGTH_SIZE;
+      VaultEntry entry;
+      qsizetype fieldOffset = readEntryPrefix(record, recordLength, entry);
+      if (fieldOffset < 0 || fieldOffset + static_cast<qsizetype>(sizeof(quint64) + sizeof(quint32)) > recordLength)
+      {
+        throw FileUtils::FileOperationError("Malformed vault index entry");
+      }
+
+      entry.block.offset = static_cast<qint64>(readInt<quint64>(record + fieldOffset));
+      entry.block.length = readInt<quint32>(record + fieldOffset + sizeof(quint64));
+      outEntries.append(entry);
+
+      // Skip fields added by newer versions
+      offset += LENGTH_SIZE + recordLength;
+    }
+  }
+
+  void appendEntry(QByteArray &out, const VaultEntry &entry)
+  {
+    QByteArray username = encodeUsername(entry.username);
+    appendEntryPrefix(out, entry, username, ENTRY_FIXED_SIZE + username.size() + entry.encryptedPassword.size());
+    appendInt<quint32>(out, static_cast<quint32>(entry.encryptedPassword.size()));
+    out.append(entry.encryptedPassword);
+  }
+
+  bool readEntry(const QByteArray &data, qsizetype &offset, VaultEntry &outEntry)
+  {
+    if (data.size() - offset < LENGTH_SIZE)
+    {
+      return false;
+    }
+
+    const char *base = data.constData() + offset;
+    qsizetype recordLength = readInt<quint32>(base);
+    if (recordLength < ENTRY_FIXED_SIZE || recordLength > data.size() - offset - LENGTH_SIZE)
+    {
+      return false;
+    }
+
+    const char *record = base + LENGTH_SIZE;
+    qsizetype blobLengthOffset = readEntryPrefix(record, recordLength, outEntry);
+    if (blobLengthOffset < 0 || blobLengthOffset + LENGTH_SIZE > recordLength)
+    {
+      return false;
+    }
+
+    qsizetype blobOffset = blobLengthOffset + LENGTH_SIZE;
+    qsizetype blobLength = readInt<quint32>(record + blobLengthOffset);
+    if (blobLength > recordLength - blobOffset)
+    {
+      return false;
+    }
+
+    outEntry.encryptedPassword = QByteArray(record + blobOffset, blobLength);
+
+    // Skip fields added by newer versions
+    offset += LENGTH_SIZE + recordLength;
+    return true;
+  }
+}
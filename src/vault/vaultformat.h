@@ -0,0 +1,97 @@
+#ifndef VAULTFORMAT_H
+#define VAULTFORMAT_H
+
+#include <QByteArray>
+#include <QList>
+#include "vaultentry.h"
+
+/**
+ * @brief Binary encoding of the decrypted vault payload
+ *
+ * Payload layout (all integers little endian):
+ *   magic "PMVB" (4) | format version (2) | journal generation (8) | entry count (4) | entries...
+ *
+ * Entry layout:
+ *   record length (4) | id (8) | entry format version (1) |
+ *   username length (2) | username (UTF-8) | encrypted password length (4) | encrypted password
+ *
+ * The record length covers everything after itself, so readers skip fields
+ * appended by newer versions. Decoding walks the buffer in place, without a
+ * document tree or base64 step.
+ */
+namespace VaultFormat
+{
+  constexpr quint16 CurrentVersion = 1;
+
+  /**
+   * @brief Longest username the record layout can hold, in UTF-8 bytes
+   */
+  constexpr qsizetype MaxUsernameSize = 0xFFFF;
+
+  /**
+   * @brief Check whether a username fits the record layout without being cut
+   */
+  bool isUsernameStorable(const QString &username);
+
+  /**
+   * @brief Check whether a decrypted payload uses the binary format
+   * Payloads without the magic are legacy JSON documents
+   */
+  bool isBinaryPayload(const QByteArray &payload);
+
+  /**
+   * @brief Payload of a vault without entries
+   */
+  QByteArray emptyPayload();
+
+  /**
+   * @brief Encode a snapshot of the vault entries
+   * @param entries Entries to store (encrypted fields only)
+   * @param journalGeneration Generation of the journal that continues this snapshot
+   */
+  QByteArray encodePayload(const QList<VaultEntry> &entries, quint64 journalGeneration);
+
+  /**
+   * @brief Decode a payload written by encodePayload
+   * @throws FileUtils::FileOperationError if the payload is malformed or too new
+   */
+  void decodePayload(const QByteArray &payload, QList<VaultEntry> &outEntries, quint64 &outJournalGeneration);
+
+  /**
+   * @brief Check whether a decrypted payload is the index of a segmented vault
+   */
+  bool isIndexPayload(const QByteArray &payload);
+
+  /**
+   * @brief Encode the index of a segmented vault
+   * Same layout as the payload (magic "PMVI"), but every entry stores the
+   * location of its record block instead of the encrypted password:
+   *   record length (4) | id (8) | entry format version (1) |
+   *   username length (2) | username (UTF-8) | block offset (8) | block length (4)
+   * @param entries Entries in the order their blocks were written
+   * @param locations Block location of every entry
+   * @param journalGeneration Generation of the journal that continues this snapshot
+   */
+  QByteArray encodeIndex(const QList<VaultEntry> &entries, const QList<FileUtils::BlockLocation> &locations,
+                         quint64 journalGeneration);
+
+  /**
+   * @brief Decode an index written by encodeIndex
+   * The entries have no encrypted password yet, only the location of their block
+   * @throws FileUtils::FileOperationError if the index is malformed or too new
+   */
+  void decodeIndex(const QByteArray &payload, QList<VaultEntry> &outEntries, quint64 &outJournalGeneration);
+
+  /**
+   * @brief Append the encoding of a single entry (used by snapshots and journal records)
+   */
+  void appendEntry(QByteArray &out, const VaultEntry &entry);
+
+  /**
+   * @brief Decode a single entry starting at offset and advance offset past it
+   * @return false if the data at offset is not a complete entry
+   */
+  bool readEntry(const QByteArray &data, qsizetype &offset, VaultEntry &outEntry);
+}
+
+#endif // VAULTFORMAT_H
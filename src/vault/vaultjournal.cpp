@@ -0,0 +1,449 @@
+#include "vaultjournal.h"
+#include "../crypto/cryptoutils.h"
+#include "../utils/fileutils.h"
+#include "../utils/metrics.h"
+#include "../utils/tracing.h"
+#include "vaultformat.h"
+#include <QFile>
+#include <QHash>
+#include <QDebug>
+#include <QtEndian>
+#include <sodium.h>
+
+namespace
+{
+  constexpr char JOURNAL_MAGIC[] = "PMJ1";
+  constexpr qint64 MAGIC_SIZE = 4;
+  constexpr qint64 HEADER_SIZE = MAGIC_SIZE + sizeof(quint64);
+  constexpr qint64 LENGTH_SIZE = sizeof(quint32);
+  constexpr quint32 MAX_RECORD_SIZE = 16 * 1024 * 1024;
+}
+
+QString VaultJournal::pathFor(const QString &vaultPath)
+{
+  return vaultPath + ".journal";
+}
+
+QString VaultJournal::nextPathFor(const QString &vaultPath)
+{
+  return vaultPath + ".journal.next";
+}
+
+VaultJournal::ReplayResult VaultJournal::read(const QString &vaultPath, quint64 generation, QByteArrayView rootKey)
+{
+  TRACE_SPAN("vault", "VaultJournal::read");
+  ReplayResult result;
+  SecureMemory::Buffer key = CryptoUtils::expandRootKey(rootKey, CryptoUtils::RootSubkey::Journal);
+
+  const int NONCE_SIZE = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+  const int TAG_SIZE = crypto_aead_xchacha20poly1305_ietf_ABYTES;
+
+  for (const QString &path : {pathFor(vaultPath), nextPathFor(vaultPath)})
+  {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+      continue;
+    }
+
+    QByteArray header = file.read(HEADER_SIZE);
+    if (header.size() != HEADER_SIZE || !header.startsWith(JOURNAL_MAGIC) ||
+        qFromLittleEndian<quint64>(header.constData() + MAGIC_SIZE) != generation)
+    {
+      // Stale journal from an older snapshot
+      continue;
+    }
+
+    result.found = true;
+    result.path = path;
+    result.validSize = HEADER_SIZE;
+
+    while (!file.atEnd())
+    {
+      QByteArray lengthBytes = file.read(LENGTH_SIZE);
+      if (lengthBytes.size() != LENGTH_SIZE)
+      {
+        break;
+      }
+
+      quint32 length = qFromLittleEndian<quint32>(lengthBytes.constData());
+      if (length < static_cast<quint32>(NONCE_SIZE + TAG_SIZE) || length > MAX_RECORD_SIZE)
+      {
+        break;
+      }
+
+      QByteArray body = file.read(length);
+      if (body.size() != static_cast<qsizetype>(length))
+      {
+        break;
+      }
+
+      QByteArray plain;
+      try
+      {
+        CryptoUtils::decrypt(body.mid(NONCE_SIZE), key, body.left(NONCE_SIZE), plain,
+                             recordAssociatedData(generation, result.recordCount));
+      }
+      catch (const CryptoUtils::CryptoOperationError &)
+      {
+        break;
+      }
+
+      Record record;
+      bool decoded = decodeRecord(plain, record);
+      plain.fill(0);
+      if (!decoded)
+      {
+        break;
+      }
+
+      result.records.append(record);
+      ++result.recordCount;
+      result.validSize = file.pos();
+    }
+
+    if (result.validSize < file.size())
+    {
+      qWarning() << "Discarding torn journal tail of" << (file.size() - result.validSize) << "bytes in" << path;
+    }
+    break;
+  }
+
+  return result;
+}
+
+void VaultJournal::apply(QList<VaultEntry> &entries, const QList<Record> &records)
+{
+  TRACE_SPAN("vault", "VaultJournal::apply");
+  if (records.isEmpty())
+  {
+    return;
+  }
+
+  QHash<EntryId, qsizetype> index;
+  index.reserve(entries.size());
+  for (qsizetype i = 0; i < entries.size(); ++i)
+  {
+    index.insert(entries[i].id, i);
+  }
+
+  // Puts and removes are idempotent, replaying a record twice is harmless
+  for (const Record &record : records)
+  {
+    auto it = index.constFind(record.id);
+    if (record.operation == Operation::Put)
+    {
+      if (it != index.constEnd())
+      {
+        entries[it.value()] = record.entry;
+      }
+      else
+      {
+        index.insert(record.id, entries.size());
+        entries.append(record.entry);
+      }
+    }
+    else if (it != index.constEnd())
+    {
+      qsizetype row = it.value();
+      qsizetype lastRow = entries.size() - 1;
+      if (row != lastRow)
+      {
+        entries.swapItemsAt(row, lastRow);
+        index[entries[row].id] = row;
+      }
+      entries.removeLast();
+      index.remove(record.id);
+    }
+  }
+}
+
+void VaultJournal::attach(const QString &vaultPath, QByteArrayView rootKey, quint64 generation,
+                          const ReplayResult &replay)
+{
+  m_path = pathFor(vaultPath);
+  m_nextPath = nextPathFor(vaultPath);
+  m_key = CryptoUtils::expandRootKey(rootKey, CryptoUtils::RootSubkey::Journal);
+  m_generation = generation;
+  m_rollingOver = false;
+
+  if (!replay.found)
+  {
+    QFile::remove(m_nextPath);
+    reset(generation);
+    return;
+  }
+
+  // A compaction finished writing its snapshot but not the rename
+  if (replay.path != m_path)
+  {
+    QFile::remove(m_path);
+    if (!QFile::rename(replay.path, m_path))
+    {
+      throw FileUtils::FileOperationError("Cannot promote next journal: " + replay.path.toStdString());
+    }
+    if (m_syncWrites)
+    {
+      FileUtils::syncDirectory(m_path);
+    }
+  }
+  else
+  {
+    QFile::remove(m_nextPath);
+  }
+
+  // Cut off a torn tail so new records follow the last intact one
+  QFile file(m_path);
+  if (file.size() > replay.validSize && !file.resize(replay.validSize))
+  {
+    throw FileUtils::FileOperationError("Cannot truncate journal: " + m_path.toStdString());
+  }
+
+  m_sequence = replay.recordCount;
+  m_size = replay.validSize;
+}
+
+void VaultJournal::detach()
+{
+  m_key.clear();
+  m_path.clear();
+  m_nextPath.clear();
+  m_generation = 0;
+  m_sequence = 0;
+  m_size = 0;
+  m_rollingOver = false;
+  m_nextBacklog.clear();
+}
+
+void VaultJournal::append(const Record &record)
+{
+  append(QList<Record>{record});
+}
+
+void VaultJournal::append(const QList<Record> &records)
+{
+  TRACE_SPAN("vault", "VaultJournal::append");
+  if (records.isEmpty())
+  {
+    return;
+  }
+
+  // Encrypt the whole batch first, so it reaches each file in one write
+  QByteArray current;
+  QByteArray next;
+  for (qsizetype i = 0; i < records.size(); ++i)
+  {
+    QByteArray plain = encodeRecord(records[i]);
+    try
+    {
+      current += encryptRecord(m_generation, m_sequence + i, plain);
+      if (m_rollingOver)
+      {
+        next += encryptRecord(m_nextGeneration, m_nextSequence + i, plain);
+      }
+    }
+    catch (...)
+    {
+      plain.fill(0);
+      throw;
+    }
+    plain.fill(0);
+  }
+
+  // Up to here a failure leaves the journal as it was, a retry rewrites the batch from m_size
+  m_size += appendToFile(m_path, m_size, current, m_syncWrites);
+  m_sequence += records.size();
+
+  if (m_rollingOver)
+  {
+    // The batch is committed, the next journal must not make the caller write it again
+    m_nextBacklog += next;
+    m_nextSequence += records.size();
+    try
+    {
+      catchUpRollover();
+    }
+    catch (const std::exception &e)
+    {
+      qWarning() << "Next journal fell behind, retrying with the next write:" << e.what();
+    }
+  }
+}
+
+void VaultJournal::catchUpRollover()
+{
+  if (!m_rollingOver || m_nextBacklog.isEmpty())
+  {
+    return;
+  }
+
+  m_nextSize += appendToFile(m_nextPath, m_nextSize, m_nextBacklog, m_syncWrites);
+  m_nextBacklog.clear();
+}
+
+void VaultJournal::reset(quint64 generation)
+{
+  if (m_rollingOver)
+  {
+    abortRollover();
+  }
+
+  m_size = writeHeader(m_path, generation, m_syncWrites);
+  m_generation = generation;
+  m_sequence = 0;
+}
+
+void VaultJournal::beginRollover(quint64 nextGeneration)
+{
+  m_nextSize = writeHeader(m_nextPath, nextGeneration, m_syncWrites);
+  m_nextGeneration = nextGeneration;
+  m_nextSequence = 0;
+  m_nextBacklog.clear();
+  m_rollingOver = true;
+}
+
+void VaultJournal::commitRollover()
+{
+  if (!m_rollingOver)
+  {
+    return;
+  }
+  Q_ASSERT(m_nextBacklog.isEmpty());
+
+  // The new snapshot is on disk, so the current journal is stale. Until the
+  // rename lands, unlock finds the next journal by its generation
+  QFile::remove(m_path);
+  if (!QFile::rename(m_nextPath, m_path))
+  {
+    throw FileUtils::FileOperationError("Cannot promote next journal: " + m_nextPath.toStdString());
+  }
+  if (m_syncWrites)
+  {
+    FileUtils::syncDirectory(m_path);
+  }
+
+  m_generation = m_nextGeneration;
+  m_sequence = m_nextSequence;
+  m_size = m_nextSize;
+  m_rollingOver = false;
+}
+
+void VaultJournal::abortRollover()
+{
+  QFile::remove(m_nextPath);
+  m_nextBacklog.clear();
+  m_rollingOver = false;
+}
+
+QByteArray VaultJournal::encodeRecord(const Record &record)
+{
+  // operation (1) | id (8) | entry encoded as in the snapshot (Put only)
+  QByteArray plain(sizeof(quint8) + sizeof(quint64), 0);
+  plain[0] = static_cast<char>(record.operation);
+  qToLittleEndian(record.id, plain.data() + sizeof(quint8));
+  if (record.operation == Operation::Put)
+  {
+    VaultFormat::appendEntry(plain, record.entry);
+  }
+  return plain;
+}
+
+bool VaultJournal::decodeRecord(const QByteArray &plain, Record &outRecord)
+{
+  const qsizetype HEADER = sizeof(quint8) + sizeof(quint64);
+  if (plain.size() < HEADER)
+  {
+    return false;
+  }
+
+  outRecord.operation = static_cast<Operation>(plain[0]);
+  outRecord.id = qFromLittleEndian<quint64>(plain.constData() + sizeof(quint8));
+  if (outRecord.id == 0)
+  {
+    return false;
+  }
+
+  switch (outRecord.operation)
+  {
+  case Operation::Put:
+  {
+    qsizetype offset = HEADER;
+    return VaultFormat::readEntry(plain, offset, outRecord.entry) && outRecord.entry.id == outRecord.id;
+  }
+  case Operation::Remove:
+    return true;
+  }
+  return false;
+}
+
+QByteArray VaultJournal::recordAssociatedData(quint64 generation, quint64 sequence)
+{
+  QByteArray ad(2 * sizeof(quint64), 0);
+  qToLittleEndian(generation, ad.data());
+  qToLittleEndian(sequence, ad.data() + sizeof(quint64));
+  return ad;
+}
+
+qint64 VaultJournal::writeHeader(const QString &path, quint64 generation, bool sync)
+{
+  QByteArray header(JOURNAL_MAGIC, MAGIC_SIZE);
+  header.resize(HEADER_SIZE);
+  qToLittleEndian(generation, header.data() + MAGIC_SIZE);
+
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(header) != header.size())
+  {
+    throw FileUtils::FileOperationError("Cannot write journal header: " + path.toStdString());
+  }
+  if (sync)
+  {
+    // A fresh journal file needs its directory entry on disk as well
+    FileUtils::syncFile(file);
+    FileUtils::syncDirectory(path);
+  }
+  Metrics::increment(Metrics::Counter::BytesWritten, header.size());
+  return header.size();
+}
+
+QByteArray VaultJournal::encryptRecord(quint64 generation, quint64 sequence, const QByteArray &plain) const
+{
+  QByteArray nonce, ciphertext;
+  CryptoUtils::encrypt(plain, m_key, ciphertext, nonce, recordAssociatedData(generation, sequence));
+
+  QByteArray record(LENGTH_SIZE, 0);
+  qToLittleEndian(static_cast<quint32>(nonce.size() + ciphertext.size()), record.data());
+  record += nonce;
+  record += ciphertext;
+  return record;
+}
+
+qint64 VaultJournal::appendToFile(const QString &path, qint64 size, const QByteArray &data, bool sync)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+  {
+    throw FileUtils::FileOperationError("Cannot open journal: " + path.toStdString());
+  }
+
+  // A failed append may have left a partial or unsynced batch behind. Records after
+  // it would never be replayed, since reading stops at the first broken record
+  if (file.size() < size)
+  {
+    throw FileUtils::FileOperationError("Journal is shorter than its records: " + path.toStdString());
+  }
+  if (file.size() > size && !file.resize(size))
+  {
+    throw FileUtils::FileOperationError("Cannot truncate journal: " + path.toStdString());
+  }
+
+  if (file.write(data) != data.size())
+  {
+    throw FileUtils::FileOperationError("Cannot append journal record: " + path.toStdString());
+  }
+  if (sync)
+  {
+    FileUtils::syncFile(file);
+  }
+  Metrics::increment(Metrics::Counter::BytesWritten, data.size());
+  return data.size();
+}
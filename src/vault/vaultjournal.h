@@ -0,0 +1,172 @@
+#ifndef VAULTJOURNAL_H
+#define VAULTJOURNAL_H
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include "vaultentry.h"
+
+/**
+ * @brief Append-only, individually authenticated log of entry mutations
+ *
+ * The journal lives next to the vault file (<vault>.journal) and holds the
+ * mutations made since the last full snapshot, so a single add, update or
+ * remove costs one record instead of a rewrite of the whole vault.
+ *
+ * File layout: magic (4) | generation (8) | records...
+ * Record layout: length (4) | nonce (24) | ciphertext
+ *
+ * Every record is encrypted with the journal subkey and authenticates the
+ * journal generation and its sequence number, so records cannot be moved
+ * between journals or reordered. The snapshot stores the generation of the
+ * journal that continues it; a journal with any other generation is stale.
+ *
+ * While a snapshot is compacted in the background, records are written to
+ * both the current journal and <vault>.journal.next, which continues the
+ * new snapshot. Whichever snapshot is on disk after a crash, one of the two
+ * journals matches it.
+ *
+ * A failed append leaves the journal sizes and sequence numbers untouched,
+ * and the next append first cuts off whatever the failed write left behind,
+ * so retrying the same records is safe. Once the current journal holds a
+ * batch it is never written there again: if only the next journal fails,
+ * its records are kept and written ahead of the next batch.
+ */
+class VaultJournal
+{
+public:
+  enum class Operation : quint8
+  {
+    Put = 1,    // Add or replace the entry with entry.id
+    Remove = 2, // Remove the entry with id
+  };
+
+  struct Record
+  {
+    Operation operation = Operation::Put;
+    EntryId id = 0;
+    VaultEntry entry; // Only used by Put
+  };
+
+  /**
+   * @brief Journal records matching a snapshot, as read at unlock
+   */
+  struct ReplayResult
+  {
+    QList<Record> records;
+    bool found = false;    // A journal with the requested generation exists
+    QString path;          // File the records were read from
+    qint64 validSize = 0;  // Bytes up to the end of the last intact record
+    quint64 recordCount = 0;
+  };
+
+  static QString pathFor(const QString &vaultPath);
+  static QString nextPathFor(const QString &vaultPath);
+
+  /**
+   * @brief Read the journal that continues the snapshot with the given generation
+   * Reading stops at the first truncated or unauthenticated record (torn write)
+   * @param vaultPath Path to the vault file
+   * @param generation Journal generation stored in the snapshot
+   * @param rootKey Root key of the vault
+   */
+  static ReplayResult read(const QString &vaultPath, quint64 generation, QByteArrayView rootKey);
+
+  /**
+   * @brief Apply replayed records to a list of entries in order
+   */
+  static void apply(QList<VaultEntry> &entries, const QList<Record> &records);
+
+  /**
+   * @brief Start appending to the journal of an unlocked vault
+   * Promotes a matching .next journal, drops a torn tail and creates the
+   * journal if there is none
+   * @throws FileUtils::FileOperationError if the journal cannot be prepared
+   */
+  void attach(const QString &vaultPath, QByteArrayView rootKey, quint64 generation,
+              const ReplayResult &replay);
+
+  /**
+   * @brief Stop using the journal and wipe its key
+   */
+  void detach();
+
+  /**
+   * @brief Append one record, also to the next journal while a rollover is pending
+   * @throws FileUtils::FileOperationError if the record cannot be written to the current journal
+   */
+  void append(const Record &record);
+
+  /**
+   * @brief Append several records with a single write per journal file
+   * Nothing is thrown once the current journal holds the records, a failed
+   * write to the next journal is repeated by the following append or catchUpRollover
+   * @throws FileUtils::FileOperationError if the records cannot be written to the current journal
+   */
+  void append(const QList<Record> &records);
+
+  /**
+   * @brief Start an empty journal after a full snapshot was written
+   * @param generation Generation stored in that snapshot
+   */
+  void reset(quint64 generation);
+
+  /**
+   * @brief Start writing records to the next journal as well (background compaction)
+   * @param nextGeneration Generation stored in the snapshot being written
+   */
+  void beginRollover(quint64 nextGeneration);
+
+  /**
+   * @brief Write the records the next journal is still missing
+   * Must succeed before the snapshot continued by the next journal replaces the vault
+   * @throws FileUtils::FileOperationError if the next journal cannot be written
+   */
+  void catchUpRollover();
+
+  /**
+   * @brief Make the next journal current once its snapshot is on disk
+   */
+  void commitRollover();
+
+  /**
+   * @brief Drop the next journal after a failed compaction
+   */
+  void abortRollover();
+
+  /**
+   * @brief Whether appends, new headers and journal renames are fsynced (on by default)
+   * Off for FileUtils::Durability::Relaxed
+   */
+  void setSyncWrites(bool sync) { m_syncWrites = sync; }
+  bool syncWrites() const { return m_syncWrites; }
+
+  bool isAttached() const { return !m_key.isEmpty(); }
+  bool isRollingOver() const { return m_rollingOver; }
+  quint64 generation() const { return m_generation; }
+  qint64 size() const { return m_size; }
+  quint64 recordCount() const { return m_sequence; }
+
+private:
+  QString m_path;
+  QString m_nextPath;
+  SecureMemory::Buffer m_key;
+  quint64 m_generation = 0;
+  quint64 m_sequence = 0;
+  qint64 m_size = 0;
+  bool m_rollingOver = false;
+  quint64 m_nextGeneration = 0;
+  quint64 m_nextSequence = 0;
+  qint64 m_nextSize = 0;
+  QByteArray m_nextBacklog; // Encrypted records the next journal failed to take
+  bool m_syncWrites = true;
+
+  static QByteArray encodeRecord(const Record &record);
+  static bool decodeRecord(const QByteArray &plain, Record &outRecord);
+  static QByteArray recordAssociatedData(quint64 generation, quint64 sequence);
+  static qint64 writeHeader(const QString &path, quint64 generation, bool sync);
+  QByteArray encryptRecord(quint64 generation, quint64 sequence, const QByteArray &plain) const;
+  static qint64 appendToFile(const QString &path, qint64 size, const QByteArray &data, bool sync);
+};
+
+#endif // VAULTJOURNAL_H
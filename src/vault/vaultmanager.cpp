@@ -1,155 +1,1439 @@
 #include "vaultmanager.h"
 #include "../utils/fileutils.h"
+#include "../utils/metrics.h"
+#include "../utils/tracing.h"
 #include "../crypto/cryptoutils.h"
+#include "vaultformat.h"
+#include <QCoreApplication>
 #include <QDebug>
 #include <QJsonDocument>
 #include <QJsonArray>
 #include <QJsonObject>
-#include <QPalette>
 #include <QTimerEvent>
 #include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QtConcurrent/QtConcurrent>
+#include <atomic>
 
-constexpr int SESSION_TIMEOUT = 15 * 60 * 1000; // 15 minutes in milliseconds
+constexpr int SESSION_TIMEOUT = 15 * 60 * 1000;                 // 15 minutes in milliseconds
+constexpr qint64 JOURNAL_COMPACTION_THRESHOLD = 256 * 1024; // Journal size that triggers a background snapshot
+constexpr qsizetype SECRET_CACHE_CAPACITY = 32;               // Decrypted passwords kept at most
+constexpr qint64 SECRET_CACHE_TTL = 20 * 1000;                // Lifetime of a decrypted password in the cache
+constexpr int SECRET_CACHE_PURGE_INTERVAL = 5 * 1000;         // How often expired passwords are wiped
+constexpr int WRITE_BEHIND_WINDOW = 500;                      // Mutations within this many milliseconds share a journal write
 
 VaultManager::VaultManager()
+    : m_secretCache(SECRET_CACHE_CAPACITY, SECRET_CACHE_TTL), m_writeBehindWindow(WRITE_BEHIND_WINDOW)
 {
+  connect(&m_unlockWatcher, &QFutureWatcher<UnlockedVault>::progressValueChanged, this, &VaultManager::unlockProgress);
+  connect(&m_unlockWatcher, &QFutureWatcher<UnlockedVault>::finished, this, &VaultManager::onUnlockFinished);
+  connect(&m_compactionWatcher, &QFutureWatcher<CompactionResult>::finished, this, &VaultManager::finishCompaction);
+  connect(&m_rekeyWatcher, &QFutureWatcher<RekeyedVault>::progressValueChanged, this, &VaultManager::masterPasswordChangeProgress);
+  connect(&m_rekeyWatcher, &QFutureWatcher<RekeyedVault>::finished, this, &VaultManager::onRekeyFinished);
+  connect(&m_flushWatcher, &QFutureWatcher<FlushResult>::finished, this, &VaultManager::onFlushFinished);
+
+  // The event loop is gone by the time the destructor runs, write the last window now
+  if (QCoreApplication *app = QCoreApplication::instance())
+  {
+    connect(app, &QCoreApplication::aboutToQuit, this, &VaultManager::flushPendingWrites);
+  }
+}
+
+void VaultManager::openVault(const QString &filePath, const QString &password)
+{
+  lockVaultFile(filePath);
+  try
+  {
+    UnlockedVault unlocked = unlockVault(filePath, password, m_kdfTargetMilliseconds, m_kdfMemoryBudget, nullptr,
+                                         waitForPrefetch(filePath));
+    applyUnlockedVault(unlocked);
+  }
+  catch (...)
+  {
+    unlockVaultFileIfUnused();
+    throw;
+  }
+}
+
+QFuture<UnlockedVault> VaultManager::openVaultAsync(const QString &filePath, const QString &password)
+{
+  // Starting a new unlock supersedes any unlock still in flight
+  cancelOpenVault();
+
+  // The lock is taken here rather than on the worker: an unlock cancelled by a
+  // retry may still be running, and it holds the same lock as its successor
+  QString lockError;
+  try
+  {
+    lockVaultFile(filePath);
+  }
+  catch (const std::exception &e)
+  {
+    lockError = QString::fromUtf8(e.what());
+  }
+
+  // A prefetch still running is waited for on the worker, not on the GUI thread
+  dropUnusablePrefetch();
+  bool hasPrefetch = m_prefetchPath == filePath;
+  QFuture<FileUtils::PreparedVault> prefetch = m_prefetch;
+
+  QFuture<UnlockedVault> future = QtConcurrent::run(
+      [filePath, password, kdfTarget = m_kdfTargetMilliseconds, kdfBudget = m_kdfMemoryBudget, prefetch,
+       hasPrefetch, lockError](QPromise<UnlockedVault> &promise)
+      {
+        promise.setProgressRange(0, 100);
+        try
+        {
+          if (!lockError.isEmpty())
+          {
+            throw FileUtils::FileOperationError(lockError.toStdString());
+          }
+          FileUtils::PreparedVault prepared = hasPrefetch ? prefetch.result() : FileUtils::PreparedVault();
+          UnlockedVault unlocked = unlockVault(filePath, password, kdfTarget, kdfBudget, &promise, prepared);
+          if (!promise.isCanceled())
+          {
+            promise.addResult(unlocked);
+          }
+        }
+        catch (const std::exception &e)
+        {
+          UnlockedVault failed;
+          failed.error = QString::fromUtf8(e.what());
+          promise.addResult(failed);
+        }
+      });
+
+  m_unlockWatcher.setFuture(future);
+  return future;
+}
+
+void VaultManager::cancelOpenVault()
+{
+  if (m_unlockWatcher.isRunning())
+  {
+    m_unlockWatcher.cancel();
+  }
+}
+
+bool VaultManager::isUnlocking() const
+{
+  return m_unlockWatcher.isRunning();
+}
+
+void VaultManager::prefetchVault(const QString &filePath)
+{
+  if (m_isVaultOpen || (m_prefetchPath == filePath && !m_prefetch.isFinished()))
+  {
+    return;
+  }
+
+  m_prefetchPath = filePath;
+  m_prefetch = QtConcurrent::run(
+      [filePath, kdfTarget = m_kdfTargetMilliseconds, kdfBudget = m_kdfMemoryBudget]()
+      {
+        FileUtils::PreparedVault prepared = FileUtils::prepareVault(filePath);
+        if (!prepared.exists)
+        {
+          // The first unlock creates the vault, calibrating now takes the probes off the unlock.
+          // A failure leaves the result unusable, the unlock then calibrates and reports it itself
+          try
+          {
+            prepared.keyDerivation = {FileUtils::generateSalt(), CryptoUtils::calibrateKdf(kdfTarget, kdfBudget)};
+          }
+          catch (const std::exception &e)
+          {
+            qWarning() << "Prefetch could not calibrate the key derivation:" << e.what();
+          }
+        }
+        return prepared;
+      });
+}
+
+FileUtils::PreparedVault VaultManager::waitForPrefetch(const QString &filePath)
+{
+  if (m_prefetchPath != filePath)
+  {
+    return FileUtils::PreparedVault();
+  }
+
+  FileUtils::PreparedVault prepared = m_prefetch.result();
+  dropUnusablePrefetch();
+  return prepared;
+}
+
+void VaultManager::dropUnusablePrefetch()
+{
+  // A failed or outdated prefetch would otherwise be handed to every retry, prefetchVault starts a new one
+  if (!m_prefetchPath.isEmpty() && m_prefetch.isFinished() && !m_prefetch.result().isUsable())
+  {
+    dropPrefetch();
+  }
+}
+
+void VaultManager::dropPrefetch()
+{
+  // Releases the mapping once the unlock is done with it. A running prefetch owns no state of the manager
+  m_prefetch = QFuture<FileUtils::PreparedVault>();
+  m_prefetchPath.clear();
+}
+
+void VaultManager::onUnlockFinished()
+{
+  QFuture<UnlockedVault> future = m_unlockWatcher.future();
+  if (future.isCanceled() || future.resultCount() == 0)
+  {
+    unlockVaultFileIfUnused();
+    emit vaultOpenCanceled();
+    return;
+  }
+
+  UnlockedVault unlocked = future.result();
+  if (!unlocked.error.isEmpty())
+  {
+    unlockVaultFileIfUnused();
+    emit vaultOpenFailed(unlocked.error);
+    return;
+  }
+
+  try
+  {
+    applyUnlockedVault(unlocked);
+  }
+  catch (const std::exception &e)
+  {
+    unlockVaultFileIfUnused();
+    emit vaultOpenFailed(QString::fromUtf8(e.what()));
+  }
+}
+
+void VaultManager::lockVaultFile(const QString &filePath)
+{
+  // A retry after a wrong password keeps the lock it already holds
+  if (m_vaultLock && m_vaultLockPath == filePath)
+  {
+    return;
+  }
+
+  m_vaultLock = FileUtils::lockVault(filePath);
+  m_vaultLockPath = filePath;
+}
+
+void VaultManager::unlockVaultFileIfUnused()
+{
+  // Only an open vault or an unlock still running needs it
+  if (!m_isVaultOpen && !m_unlockWatcher.isRunning())
+  {
+    m_vaultLock.reset();
+    m_vaultLockPath.clear();
+  }
+}
+
+UnlockedVault VaultManager::unlockVault(const QString &filePath, const QString &password,
+                                        int kdfTargetMilliseconds, quint64 kdfMemoryBudget,
+                                        QPromise<UnlockedVault> *promise, const FileUtils::PreparedVault &prepared)
+{
+  TRACE_SPAN("vault", "VaultManager::unlockVault");
+  // The prefetch already read, validated and faulted in the file, and for a new vault calibrated the hash
+  bool usePrepared = prepared.filePath == filePath && prepared.isUsable();
+
+  QElapsedTimer unlockTimer;
+  unlockTimer.start();
+
+  // Reports progress and tells the caller whether to stop. Argon2 itself cannot be
+  // interrupted, so cancellation is honoured between pipeline stages
+  auto checkpoint = [promise](int progress)
+  {
+    if (!promise)
+    {
+      return false;
+    }
+    promise->setProgressValue(progress);
+    return promise->isCanceled();
+  };
+
+  if (password.isEmpty())
+  {
+    throw CryptoUtils::CryptoOperationError("Password cannot be empty");
+  }
+
+  UnlockedVault unlocked;
+  unlocked.filePath = filePath;
+
+  // New vaults calibrate the password hash for this machine, existing ones
+  // use the parameters stored in their header
+  bool isNewVault = usePrepared ? !prepared.exists : !FileUtils::exists(filePath);
+  FileUtils::KeyDerivation keyDerivation;
+  if (usePrepared)
+  {
+    keyDerivation = prepared.keyDerivation;
+  }
+  else
+  {
+    keyDerivation = isNewVault ? FileUtils::KeyDerivation{FileUtils::generateSalt(), CryptoUtils::calibrateKdf(kdfTargetMilliseconds, kdfMemoryBudget)}
+                               : FileUtils::extractKeyDerivation(filePath);
+  }
+  if (keyDerivation.salt.isEmpty())
+  {
+    throw FileUtils::FileOperationError("Cannot extract salt from vault file");
+  }
+  const QByteArray &salt = keyDerivation.salt;
+
+  if (checkpoint(5))
+  {
+    return unlocked;
+  }
+
+  // The only password stretch of the unlock, every other key is expanded from this root key
+  unlocked.rootKey = CryptoUtils::deriveKeyFromPassword(password, salt, keyDerivation.params);
+
+  if (checkpoint(70))
+  {
+    unlocked.rootKey.clear();
+    return unlocked;
+  }
+
+  if (isNewVault)
+  {
+    FileUtils::createVault(filePath, keyDerivation, unlocked.rootKey);
+  }
+
+  bool legacyKeySchedule = false;
+  // For a segmented vault this is only the index, record blocks are read on first access
+  CryptoUtils::LockedBytes decrypted = usePrepared && prepared.mapping
+                                           ? FileUtils::readVault(prepared, unlocked.rootKey, &legacyKeySchedule)
+                                           : FileUtils::readVault(filePath, unlocked.rootKey, &legacyKeySchedule);
+
+  if (checkpoint(85))
+  {
+    unlocked.clear();
+    return unlocked;
+  }
+
+  unlocked.entries = loadEntries(decrypted.bytes(), &unlocked.journalGeneration);
+  decrypted.clear();
+
+  // Replay the mutations recorded since the snapshot was written
+  unlocked.journal = VaultJournal::read(filePath, unlocked.journalGeneration, unlocked.rootKey);
+  VaultJournal::apply(unlocked.entries, unlocked.journal.records);
+
+  unlocked.needsSave = assignMissingIds(unlocked.entries);
+
+  // Vaults from before the key schedule keep their entries under a separately
+  // stretched password key. Derive it once so the entries can be re-keyed
+  SecureMemory::Buffer legacyPasswordKey;
+  if (legacyKeySchedule)
+  {
+    legacyPasswordKey = deriveLegacyPasswordKey(password, salt);
+  }
+
+  // Entries from before the current format are re-encrypted below, which needs
+  // their record blocks. Current entries keep loading on first access
+  for (VaultEntry &entry : unlocked.entries)
+  {
+    if (entry.isPayloadPending() && (legacyKeySchedule || entry.formatVersion != VaultEntry::CurrentFormatVersion))
+    {
+      try
+      {
+        entry.encryptedPassword = FileUtils::readRecordBlock(filePath, unlocked.rootKey, entry.id, entry.block);
+      }
+      catch (const std::exception &e)
+      {
+        qWarning() << "Failed to read entry" << entry.username << "for migration:" << e.what();
+      }
+    }
+  }
+
+  SecureMemory::Buffer passwordKey = CryptoUtils::expandRootKey(unlocked.rootKey, CryptoUtils::RootSubkey::Password);
+  unlocked.needsSave |= migrateEntries(unlocked.entries, passwordKey, legacyPasswordKey);
+
+  // Index the final entries here so opening a large vault does not stall the GUI thread
+  unlocked.searchIndex.rebuild(unlocked.entries);
+
+  // Only completed unlocks are recorded, a wrong password would skew the histogram
+  Metrics::recordLatency(Metrics::Operation::Unlock, unlockTimer.nsecsElapsed());
+  checkpoint(100);
+  return unlocked;
+}
+
+void VaultManager::applyUnlockedVault(UnlockedVault &unlocked)
+{
+  TRACE_SPAN("vault", "VaultManager::applyUnlockedVault");
+  dropPrefetch();
+  m_filePath = unlocked.filePath;
+  m_entries = unlocked.entries;
+  rebuildIndex();
+  m_searchIndex = std::move(unlocked.searchIndex);
+  bool needsSave = unlocked.needsSave;
+
+  startSession(unlocked.rootKey);
+  m_journal.attach(m_filePath, unlocked.rootKey, unlocked.journalGeneration, unlocked.journal);
+  unlocked.clear();
+  emit entriesReset();
+
+  // Persist entries that were migrated to the current format during unlock
+  if (needsSave)
+  {
+    saveEntries(m_entries);
+  }
+
+  // ✅ Emit signal that vault was opened
+  emit vaultOpened(m_filePath);
+}
+
+bool VaultManager::closeVault()
+{
+  TRACE_SPAN("vault", "VaultManager::closeVault");
+  Metrics::ScopedLatency latency(Metrics::Operation::Lock);
+
+  // Nothing committed may be lost with the keys. The session timer keeps
+  // running if it is, so a timed out session tries again
+  if (!writeCommittedMutations())
+  {
+    return false;
+  }
+  killTimer(m_sessionTimer);
+  releaseVault();
+  return true;
+}
+
+bool VaultManager::writeCommittedMutations()
+{
+  flushPendingWrites();
+  if (!hasPendingWrites())
+  {
+    return true;
+  }
+
+  // The journal cannot take them, a snapshot of the entries holds them as well
+  try
+  {
+    saveEntries(m_entries);
+    return true;
+  }
+  catch (const std::exception &e)
+  {
+    reportWriteFailure(e.what());
+    return false;
+  }
+}
+
+void VaultManager::releaseVault()
+{
+  // Let a running compaction land before the keys go away. A master password
+  // change still in flight is cancelled, not waited for: it stops at its next
+  // stage and onRekeyFinished drops whatever it produced
+  finishCompaction();
+  if (m_rekeyWatcher.isRunning())
+  {
+    m_rekeyWatcher.cancel();
+  }
+  ++m_mutationSerial; // A re-key started before the close must not land on a vault opened again
+  m_journal.detach();
+  m_vaultLock.reset(); // Other processes may open the vault again
+  m_vaultLockPath.clear();
+
+  m_secretCache.clear();
+  if (m_secretCacheTimer)
+  {
+    killTimer(m_secretCacheTimer);
+    m_secretCacheTimer = 0;
+  }
+
+  // Securely clear all sensitive data
+  for (VaultEntry &entry : m_entries)
+  {
+    entry.clearSensitiveData();
+  }
+
+  // Implementation for closing the vault
+  m_entries.clear();
+  m_index.clear();
+  m_searchIndex.clear();
+  m_filePath.clear();
+
+  // Securely clear cryptographic keys
+  m_vaultRootKey.clear();
+  m_passwordMasterKey.clear();
+
+  m_isVaultOpen = false;
+  emit entriesReset();
+
+  // ✅ Emit signal that vault was closed
+  emit vaultClosed("manual");
+}
+
+VaultManager::~VaultManager()
+{
+  if (!closeVault())
+  {
+    qCritical() << "Discarding committed mutations that could not be written";
+    releaseVault();
+  }
+}
+
+QList<VaultEntry> VaultManager::getEntries() const
+{
+  return m_entries;
+}
+
+QList<VaultEntry> VaultManager::loadEntries(const QByteArray &decryptedData, quint64 *outJournalGeneration)
+{
+  TRACE_SPAN("vault", "VaultManager::loadEntries");
+  QList<VaultEntry> entries;
+  quint64 journalGeneration = 0;
+
+  // Segmented vaults decrypt to an index, their record blocks stay on disk until needed
+  bool isIndex = VaultFormat::isIndexPayload(decryptedData);
+  if (isIndex || VaultFormat::isBinaryPayload(decryptedData))
+  {
+    if (isIndex)
+    {
+      VaultFormat::decodeIndex(decryptedData, entries, journalGeneration);
+    }
+    else
+    {
+      VaultFormat::decodePayload(decryptedData, entries, journalGeneration);
+    }
+
+    if (outJournalGeneration)
+    {
+      *outJournalGeneration = journalGeneration;
+    }
+    return entries;
+  }
+
+  // JSON payloads from older versions, rewritten in the binary format on the next save
+  QJsonDocument doc = QJsonDocument::fromJson(decryptedData);
+
+  // Snapshots record the journal generation that continues them,
+  // vaults written before the journal existed are a bare array
+  QJsonArray array;
+  if (doc.isObject())
+  {
+    QJsonObject root = doc.object();
+    journalGeneration = root.value("journalGeneration").toString().toULongLong();
+    array = root.value("entries").toArray();
+  }
+  else if (doc.isArray())
+  {
+    array = doc.array();
+  }
+
+  for (const QJsonValue &value : array)
+  {
+    VaultEntry entry;
+    if (value.isObject() && VaultEntry::fromJson(value.toObject(), entry))
+    {
+      entries.append(entry);
+    }
+  }
+
+  if (outJournalGeneration)
+  {
+    *outJournalGeneration = journalGeneration;
+  }
+  return entries;
+}
+
+QList<FileUtils::BlockLocation> VaultManager::writeSnapshot(const QString &filePath, const QString &targetPath,
+                                                           QByteArrayView rootKey, const QList<VaultEntry> &entries,
+                                                           quint64 journalGeneration,
+                                                           const FileUtils::KeyDerivation &keyDerivation)
+{
+  TRACE_SPAN("vault", "VaultManager::writeSnapshot");
+  // Entries that were never read are copied block by block without decrypting them
+  QList<FileUtils::RecordBlock> blocks;
+  blocks.reserve(entries.size());
+  for (const VaultEntry &entry : entries)
+  {
+    FileUtils::RecordBlock block;
+    block.id = entry.id;
+    if (entry.isPayloadPending())
+    {
+      block.source = entry.block;
+    }
+    else
+    {
+      block.plain = entry.encryptedPassword;
+    }
+    blocks.append(block);
+  }
+
+  return FileUtils::writeSegmentedVault(targetPath, filePath, rootKey, blocks,
+                                        [&entries, journalGeneration](const QList<FileUtils::BlockLocation> &locations)
+                                        { return VaultFormat::encodeIndex(entries, locations, journalGeneration); },
+                                        keyDerivation);
+}
+
+void VaultManager::applyBlockLocations(const QList<VaultEntry> &written, const QList<FileUtils::BlockLocation> &locations,
+                                       bool releasePayloads)
+{
+  for (qsizetype i = 0; i < written.size() && i < locations.size(); ++i)
+  {
+    auto it = m_index.constFind(written[i].id);
+    if (it == m_index.constEnd())
+    {
+      continue;
+    }
+
+    // An entry changed after the snapshot keeps its newer payload in memory,
+    // the location is only used once the payload is released
+    VaultEntry &entry = m_entries[it.value()];
+    entry.block = locations[i];
+    if (releasePayloads)
+    {
+      entry.encryptedPassword.clear();
+    }
+  }
+}
+
+void VaultManager::loadPayload(VaultEntry &entry)
+{
+  if (entry.isPayloadPending())
+  {
+    entry.encryptedPassword = FileUtils::readRecordBlock(m_filePath, m_vaultRootKey, entry.id, entry.block);
+  }
+}
+
+bool VaultManager::assignMissingIds(QList<VaultEntry> &entries)
+{
+  // Entries saved before ids existed (or duplicated by hand) get a fresh id
+  QSet<EntryId> seen;
+  seen.reserve(entries.size());
+  bool assigned = false;
+  for (VaultEntry &entry : entries)
+  {
+    while (entry.id == 0 || seen.contains(entry.id))
+    {
+      entry.id = VaultEntry::generateId();
+      assigned = true;
+    }
+    seen.insert(entry.id);
+  }
+  return assigned;
+}
+
+void VaultManager::rebuildIndex()
+{
+  m_index.clear();
+  m_index.reserve(m_entries.size());
+  for (qsizetype i = 0; i < m_entries.size(); ++i)
+  {
+    m_index.insert(m_entries[i].id, i);
+  }
+}
+
+const VaultEntry *VaultManager::findEntry(EntryId id) const
+{
+  auto it = m_index.constFind(id);
+  if (it == m_index.constEnd())
+  {
+    return nullptr;
+  }
+  return &m_entries[it.value()];
+}
+
+bool VaultManager::migrateEntries(QList<VaultEntry> &entries, QByteArrayView passwordKey,
+                                  QByteArrayView legacyPasswordKey)
+{
+  TRACE_SPAN("vault", "VaultManager::migrateEntries");
+  // Transparently migrate legacy entries to the current per-entry format and
+  // key schedule. This pays the migration cost once, after that every access is cheap
+  bool migrated = !legacyPasswordKey.isEmpty();
+  for (VaultEntry &entry : entries)
+  {
+    try
+    {
+      if (!legacyPasswordKey.isEmpty())
+      {
+        entry.rekey(legacyPasswordKey, passwordKey);
+      }
+      else
+      {
+        migrated |= entry.migrate(passwordKey);
+      }
+    }
+    catch (const CryptoUtils::CryptoOperationError &e)
+    {
+      qWarning() << "Failed to migrate entry" << entry.username << ":" << e.what();
+    }
+  }
+  return migrated;
+}
+
+EntryId VaultManager::addEntry(const VaultEntry &entry)
+{
+  TRACE_SPAN("vault", "VaultManager::addEntry");
+  Metrics::ScopedLatency latency(Metrics::Operation::Add);
+  if (!VaultFormat::isUsernameStorable(entry.username))
+  {
+    throw FileUtils::FileOperationError("Username is longer than 65535 UTF-8 bytes");
+  }
+
+  // Create a copy to encrypt
+  VaultEntry encryptedEntry = entry;
+
+  // Every stored entry needs a unique id
+  while (encryptedEntry.id == 0 || m_index.contains(encryptedEntry.id))
+  {
+    encryptedEntry.id = VaultEntry::generateId();
+  }
+
+  // Encrypt the password if it's not already encrypted
+  if (!encryptedEntry.isEncrypted())
+  {
+    encryptedEntry.encryptPassword(m_passwordMasterKey);
+  }
+
+  // Add to our list
+  m_index.insert(encryptedEntry.id, m_entries.size());
+  m_entries.append(encryptedEntry);
+  m_searchIndex.insert(encryptedEntry.id, encryptedEntry.username);
+
+  // Record the addition in the journal
+  commitMutation({VaultJournal::Operation::Put, encryptedEntry.id, encryptedEntry});
+
+  // ✅ Emit signal that entry was added
+  emit entryAdded(encryptedEntry.id, m_entries.size() - 1);
+  return encryptedEntry.id;
+}
+
+QList<EntryId> VaultManager::addEntries(const QList<VaultEntry> &entries)
+{
+  TRACE_SPAN("vault", "VaultManager::addEntries");
+  Metrics::ScopedLatency latency(Metrics::Operation::Add);
+  QList<VaultEntry> encryptedEntries = entries;
+
+  // Every stored entry needs a unique id, also within the batch. The ids are
+  // assigned before encryption because the ciphertext is bound to them
+  QSet<EntryId> batchIds;
+  batchIds.reserve(encryptedEntries.size());
+  for (VaultEntry &entry : encryptedEntries)
+  {
+    if (!VaultFormat::isUsernameStorable(entry.username))
+    {
+      throw FileUtils::FileOperationError("Username is longer than 65535 UTF-8 bytes");
+    }
+    while (entry.id == 0 || m_index.contains(entry.id) || batchIds.contains(entry.id))
+    {
+      entry.id = VaultEntry::generateId();
+    }
+    batchIds.insert(entry.id);
+  }
+  encryptEntries(encryptedEntries, m_passwordMasterKey);
+
+  QList<EntryId> ids;
+  QList<VaultJournal::Record> records;
+  ids.reserve(encryptedEntries.size());
+  records.reserve(encryptedEntries.size());
+  m_entries.reserve(m_entries.size() + encryptedEntries.size());
+
+  for (VaultEntry &entry : encryptedEntries)
+  {
+    m_index.insert(entry.id, m_entries.size());
+    m_entries.append(entry);
+    m_searchIndex.insert(entry.id, entry.username);
+    ids.append(entry.id);
+    records.append({VaultJournal::Operation::Put, entry.id, entry});
+  }
+
+  commitMutations(records);
+
+  // The batch was appended in order behind the existing rows
+  qsizetype row = m_entries.size() - ids.size();
+  for (EntryId id : ids)
+  {
+    emit entryAdded(id, row++);
+  }
+  emit entriesChanged();
+  return ids;
+}
+
+void VaultManager::updateEntries(const QHash<EntryId, QString> &newPasswords)
+{
+  TRACE_SPAN("vault", "VaultManager::updateEntries");
+  Metrics::ScopedLatency latency(Metrics::Operation::Update);
+  // Encrypt copies first, the vault only changes once the whole batch succeeded
+  QList<VaultEntry> updated;
+  updated.reserve(newPasswords.size());
+  for (auto it = newPasswords.constBegin(); it != newPasswords.constEnd(); ++it)
+  {
+    const VaultEntry *current = findEntry(it.key());
+    if (!current)
+    {
+      qWarning() << "Entry not found for update:" << it.key();
+      continue;
+    }
+
+    VaultEntry entry = *current;
+    entry.encryptedPassword.clear();
+    entry.block = FileUtils::BlockLocation();
+    entry.password = it.value();
+    updated.append(entry);
+  }
+
+  encryptEntries(updated, m_passwordMasterKey);
+
+  QList<VaultJournal::Record> records;
+  records.reserve(updated.size());
+  for (const VaultEntry &entry : updated)
+  {
+    m_entries[m_index.value(entry.id)] = entry;
+    m_secretCache.remove(entry.id);
+    records.append({VaultJournal::Operation::Put, entry.id, entry});
+  }
+
+  commitMutations(records);
+
+  for (const VaultEntry &entry : updated)
+  {
+    emit entryUpdated(entry.id, m_index.value(entry.id));
+  }
+  emit entriesChanged();
+}
+
+void VaultManager::removeEntries(const QList<EntryId> &ids)
+{
+  TRACE_SPAN("vault", "VaultManager::removeEntries");
+  Metrics::ScopedLatency latency(Metrics::Operation::Remove);
+  // Every removal moves rows, so the signals replay the removals in order
+  struct RemovedRow
+  {
+    EntryId id;
+    qsizetype row;
+    qsizetype movedFromRow;
+  };
+  QList<RemovedRow> removed;
+  QList<VaultJournal::Record> records;
+  removed.reserve(ids.size());
+  records.reserve(ids.size());
+
+  for (EntryId id : ids)
+  {
+    auto it = m_index.constFind(id);
+    if (it == m_index.constEnd())
+    {
+      qWarning() << "Entry not found for removal:" << id;
+      continue;
+    }
+
+    qsizetype row = it.value();
+    removed.append({id, row, eraseRow(row)});
+    records.append({VaultJournal::Operation::Remove, id, VaultEntry()});
+  }
+
+  commitMutations(records);
+
+  for (const RemovedRow &step : removed)
+  {
+    emit entryRemoved(step.id, step.row, step.movedFromRow);
+  }
+  emit entriesChanged();
+}
+
+void VaultManager::saveVault()
+{
+  if (!m_isVaultOpen)
+  {
+    qWarning() << "Cannot save: no vault is open";
+    return;
+  }
+
+  saveEntries(m_entries);
+}
+
+void VaultManager::saveEntries(QList<VaultEntry> entries)
+{
+  TRACE_SPAN("vault", "VaultManager::saveEntries");
+  Metrics::ScopedLatency latency(Metrics::Operation::Save);
+  // A full snapshot supersedes a background compaction that is still running
+  finishCompaction();
+
+  // The snapshot names the generation of the fresh journal that continues it
+  QElapsedTimer timer;
+  timer.start();
+  quint64 journalGeneration = m_journal.generation() + 1;
+  QString tempPath = m_filePath + ".tmp";
+  QList<FileUtils::BlockLocation> locations = writeSnapshot(m_filePath, tempPath, m_vaultRootKey, entries, journalGeneration);
+  FileUtils::replaceVault(tempPath, m_filePath, m_durability != FileUtils::Durability::Relaxed);
+  m_journal.reset(journalGeneration);
+  recordCommitLatency(timer.nsecsElapsed());
+
+  // The snapshot supersedes the mutations still waiting for the journal, the
+  // entries already contain them. Until here a failed write leaves them pending
+  if (m_writeBehindTimer)
+  {
+    killTimer(m_writeBehindTimer);
+    m_writeBehindTimer = 0;
+  }
+  m_pendingRecords.clear();
+  m_pendingBytes = 0;
+
+  // Everything is on disk now, payloads are read back from their blocks on demand
+  applyBlockLocations(entries, locations, true);
 }
 
-void VaultManager::openVault(const QString &filePath, const QString &password)
+void VaultManager::commitMutation(const VaultJournal::Record &record)
 {
+  commitMutations({record});
+}
 
-  if (!FileUtils::exists(filePath))
+void VaultManager::commitMutations(const QList<VaultJournal::Record> &records)
+{
+  if (records.isEmpty())
   {
-    FileUtils::createVault(filePath, password);
+    return;
   }
-  // Implementation for opening the vault
-  m_isVaultOpen = true;
 
-  QByteArray decrypted = FileUtils::readVault(filePath, password);
+  // A batch too large for the journal goes straight into a snapshot, which
+  // is the single write it would have triggered through compaction anyway
+  qint64 batchSize = 0;
+  for (const VaultJournal::Record &record : records)
+  {
+    batchSize += record.entry.username.size() * 3 + record.entry.encryptedPassword.size();
+  }
+  // The mutation is applied in memory and its signals still have to go out, so a
+  // failed write is reported through writeFailed and retried instead of thrown
+  ++m_mutationSerial;
+  if (m_pendingBytes + batchSize > JOURNAL_COMPACTION_THRESHOLD && records.size() > 1)
+  {
+    try
+    {
+      saveEntries(m_entries);
+      return;
+    }
+    catch (const std::exception &e)
+    {
+      // The journal can still take the batch, retried like any other pending write
+      reportWriteFailure(e.what());
+    }
+  }
 
-  qDebug() << "Decrypted Data is: " << decrypted << "\n";
+  // Otherwise the mutations cost one journal write instead of a full rewrite,
+  // shared with every other mutation of the same window
+  m_pendingRecords.append(records);
+  m_pendingBytes += batchSize;
 
-  // TODO: Don't store plain text password in memory
-  m_decrypted = decrypted;
-  m_filePath = filePath;
+  if (m_writeBehindWindow <= 0 || m_durability == FileUtils::Durability::Strict)
+  {
+    try
+    {
+      writePendingRecords();
+    }
+    catch (const std::exception &e)
+    {
+      reportWriteFailure(e.what());
+    }
+    return;
+  }
 
-  startSession(password);
-  loadEntries(m_decrypted);
+  // A window opens with its first mutation. While a flush runs, onFlushFinished opens the next one
+  if (!m_writeBehindTimer && !m_flushWatcher.isRunning())
+  {
+    m_writeBehindTimer = startTimer(m_writeBehindWindow);
+  }
+}
 
-  // ✅ Emit signal that vault was opened
-  emit vaultOpened(filePath);
+void VaultManager::reportWriteFailure(const QString &error)
+{
+  qWarning() << "Failed to write committed mutations, retrying:" << error;
+  emit writeFailed(error);
+
+  // The records stay pending, the next window writes them again
+  if (!m_pendingRecords.isEmpty() && !m_writeBehindTimer && !m_flushWatcher.isRunning())
+  {
+    m_writeBehindTimer = startTimer(m_writeBehindWindow > 0 ? m_writeBehindWindow : WRITE_BEHIND_WINDOW);
+  }
 }
 
-void VaultManager::closeVault()
+void VaultManager::setWriteBehindWindow(int milliseconds)
 {
-  killTimer(m_sessionTimer);
+  m_writeBehindWindow = qMax(0, milliseconds);
+  if (m_writeBehindWindow == 0)
+  {
+    flushPendingWrites();
+  }
+}
 
-  // Securely clear all sensitive data
-  for (VaultEntry &entry : m_entries)
+void VaultManager::flushPendingWrites()
+{
+  if (m_writeBehindTimer)
   {
-    entry.clearSensitiveData();
+    killTimer(m_writeBehindTimer);
+    m_writeBehindTimer = 0;
   }
 
-  // Implementation for closing the vault
-  m_decrypted.fill(0);
-  m_decrypted.clear();
-  m_entries.clear();
-  m_filePath.clear();
+  try
+  {
+    writePendingRecords();
+  }
+  catch (const std::exception &e)
+  {
+    reportWriteFailure(e.what());
+  }
+}
 
-  // Securely clear cryptographic keys
-  m_vaultSessionKey.fill(0);
-  m_vaultSessionKey.clear();
-  m_passwordMasterKey.fill(0);
-  m_passwordMasterKey.clear();
+void VaultManager::writePendingRecords()
+{
+  TRACE_SPAN("vault", "VaultManager::writePendingRecords");
+  // Appends stay in order: the running flush lands first
+  collectFlush();
+  if (m_pendingRecords.isEmpty())
+  {
+    return;
+  }
 
-  m_isVaultOpen = false;
+  QElapsedTimer timer;
+  timer.start();
+  m_journal.append(m_pendingRecords);
+  recordCommitLatency(timer.nsecsElapsed());
 
-  // ✅ Emit signal that vault was closed
-  emit vaultClosed("manual");
+  m_pendingRecords.clear();
+  m_pendingBytes = 0;
+  startCompactionIfNeeded();
 }
 
-VaultManager::~VaultManager()
+void VaultManager::startFlush()
+{
+  if (m_pendingRecords.isEmpty() || m_flushWatcher.isRunning() || !m_journal.isAttached())
+  {
+    return;
+  }
+
+  // The worker owns the journal until collectFlush, the GUI thread only queues records meanwhile
+  m_flushingRecords = std::move(m_pendingRecords);
+  m_pendingRecords.clear();
+  m_pendingBytes = 0;
+
+  m_flushWatcher.setFuture(QtConcurrent::run(
+      [journal = &m_journal, records = m_flushingRecords]()
+      {
+        FlushResult result;
+        QElapsedTimer timer;
+        timer.start();
+        try
+        {
+          journal->append(records);
+        }
+        catch (const std::exception &e)
+        {
+          result.error = QString::fromUtf8(e.what());
+        }
+        result.nanoseconds = timer.nsecsElapsed();
+        return result;
+      }));
+}
+
+void VaultManager::collectFlush()
 {
-  closeVault();
+  TRACE_SPAN("vault", "VaultManager::collectFlush");
+  if (m_flushingRecords.isEmpty())
+  {
+    return;
+  }
+
+  m_flushWatcher.waitForFinished();
+  FlushResult result = m_flushWatcher.future().result();
+  if (result.error.isEmpty())
+  {
+    recordCommitLatency(result.nanoseconds);
+  }
+  else
+  {
+    // Keep the records ahead of the newer ones and try again with the next write
+    for (const VaultJournal::Record &record : std::as_const(m_flushingRecords))
+    {
+      m_pendingBytes += record.entry.username.size() * 3 + record.entry.encryptedPassword.size();
+    }
+    m_pendingRecords = m_flushingRecords + m_pendingRecords;
+    m_flushingRecords.clear();
+    reportWriteFailure(result.error);
+    return;
+  }
+  m_flushingRecords.clear();
 }
 
-QList<VaultEntry> VaultManager::getEntries() const
+void VaultManager::onFlushFinished()
 {
-  return m_entries;
+  // Already collected if a synchronous flush waited for it
+  if (m_flushingRecords.isEmpty())
+  {
+    return;
+  }
+
+  collectFlush();
+  startCompactionIfNeeded();
+
+  if (!m_pendingRecords.isEmpty() && !m_writeBehindTimer)
+  {
+    m_writeBehindTimer = startTimer(m_writeBehindWindow > 0 ? m_writeBehindWindow : WRITE_BEHIND_WINDOW);
+  }
 }
 
-void VaultManager::loadEntries(QByteArray decryptedData)
+void VaultManager::setDurability(FileUtils::Durability durability)
 {
-  QJsonDocument doc = QJsonDocument::fromJson(decryptedData);
-  if (doc.isArray())
+  // The journal is not touched while a flush owns it
+  collectFlush();
+  m_durability = durability;
+  m_journal.setSyncWrites(durability != FileUtils::Durability::Relaxed);
+
+  // Strict commits do not wait for a window
+  if (durability == FileUtils::Durability::Strict)
+  {
+    flushPendingWrites();
+  }
+}
+
+CommitLatencyStats VaultManager::commitLatencyStats(FileUtils::Durability durability) const
+{
+  return m_commitLatency[static_cast<int>(durability)];
+}
+
+void VaultManager::recordCommitLatency(qint64 nanoseconds)
+{
+  Metrics::recordLatency(Metrics::Operation::Commit, nanoseconds);
+  CommitLatencyStats &stats = m_commitLatency[static_cast<int>(m_durability)];
+  ++stats.commits;
+  stats.totalNanoseconds += nanoseconds;
+  stats.maxNanoseconds = qMax(stats.maxNanoseconds, nanoseconds);
+}
+
+void VaultManager::startCompactionIfNeeded()
+{
+  if (m_journal.size() > JOURNAL_COMPACTION_THRESHOLD && !m_journal.isRollingOver())
+  {
+    startCompaction();
+  }
+}
+
+void VaultManager::encryptEntries(QList<VaultEntry> &entries, QByteArrayView passwordKey)
+{
+  TRACE_SPAN("vault", "VaultManager::encryptEntries");
+  // Every entry derives its own subkey, so the entries are independent and
+  // spread across the cores of the global thread pool
+  std::atomic<bool> failed = false;
+  QtConcurrent::blockingMap(entries,
+                            [&passwordKey, &failed](VaultEntry &entry)
+                            {
+                              if (entry.isEncrypted())
+                              {
+                                return;
+                              }
+                              try
+                              {
+                                entry.encryptPassword(passwordKey);
+                              }
+                              catch (const CryptoUtils::CryptoOperationError &e)
+                              {
+                                qWarning() << "Failed to encrypt entry" << entry.username << ":" << e.what();
+                                failed = true;
+                              }
+                            });
+
+  if (failed)
   {
-    QJsonArray array = doc.array();
-    for (const QJsonValue &value : array)
+    for (VaultEntry &entry : entries)
     {
-      if (value.isObject())
-      {
-        QJsonObject obj = value.toObject();
-        QString username = obj.value("username").toString();
+      entry.clearSensitiveData();
+    }
+    throw CryptoUtils::CryptoOperationError("Failed to encrypt batch entries");
+  }
+}
+
+void VaultManager::startCompaction()
+{
+  quint64 nextGeneration = m_journal.generation() + 1;
 
-        // Check for new format (encrypted password)
-        if (obj.contains("encryptedPassword"))
+  // Records appended from now on also go to the journal of the new snapshot
+  m_journal.beginRollover(nextGeneration);
+
+  QFuture<CompactionResult> future = QtConcurrent::run(
+      [filePath = m_filePath, rootKey = m_vaultRootKey, entries = m_entries, nextGeneration]()
+      {
+        CompactionResult result;
+        result.tempPath = filePath + ".compact";
+        result.entries = entries;
+        try
         {
-          QByteArray encryptedPassword = QByteArray::fromBase64(obj.value("encryptedPassword").toString().toUtf8());
-          VaultEntry entry;
-          entry.username = username;
-          entry.encryptedPassword = encryptedPassword;
-          m_entries.append(entry);
+          result.locations = writeSnapshot(filePath, result.tempPath, rootKey, entries, nextGeneration);
+          result.ok = true;
         }
-      }
+        catch (const std::exception &e)
+        {
+          qWarning() << "Journal compaction failed:" << e.what();
+        }
+        return result;
+      });
+
+  m_compactionWatcher.setFuture(future);
+}
+
+void VaultManager::finishCompaction()
+{
+  // The journal may still be written by a flush
+  collectFlush();
+
+  if (!m_journal.isRollingOver())
+  {
+    return;
+  }
+
+  m_compactionWatcher.waitForFinished();
+  CompactionResult result = m_compactionWatcher.future().result();
+
+  try
+  {
+    if (result.ok)
+    {
+      // Swap the snapshot in here rather than on the worker, so blocks read on
+      // demand never see the new file with old locations. The journal continuing
+      // it has to hold every record first
+      m_journal.catchUpRollover();
+      FileUtils::replaceVault(result.tempPath, m_filePath, m_durability != FileUtils::Durability::Relaxed);
+      m_journal.commitRollover();
+      applyBlockLocations(result.entries, result.locations, false);
     }
+    else
+    {
+      m_journal.abortRollover();
+    }
+  }
+  catch (const std::exception &e)
+  {
+    qWarning() << "Failed to finish journal compaction:" << e.what();
+    QFile::remove(result.tempPath);
+    m_journal.abortRollover();
   }
 }
 
-void VaultManager::addEntry(const VaultEntry &entry)
+void VaultManager::changeMasterPassword(const QString &currentPassword, const QString &newPassword)
 {
-  // Create a copy to encrypt
-  VaultEntry encryptedEntry = entry;
-
-  // Encrypt the password if it's not already encrypted
-  if (!encryptedEntry.isEncrypted())
+  if (!m_isVaultOpen || isChangingMasterPassword())
   {
-    encryptedEntry.encryptPassword(m_passwordMasterKey);
+    emit masterPasswordChangeFailed(tr("No vault open or a password change is already running"));
+    return;
+  }
+  if (newPassword.isEmpty())
+  {
+    emit masterPasswordChangeFailed(tr("The new password cannot be empty"));
+    return;
   }
 
-  // Add to our list
-  m_entries.append(encryptedEntry);
+  // The snapshot written by the worker continues the journal as it is on disk,
+  // and block locations must not move under it
+  flushPendingWrites();
+  finishCompaction();
 
-  // Save to disk
-  saveEntries(m_entries);
+  QFuture<RekeyedVault> future = QtConcurrent::run(
+      [filePath = m_filePath, rootKey = m_vaultRootKey, entries = m_entries, currentPassword, newPassword,
+       journalGeneration = m_journal.generation() + 1, mutationSerial = m_mutationSerial,
+       kdfTarget = m_kdfTargetMilliseconds, kdfBudget = m_kdfMemoryBudget](QPromise<RekeyedVault> &promise)
+      {
+        promise.setProgressRange(0, 100);
+        RekeyedVault rekeyed = rekeyVault(filePath, rootKey, entries, currentPassword, newPassword,
+                                          journalGeneration, kdfTarget, kdfBudget, promise);
+        rekeyed.mutationSerial = mutationSerial;
 
-  // ✅ Emit signal that entry was added
-  emit entryAdded(encryptedEntry);
+        // A cancelled promise refuses the result, nobody would remove the file then
+        if (!promise.addResult(rekeyed))
+        {
+          QFile::remove(rekeyed.tempPath);
+        }
+        rekeyed.clear();
+      });
+
+  m_rekeyWatcher.setFuture(future);
 }
 
-void VaultManager::saveEntries(QList<VaultEntry> entries)
+bool VaultManager::isChangingMasterPassword() const
 {
-  // Implementation for saving entries
-  QJsonArray array;
-  for (const VaultEntry &entry : entries)
+  return m_rekeyWatcher.isRunning();
+}
+
+void VaultManager::setKdfTarget(int milliseconds, quint64 memoryBudget)
+{
+  m_kdfTargetMilliseconds = milliseconds;
+  m_kdfMemoryBudget = memoryBudget;
+
+  // A vault prefetched before its creation was calibrated for the old target
+  dropPrefetch();
+}
+
+RekeyedVault VaultManager::rekeyVault(const QString &filePath, QByteArrayView rootKey, QList<VaultEntry> entries,
+                                      const QString &currentPassword, const QString &newPassword,
+                                      quint64 journalGeneration, int kdfTargetMilliseconds, quint64 kdfMemoryBudget,
+                                      QPromise<RekeyedVault> &promise)
+{
+  TRACE_SPAN("vault", "VaultManager::rekeyVault");
+  RekeyedVault rekeyed;
+  rekeyed.tempPath = filePath + ".rekey";
+  rekeyed.journalGeneration = journalGeneration;
+
+  SecureMemory::Buffer oldPasswordKey;
+  SecureMemory::Buffer newPasswordKey;
+
+  // Closing the vault cancels the change. Argon2 cannot be interrupted, so this
+  // is checked between the stages and between entries
+  auto throwIfCanceled = [&promise]()
+  {
+    if (promise.isCanceled())
+    {
+      throw CryptoUtils::CryptoOperationError("The vault was closed");
+    }
+  };
+
+  try
+  {
+    // Confirm the current password before anything is rewritten
+    FileUtils::KeyDerivation current = FileUtils::extractKeyDerivation(filePath);
+    SecureMemory::Buffer checkKey = CryptoUtils::deriveKeyFromPassword(currentPassword, current.salt, current.params);
+    bool matches = checkKey.size() == rootKey.size() &&
+                   sodium_memcmp(checkKey.constData(), rootKey.constData(), rootKey.size()) == 0;
+    if (!matches)
+    {
+      throw CryptoUtils::CryptoOperationError("The current password is incorrect");
+    }
+    throwIfCanceled();
+    promise.setProgressValue(30);
+
+    // A fresh salt, so the new root key shares nothing with the old one, and
+    // parameters recalibrated for the machine the password is changed on
+    FileUtils::KeyDerivation keyDerivation{FileUtils::generateSalt(),
+                                           CryptoUtils::calibrateKdf(kdfTargetMilliseconds, kdfMemoryBudget)};
+    throwIfCanceled();
+    rekeyed.rootKey = CryptoUtils::deriveKeyFromPassword(newPassword, keyDerivation.salt, keyDerivation.params);
+    throwIfCanceled();
+    promise.setProgressValue(60);
+
+    oldPasswordKey = CryptoUtils::expandRootKey(rootKey, CryptoUtils::RootSubkey::Password);
+    newPasswordKey = CryptoUtils::expandRootKey(rekeyed.rootKey, CryptoUtils::RootSubkey::Password);
+
+    // Entries are independent (one KDF subkey each), so the global pool spreads
+    // them across all cores and idle threads pick up the remaining entries
+    std::atomic<qsizetype> done = 0;
+    std::atomic<bool> failed = false;
+    const qsizetype total = entries.size();
+    QtConcurrent::blockingMap(entries,
+                              [&](VaultEntry &entry)
+                              {
+                                if (failed || promise.isCanceled())
+                                {
+                                  return;
+                                }
+                                try
+                                {
+                                  if (entry.isPayloadPending())
+                                  {
+                                    entry.encryptedPassword = FileUtils::readRecordBlock(filePath, rootKey, entry.id, entry.block);
+                                  }
+                                  entry.rekey(oldPasswordKey, newPasswordKey);
+                                  entry.block = FileUtils::BlockLocation();
+                                }
+                                catch (const std::exception &e)
+                                {
+                                  qWarning() << "Failed to re-key entry" << entry.username << ":" << e.what();
+                                  failed = true;
+                                }
+
+                                qsizetype count = ++done;
+                                promise.setProgressValue(60 + static_cast<int>(35 * count / total));
+                              });
+    if (failed)
+    {
+      throw CryptoUtils::CryptoOperationError("Failed to re-encrypt the vault entries");
+    }
+    throwIfCanceled();
+
+    // Every block is new, so the whole vault is streamed into the temporary file
+    rekeyed.locations = writeSnapshot(filePath, rekeyed.tempPath, rekeyed.rootKey, entries, journalGeneration,
+                                      keyDerivation);
+    rekeyed.entries = entries;
+    promise.setProgressValue(100);
+  }
+  catch (const std::exception &e)
+  {
+    QFile::remove(rekeyed.tempPath);
+    rekeyed.clear();
+    rekeyed.error = QString::fromUtf8(e.what());
+  }
+
+  for (VaultEntry &entry : entries)
+  {
+    entry.clearSensitiveData();
+  }
+  return rekeyed;
+}
+
+void VaultManager::onRekeyFinished()
+{
+  // Taking the result leaves no copy of the new root key in the future
+  QFuture<RekeyedVault> future = m_rekeyWatcher.future();
+  if (future.isCanceled() || future.resultCount() == 0)
+  {
+    emit masterPasswordChangeFailed(tr("The vault was closed while the password was being changed"));
+    return;
+  }
+  RekeyedVault rekeyed = future.takeResult();
+  if (!rekeyed.error.isEmpty())
+  {
+    emit masterPasswordChangeFailed(rekeyed.error);
+    return;
+  }
+
+  // The snapshot is only valid for the vault state it was taken from
+  if (!m_isVaultOpen || rekeyed.mutationSerial != m_mutationSerial)
+  {
+    QFile::remove(rekeyed.tempPath);
+    rekeyed.clear();
+    emit masterPasswordChangeFailed(tr("The vault changed while the password was being changed"));
+    return;
+  }
+
+  try
   {
-    QJsonObject obj;
-    obj["username"] = entry.username;
-    // Store encrypted password as base64 string
-    obj["encryptedPassword"] = QString::fromUtf8(entry.encryptedPassword.toBase64());
-    array.append(obj);
+    finishCompaction();
+    FileUtils::replaceVault(rekeyed.tempPath, m_filePath, m_durability != FileUtils::Durability::Relaxed);
   }
+  catch (const std::exception &e)
+  {
+    QFile::remove(rekeyed.tempPath);
+    rekeyed.clear();
+    emit masterPasswordChangeFailed(QString::fromUtf8(e.what()));
+    return;
+  }
+
+  // The old journal has an older generation than the new snapshot, so it is
+  // stale even if the process dies before the fresh journal is written
+  m_journal.detach();
+  killTimer(m_sessionTimer);
+  startSession(rekeyed.rootKey);
+  m_journal.attach(m_filePath, m_vaultRootKey, rekeyed.journalGeneration, VaultJournal::ReplayResult());
 
-  QJsonDocument doc(array);
-  FileUtils::updateVault(m_filePath, m_vaultSessionKey, doc.toJson());
+  m_entries = rekeyed.entries;
+  rebuildIndex();
+  m_secretCache.clear();
+  applyBlockLocations(rekeyed.entries, rekeyed.locations, true);
+  rekeyed.clear();
+  emit entriesReset();
+
+  emit masterPasswordChanged();
 }
 
-void VaultManager::startSession(const QString &password)
+void VaultManager::startSession(QByteArrayView rootKey)
 {
-  QByteArray vaultSalt = FileUtils::extractSalt(m_filePath);
+  // Assigning releases the previous keys, which wipes them
+  m_vaultRootKey = SecureMemory::Buffer(rootKey);
+
+  // Expand an independent master key for password encryption/decryption
+  m_passwordMasterKey = CryptoUtils::expandRootKey(rootKey, CryptoUtils::RootSubkey::Password);
 
-  // Derive session key for vault operations
-  m_vaultSessionKey = CryptoUtils::deriveKeyFromPassword(password, vaultSalt);
+  m_sessionTimer = startTimer(SESSION_TIMEOUT);
+  m_isVaultOpen = true;
+}
 
+SecureMemory::Buffer VaultManager::deriveLegacyPasswordKey(const QString &password, const QByteArray &vaultSalt)
+{
   // Create a separate salt for password encryption to ensure key independence
   // We need a deterministic but different salt, so we'll derive it from the vault salt
   QByteArray passwordSaltBase = vaultSalt + QByteArray("PASSWORD_ENCRYPTION", 18);
@@ -157,11 +1441,7 @@ void VaultManager::startSession(const QString &password)
   // Hash the combined data to create a proper salt
   QByteArray passwordSalt = QCryptographicHash::hash(passwordSaltBase, QCryptographicHash::Sha256).left(crypto_pwhash_SALTBYTES);
 
-  // Derive a separate master key for password encryption/decryption using independent salt
-  m_passwordMasterKey = CryptoUtils::deriveKeyFromPassword(password, passwordSalt);
-
-  m_sessionTimer = startTimer(SESSION_TIMEOUT);
-  m_isVaultOpen = true;
+  return CryptoUtils::deriveKeyFromPassword(password, passwordSalt);
 }
 
 void VaultManager::extendSession()
@@ -181,76 +1461,138 @@ void VaultManager::timerEvent(QTimerEvent *event)
     qDebug() << "Session timed out";
     closeVault();
   }
+  else if (event->timerId() == m_writeBehindTimer)
+  {
+    killTimer(m_writeBehindTimer);
+    m_writeBehindTimer = 0;
+    startFlush();
+  }
+  else if (event->timerId() == m_secretCacheTimer)
+  {
+    m_secretCache.purgeExpired();
+    if (m_secretCache.size() == 0)
+    {
+      killTimer(m_secretCacheTimer);
+      m_secretCacheTimer = 0;
+    }
+  }
   QObject::timerEvent(event);
 }
 
-QString VaultManager::getPasswordSecure(const QString &username)
+QString VaultManager::getPasswordSecure(EntryId id)
 {
+  TRACE_SPAN("vault", "VaultManager::getPasswordSecure");
   // Extend session when accessing sensitive data
   extendSession();
 
   // Find the entry and decrypt its password on demand
-  for (const VaultEntry &entry : m_entries)
+  auto it = m_index.constFind(id);
+  if (it == m_index.constEnd())
   {
-    if (entry.username == username)
-    {
-      try
-      {
-        QString decryptedPassword = entry.decryptPassword(m_passwordMasterKey);
+    qWarning() << "Entry not found:" << id;
+    return QString(); // Entry not found
+  }
 
-        // Note: The caller is responsible for securely handling the returned password
-        // Consider using it immediately and not storing it in variables
-        return decryptedPassword;
-      }
-      catch (const CryptoUtils::CryptoOperationError &e)
-      {
-        qWarning() << "Failed to decrypt password for" << username << ":" << e.what();
-        return QString();
-      }
-    }
+  // A reveal followed by a copy decrypts only once
+  QString cachedPassword = m_secretCache.find(id);
+  if (!cachedPassword.isNull())
+  {
+    Metrics::increment(Metrics::Counter::SecretCacheHits);
+    return cachedPassword;
   }
+  Metrics::increment(Metrics::Counter::SecretCacheMisses);
 
-  qWarning() << "Entry not found:" << username;
-  return QString(); // Entry not found
-}
+  VaultEntry &entry = m_entries[it.value()];
 
-void VaultManager::removeEntry(const QString &username)
-{
-  for (int i = 0; i < m_entries.size(); ++i)
+  try
   {
-    if (m_entries[i].username == username)
-    {
-      // Securely clear the entry before removal
-      m_entries[i].clearSensitiveData();
-      m_entries.removeAt(i);
+    // Segmented vaults read the record block on first access
+    loadPayload(entry);
 
-      // Save updated entries
-      saveEntries(m_entries);
-      return;
+    QString decryptedPassword = entry.decryptPassword(m_passwordMasterKey);
+    m_secretCache.insert(id, decryptedPassword);
+    if (!m_secretCacheTimer)
+    {
+      m_secretCacheTimer = startTimer(SECRET_CACHE_PURGE_INTERVAL);
     }
+
+    // Note: The caller is responsible for securely handling the returned password
+    // Consider using it immediately and not storing it in variables
+    return decryptedPassword;
+  }
+  catch (const std::exception &e)
+  {
+    qWarning() << "Failed to decrypt password for" << entry.username << ":" << e.what();
+    return QString();
+  }
+}
+
+void VaultManager::removeEntry(EntryId id)
+{
+  TRACE_SPAN("vault", "VaultManager::removeEntry");
+  Metrics::ScopedLatency latency(Metrics::Operation::Remove);
+  auto it = m_index.constFind(id);
+  if (it == m_index.constEnd())
+  {
+    qWarning() << "Entry not found for removal:" << id;
+    return;
   }
 
-  qWarning() << "Entry not found for removal:" << username;
+  qsizetype row = it.value();
+  qsizetype movedFromRow = eraseRow(row);
+
+  // Record the removal in the journal
+  commitMutation({VaultJournal::Operation::Remove, id, VaultEntry()});
+
+  emit entryRemoved(id, row, movedFromRow);
 }
 
-void VaultManager::updateEntry(const QString &username, const QString &newPassword)
+qsizetype VaultManager::eraseRow(qsizetype row)
 {
-  for (VaultEntry &entry : m_entries)
+  qsizetype lastRow = m_entries.size() - 1;
+  EntryId id = m_entries[row].id;
+
+  // Securely clear the entry before removal
+  m_entries[row].clearSensitiveData();
+
+  // Move the last entry into the gap so removal stays constant time
+  if (row != lastRow)
   {
-    if (entry.username == username)
-    {
-      // Clear old sensitive data
-      entry.clearSensitiveData();
+    m_entries.swapItemsAt(row, lastRow);
+    m_index[m_entries[row].id] = row;
+  }
+  m_entries.removeLast();
+  m_index.remove(id);
+  m_searchIndex.remove(id);
+  m_secretCache.remove(id);
 
-      // Set new password and encrypt it
-      entry.password = newPassword;
-      entry.encryptPassword(m_passwordMasterKey);
+  return row != lastRow ? lastRow : -1;
+}
 
-      // Save updated entries
-      saveEntries(m_entries);
-      return;
-    }
+void VaultManager::updateEntry(EntryId id, const QString &newPassword)
+{
+  TRACE_SPAN("vault", "VaultManager::updateEntry");
+  Metrics::ScopedLatency latency(Metrics::Operation::Update);
+  auto it = m_index.constFind(id);
+  if (it == m_index.constEnd())
+  {
+    qWarning() << "Entry not found for update:" << id;
+    return;
   }
 
-  qWarning() << "Entry not found for update:" << username;
+  qsizetype row = it.value();
+  VaultEntry &entry = m_entries[row];
+
+  // Clear old sensitive data
+  entry.clearSensitiveData();
+  m_secretCache.remove(id);
+
+  // Set new password and encrypt it
+  entry.password = newPassword;
+  entry.encryptPassword(m_passwordMasterKey);
+
+  // Record the update in the journal
+  commitMutation({VaultJournal::Operation::Put, id, entry});
+
+  emit entryUpdated(id, row);
 }
@@ -3,145 +3,300 @@
 
 #include <QString>
 #include <QList>
+#include <QHash>
 #include <QObject>
 #include <QTimerEvent>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QPromise>
 #include <sodium.h>
-#include "../crypto/cryptoutils.h"
-#include "../utils/fileutils.h"
+#include "vaultentry.h"
+#include "vaultjournal.h"
+#include "searchindex.h"
+#include "secretcache.h"
+#include "../utils/metrics.h"
 
-struct VaultEntry
+/**
+ * @brief Result of the unlock pipeline
+ * Produced off the GUI thread by VaultManager::unlockVault and applied on it
+ */
+struct UnlockedVault
 {
-  QString username;
-  QString password;             // Temporary plaintext storage - will be cleared after encryption
-  QByteArray encryptedPassword; // Binary encrypted storage with individual salt
+  QString filePath;
+  SecureMemory::Buffer rootKey;
+  QList<VaultEntry> entries;
+  quint64 journalGeneration = 0;     // Generation of the journal that continues the snapshot
+  VaultJournal::ReplayResult journal; // Journal records already applied to entries
+  bool needsSave = false;             // Entries were migrated and must be written back
+  SearchIndex searchIndex;            // Index over the final entries, built off the GUI thread
+  QString error;          // Set instead of throwing when run asynchronously
 
   /**
-   * @brief Encrypts the plaintext password with military-grade security
-   * Each password gets its own unique salt for maximum security
-   * @param masterKey The derived master key (QByteArray) for encryption
+   * @brief Securely clear the key material
    */
-  void encryptPassword(const QByteArray &masterKey)
+  void clear()
   {
-    if (password.isEmpty())
-    {
-      throw CryptoUtils::CryptoOperationError("Cannot encrypt empty password");
-    }
-
-    // Generate a unique salt for this specific password entry
-    QByteArray individualSalt = FileUtils::generateSalt();
+    rootKey.clear();
+    entries.clear();
+    journal.records.clear();
+    searchIndex.clear();
+  }
+};
 
-    // Use the master key directly with the individual salt for key derivation
-    // This creates a unique key for each password without storing the master password
-    QByteArray derivedKey = CryptoUtils::deriveKeyFromPassword(QString::fromUtf8(masterKey), individualSalt);
+/**
+ * @brief Cost of the commits made under one durability mode
+ * A commit is one journal write, including its fsync if the mode asks for one,
+ * or one full snapshot written by saveVault
+ */
+struct CommitLatencyStats
+{
+  qint64 commits = 0;
+  qint64 totalNanoseconds = 0;
+  qint64 maxNanoseconds = 0;
 
-    QByteArray nonce, ciphertext;
+  qint64 averageNanoseconds() const { return commits ? totalNanoseconds / commits : 0; }
+};
 
-    try
-    {
-      CryptoUtils::encrypt(password.toUtf8(), derivedKey, ciphertext, nonce);
-    }
-    catch (const CryptoUtils::CryptoOperationError &e)
-    {
-      // Clear sensitive data before throwing
-      derivedKey.fill(0);
-      throw;
-    }
+/**
+ * @brief Outcome of a background journal write
+ */
+struct FlushResult
+{
+  QString error;          // Empty if the records were written
+  qint64 nanoseconds = 0; // Time the write and its fsync took
+};
 
-    // Store format: individual_salt (16 bytes) + nonce (24 bytes) + ciphertext
-    encryptedPassword = individualSalt + nonce + ciphertext;
+/**
+ * @brief Result of a background snapshot written by journal compaction
+ */
+struct CompactionResult
+{
+  bool ok = false;
+  QString tempPath;                           // Fully written snapshot, renamed over the vault on the GUI thread
+  QList<VaultEntry> entries;                  // Entries as captured when the compaction started
+  QList<FileUtils::BlockLocation> locations;  // Where their record blocks ended up in the new file
+};
 
-    // Securely clear sensitive data from memory
-    clearSensitiveData();
-    derivedKey.fill(0);
-  }
+/**
+ * @brief Result of the master password change pipeline
+ * Produced off the GUI thread by VaultManager::rekeyVault and applied on it
+ */
+struct RekeyedVault
+{
+  QString tempPath;                          // Re-encrypted vault, renamed over the vault on the GUI thread
+  SecureMemory::Buffer rootKey;              // Root key derived from the new password and salt
+  QList<VaultEntry> entries;                 // Entries encrypted under the new password key
+  QList<FileUtils::BlockLocation> locations; // Where their record blocks ended up in the new file
+  quint64 journalGeneration = 0;             // Generation stored in the new snapshot
+  quint64 mutationSerial = 0;                // Mutation count the snapshot was taken at
+  QString error;                             // Set instead of throwing, the pipeline runs asynchronously
 
   /**
-   * @brief Decrypts the password on-demand with military-grade security
-   * @param masterKey The derived master key (QByteArray) for decryption
-   * @return Decrypted password as QString
+   * @brief Securely clear the key material and entries
    */
-  QString decryptPassword(const QByteArray &masterKey) const
+  void clear()
   {
-    if (encryptedPassword.isEmpty())
+    rootKey.clear();
+    for (VaultEntry &entry : entries)
     {
-      throw CryptoUtils::CryptoOperationError("No encrypted password data");
+      entry.clearSensitiveData();
     }
+    entries.clear();
+  }
+};
 
-    // Parse encrypted data format: individual_salt + nonce + ciphertext
-    const int SALT_SIZE = crypto_pwhash_SALTBYTES;                       // crypto_pwhash_SALTBYTES
-    const int NONCE_SIZE = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES; // crypto_aead_xchacha20poly1305_ietf_NPUBBYTES
+class VaultManager : public QObject
+{
+  Q_OBJECT
 
-    if (encryptedPassword.size() < SALT_SIZE + NONCE_SIZE)
-    {
-      throw CryptoUtils::CryptoOperationError("Invalid encrypted password format");
-    }
+public:
+  VaultManager();
+  ~VaultManager();
 
-    QByteArray individualSalt = encryptedPassword.left(SALT_SIZE);
-    QByteArray nonce = encryptedPassword.mid(SALT_SIZE, NONCE_SIZE);
-    QByteArray ciphertext = encryptedPassword.mid(SALT_SIZE + NONCE_SIZE);
+  /**
+   * @brief Open the vault on the calling thread
+   * The vault is locked against other processes (see FileUtils::lockVault) from
+   * before it is read until closeVault
+   * @throws FileOperationError if another process has the vault open or it cannot be read
+   * @throws CryptoOperationError if the password is wrong
+   */
+  void openVault(const QString &filePath, const QString &password);
 
-    // Use the same key derivation as during encryption
-    QByteArray derivedKey = CryptoUtils::deriveKeyFromPassword(QString::fromUtf8(masterKey), individualSalt);
+  /**
+   * @brief Open the vault without blocking the calling thread
+   * Key derivation, file I/O, decryption and parsing run on the global thread pool.
+   * Progress is reported through unlockProgress, the outcome through vaultOpened,
+   * vaultOpenFailed or vaultOpenCanceled. A vault another process has open fails
+   * through vaultOpenFailed as well
+   * @param filePath Path to the vault file
+   * @param password Master password
+   * @return Future of the unlock, cancelling it has the same effect as cancelOpenVault
+   */
+  QFuture<UnlockedVault> openVaultAsync(const QString &filePath, const QString &password);
 
-    QByteArray decrypted;
+  /**
+   * @brief Cancel an unlock started with openVaultAsync
+   * Takes effect at the next pipeline stage, nothing is applied to the manager
+   */
+  void cancelOpenVault();
+  bool isUnlocking() const;
 
-    try
-    {
-      CryptoUtils::decrypt(ciphertext, derivedKey, nonce, decrypted);
-    }
-    catch (const CryptoUtils::CryptoOperationError &e)
-    {
-      derivedKey.fill(0);
-      throw;
-    }
+  /**
+   * @brief Get the vault file ready for an unlock while the password is still being typed
+   * Maps, validates and faults in the file and reads its key derivation header on
+   * the thread pool (see FileUtils::prepareVault). A vault that does not exist yet
+   * gets its password hash calibrated here. The next unlock of filePath then starts
+   * with the password hash, unless the file changed in between
+   * @param filePath Path to the vault file the login screen is for
+   */
+  void prefetchVault(const QString &filePath);
 
-    QString result = QString::fromUtf8(decrypted);
+  /**
+   * @brief Write a full snapshot of the open vault and start a fresh journal
+   * Mutations are journaled as they happen, this folds the journal into the vault file
+   */
+  void saveVault();
 
-    // Securely clear sensitive data from memory
-    decrypted.fill(0);
-    derivedKey.fill(0);
+  /**
+   * @brief Coalesce mutations into one background journal write per window
+   * Mutations apply in memory at once, their journal records are written by a
+   * worker thread when the window closes. Records are authenticated and replayed
+   * in order, so a crash loses at most the last window but never tears the vault
+   * @param milliseconds Length of the window, 0 writes every mutation through on the calling thread
+   */
+  void setWriteBehindWindow(int milliseconds);
 
-    return result;
-  }
+  /**
+   * @brief Write every pending mutation to the journal and wait until it is written
+   * Runs on close, on session timeout and at application exit. Failures are
+   * reported through writeFailed and the records stay pending
+   */
+  void flushPendingWrites();
 
   /**
-   * @brief Check if this entry contains encrypted password data
-   * @return true if password is encrypted, false otherwise
+   * @brief Choose how far commits are pushed to the disk (see FileUtils::Durability)
+   * Strict writes and fsyncs every mutation on the calling thread, Grouped
+   * (the default) fsyncs once per write-behind window, Relaxed never fsyncs
    */
-  bool isEncrypted() const { return !encryptedPassword.isEmpty(); }
+  void setDurability(FileUtils::Durability durability);
+  FileUtils::Durability durability() const { return m_durability; }
 
   /**
-   * @brief Securely clear all sensitive data from memory
-   * Call this when the entry is no longer needed
+   * @brief Commit latency measured while the given durability mode was active
    */
-  void clearSensitiveData()
-  {
-    password.fill(QChar(0));
-    password.clear();
-    // Note: We don't clear encryptedPassword as it's needed for storage
-  }
-};
+  CommitLatencyStats commitLatencyStats(FileUtils::Durability durability) const;
+  bool hasPendingWrites() const { return !m_pendingRecords.isEmpty() || !m_flushingRecords.isEmpty(); }
+  EntryId addEntry(const VaultEntry &entry);
+  void removeEntry(EntryId id);
+  void updateEntry(EntryId id, const QString &newPassword);
 
-class VaultManager : public QObject
-{
-  Q_OBJECT
+  /**
+   * @brief Add several entries at once (import, scripted provisioning)
+   * Passwords are encrypted in parallel on the thread pool and the batch is
+   * committed with a single write. Emits entryAdded per entry, then entriesChanged once.
+   * A failed write does not throw, it is reported through writeFailed and retried
+   * @return Ids of the added entries, in the order of entries
+   * @throws CryptoUtils::CryptoOperationError if any entry cannot be encrypted, nothing is added then
+   * @throws FileUtils::FileOperationError if a username exceeds VaultFormat::MaxUsernameSize, nothing is added then
+   */
+  QList<EntryId> addEntries(const QList<VaultEntry> &entries);
 
-public:
-  VaultManager();
-  ~VaultManager();
-  void openVault(const QString &filePath, const QString &password);
-  // void saveVault(const QString &filePath);
-  void addEntry(const VaultEntry &entry);
-  void removeEntry(const QString &username);
-  void updateEntry(const QString &username, const QString &newPassword);
+  /**
+   * @brief Replace the passwords of several entries at once
+   * Unknown ids are skipped. Encryption, commit and signal work as in addEntries
+   * @param newPasswords New password per entry id
+   */
+  void updateEntries(const QHash<EntryId, QString> &newPasswords);
+
+  /**
+   * @brief Remove several entries with a single write
+   * Unknown ids are skipped. Emits entryRemoved per entry, then entriesChanged once
+   */
+  void removeEntries(const QList<EntryId> &ids);
   QList<VaultEntry> getEntries() const;
+
+  /**
+   * @brief Change the master password without blocking the calling thread
+   * Checks the current password, derives the new root key, re-encrypts every
+   * entry on the global thread pool and writes the result to a temporary file
+   * that replaces the vault atomically. Progress is reported through
+   * masterPasswordChangeProgress, the outcome through masterPasswordChanged or
+   * masterPasswordChangeFailed. Mutations made while it runs fail the change,
+   * closing the vault cancels it without waiting for the worker
+   * @param currentPassword The master password the vault is unlocked with
+   * @param newPassword The new master password
+   */
+  void changeMasterPassword(const QString &currentPassword, const QString &newPassword);
+  bool isChangingMasterPassword() const;
+
+  /**
+   * @brief Unlock latency and memory budget the password hash is calibrated for
+   * Applies to vaults created and passwords changed afterwards, existing vaults
+   * keep the parameters stored in their header
+   * @param milliseconds Target unlock latency
+   * @param memoryBudget Upper bound for the Argon2 memory in bytes
+   */
+  void setKdfTarget(int milliseconds, quint64 memoryBudget);
+
+  /**
+   * @brief Look up an entry by id in constant time
+   * @return Pointer to the entry, or nullptr if there is none. Invalidated by mutations
+   */
+  const VaultEntry *findEntry(EntryId id) const;
+
+  /**
+   * @brief Number of entries in the store, for models that read it row by row
+   */
+  qsizetype entryCount() const { return m_entries.size(); }
+
+  /**
+   * @brief Entry at a position of the store, valid for 0 <= row < entryCount()
+   * Positions change when entries are removed, keep ids to track an entry
+   */
+  const VaultEntry &entryAt(qsizetype row) const { return m_entries.at(row); }
+
+  /**
+   * @brief Position of an entry in the store in constant time
+   * @return Row of the entry, or -1 if there is none
+   */
+  qsizetype rowOf(EntryId id) const { return m_index.value(id, -1); }
+
+  /**
+   * @brief Find entries by username, ignoring case, for as-you-type search
+   * @param query Text the username has to contain, an empty query matches nothing
+   * @param limit Maximum number of results, -1 for all
+   * @return Matching entry ids, best match first (see SearchIndex)
+   */
+  QList<EntryId> searchEntries(const QString &query, qsizetype limit = -1) const
+  {
+    return m_searchIndex.search(query, limit);
+  }
   bool isVaultOpen() const { return m_isVaultOpen; }
-  void closeVault();
-  void startSession(const QString &password);
+
+  /**
+   * @brief Write what is still pending, then wipe the keys and entries
+   * Pending mutations the journal cannot take are written as a full snapshot.
+   * If that fails too the vault stays open, nothing committed is dropped, and
+   * the failure is reported through writeFailed
+   * @return true if the vault was closed
+   */
+  bool closeVault();
+  void startSession(QByteArrayView rootKey);
   void extendSession();
 
   // Method to get password securely with automatic memory clearing
-  QString getPasswordSecure(const QString &username);
+  // Recently decrypted passwords are answered from a short-lived cache (see SecretCache)
+  QString getPasswordSecure(EntryId id);
+
+  /**
+   * @brief Hit, miss and eviction counters of the decrypted password cache
+   */
+  SecretCacheStats secretCacheStats() const { return m_secretCache.stats(); }
+
+  /**
+   * @brief Latency percentiles of the vault operations and process wide counters (see Metrics)
+   */
+  Metrics::Snapshot metricsSnapshot() const { return Metrics::snapshot(); }
 
 signals:
   /**
@@ -158,19 +313,155 @@ signals:
 
   /**
    * @brief Emitted when a new entry is added to the vault
-   * @param entry The entry that was added
+   * @param id Id of the new entry
+   * @param row Row of the entry in the store (see entryAt), always appended at the end
+   */
+  void entryAdded(EntryId id, qsizetype row);
+
+  /**
+   * @brief Emitted when the password of an entry was replaced, its row is unchanged
+   */
+  void entryUpdated(EntryId id, qsizetype row);
+
+  /**
+   * @brief Emitted when an entry was removed, after it left the store
+   * Removal is constant time: the last entry moves into the freed row, so the
+   * store order is not a display order. Views keep their own list of the ids
+   * they announced and remove by id (see PasswordTableModel)
+   * @param id Id of the removed entry
+   * @param row Row the entry occupied
+   * @param movedFromRow Row the entry now at row came from, -1 if the removed entry was the last one
+   */
+  void entryRemoved(EntryId id, qsizetype row, qsizetype movedFromRow);
+
+  /**
+   * @brief Emitted when the whole store was replaced (vault opened or closed, master password changed)
+   * Row based views have to re-read every row
+   */
+  void entriesReset();
+
+  /**
+   * @brief Emitted once after a batch call (addEntries, updateEntries, removeEntries),
+   * after the per-entry signals
+   */
+  void entriesChanged();
+
+  /**
+   * @brief Emitted when committed mutations could not be written to disk
+   * The mutations stay applied in memory and pending, they are written again
+   * with the next write-behind window
+   * @param error Description of the failure
+   */
+  void writeFailed(const QString &error);
+
+  /**
+   * @brief Emitted while a master password change is running
+   * @param percent Progress of the re-key pipeline from 0 to 100
+   */
+  void masterPasswordChangeProgress(int percent);
+
+  /**
+   * @brief Emitted once the vault is stored under the new master password
+   */
+  void masterPasswordChanged();
+
+  /**
+   * @brief Emitted when a master password change fails, the vault is left unchanged
+   * @param error Description of the failure
+   */
+  void masterPasswordChangeFailed(const QString &error);
+
+  /**
+   * @brief Emitted while an asynchronous unlock is running
+   * @param percent Progress of the unlock pipeline from 0 to 100
+   */
+  void unlockProgress(int percent);
+
+  /**
+   * @brief Emitted when an asynchronous unlock fails (e.g. wrong password)
+   * @param error Description of the failure
+   */
+  void vaultOpenFailed(const QString &error);
+
+  /**
+   * @brief Emitted when an asynchronous unlock was cancelled
    */
-  void entryAdded(const VaultEntry &entry);
+  void vaultOpenCanceled();
 
 private:
-  QByteArray m_vaultSessionKey;   // For vault operations
-  QByteArray m_passwordMasterKey; // Derived key for password encryption (no plaintext password stored)
+  SecureMemory::Buffer m_vaultRootKey;      // Root key from the single password derivation, vault file key is expanded from it
+  SecureMemory::Buffer m_passwordMasterKey; // Expanded from the root key for password encryption (no plaintext password stored)
   int m_sessionTimer;
   QString m_filePath;
-  QByteArray m_decrypted;
-  QList<VaultEntry> m_entries; // List of username-password pairs
+  std::shared_ptr<QLockFile> m_vaultLock; // Keeps other processes from writing the vault, from unlock until close
+  QString m_vaultLockPath;                // Vault m_vaultLock belongs to
+  QList<VaultEntry> m_entries;        // List of username-password pairs
+  QHash<EntryId, qsizetype> m_index; // Entry id -> position in m_entries, kept in sync on every mutation
+  SearchIndex m_searchIndex;          // Usernames of m_entries, kept in sync on every mutation
+  SecretCache m_secretCache;          // Recently decrypted passwords, wiped on close, timeout and password change
+  int m_secretCacheTimer = 0;         // Purges expired secrets while the cache is not empty
   bool m_isVaultOpen = false;
-  void loadEntries(QByteArray decryptedData);
+  QFutureWatcher<UnlockedVault> m_unlockWatcher;
+  QFuture<FileUtils::PreparedVault> m_prefetch; // Started by prefetchVault, kept for retries after a wrong password
+  QString m_prefetchPath;                       // Vault m_prefetch belongs to, empty if there is none
+  VaultJournal m_journal;               // Mutations since the last snapshot
+  QFutureWatcher<CompactionResult> m_compactionWatcher; // Background snapshot that folds the journal in
+  QFutureWatcher<RekeyedVault> m_rekeyWatcher;          // Running master password change
+  quint64 m_mutationSerial = 0;                         // Bumped by every committed mutation
+  QList<VaultJournal::Record> m_pendingRecords;         // Committed mutations not yet handed to the journal
+  qint64 m_pendingBytes = 0;                            // Rough journal size of m_pendingRecords
+  QList<VaultJournal::Record> m_flushingRecords;        // Records the running flush writes, kept for a retry
+  QFutureWatcher<FlushResult> m_flushWatcher;           // Background journal write
+  int m_writeBehindWindow;                              // Coalescing window in milliseconds, 0 writes through
+  int m_writeBehindTimer = 0;                           // Closes the current window
+  FileUtils::Durability m_durability = FileUtils::Durability::Grouped;
+  CommitLatencyStats m_commitLatency[3];                // Indexed by FileUtils::Durability
+  int m_kdfTargetMilliseconds = CryptoUtils::KDF_TARGET_MILLISECONDS; // Calibration target for new vaults
+  quint64 m_kdfMemoryBudget = CryptoUtils::KDF_MEMORY_BUDGET;
+  static UnlockedVault unlockVault(const QString &filePath, const QString &password,
+                                   int kdfTargetMilliseconds, quint64 kdfMemoryBudget,
+                                   QPromise<UnlockedVault> *promise = nullptr,
+                                   const FileUtils::PreparedVault &prepared = FileUtils::PreparedVault());
+  FileUtils::PreparedVault waitForPrefetch(const QString &filePath);
+  void dropUnusablePrefetch();
+  void dropPrefetch();
+  void applyUnlockedVault(UnlockedVault &unlocked);
+  void onUnlockFinished();
+  static RekeyedVault rekeyVault(const QString &filePath, QByteArrayView rootKey, QList<VaultEntry> entries,
+                                 const QString &currentPassword, const QString &newPassword,
+                                 quint64 journalGeneration, int kdfTargetMilliseconds, quint64 kdfMemoryBudget,
+                                 QPromise<RekeyedVault> &promise);
+  void onRekeyFinished();
+  static QList<VaultEntry> loadEntries(const QByteArray &decryptedData, quint64 *outJournalGeneration = nullptr);
+  static QList<FileUtils::BlockLocation> writeSnapshot(const QString &filePath, const QString &targetPath,
+                                                      QByteArrayView rootKey, const QList<VaultEntry> &entries,
+                                                      quint64 journalGeneration,
+                                                      const FileUtils::KeyDerivation &keyDerivation = FileUtils::KeyDerivation());
+  void applyBlockLocations(const QList<VaultEntry> &written, const QList<FileUtils::BlockLocation> &locations,
+                           bool releasePayloads);
+  void loadPayload(VaultEntry &entry);
+  void commitMutation(const VaultJournal::Record &record);
+  void commitMutations(const QList<VaultJournal::Record> &records);
+  void reportWriteFailure(const QString &error);
+  bool writeCommittedMutations();
+  void releaseVault();
+  void lockVaultFile(const QString &filePath);
+  void unlockVaultFileIfUnused();
+  static void encryptEntries(QList<VaultEntry> &entries, QByteArrayView passwordKey);
+  void startFlush();
+  void collectFlush();
+  void onFlushFinished();
+  void writePendingRecords();
+  void startCompactionIfNeeded();
+  void recordCommitLatency(qint64 nanoseconds);
+  void startCompaction();
+  void finishCompaction();
+  static bool assignMissingIds(QList<VaultEntry> &entries);
+  void rebuildIndex();
+  qsizetype eraseRow(qsizetype row);
+  static bool migrateEntries(QList<VaultEntry> &entries, QByteArrayView passwordKey,
+                             QByteArrayView legacyPasswordKey);
+  static SecureMemory::Buffer deriveLegacyPasswordKey(const QString &password, const QByteArray &vaultSalt);
   void saveEntries(QList<VaultEntry> entries);
 
 protected:
@@ -0,0 +1,121 @@
+#include "../src/vault/vaultjournal.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QTest>
+#include <sodium.h>
+
+/**
+ * @brief Replay after a failed journal append
+ *
+ * A failed append is simulated by what it leaves on disk: bytes past the end
+ * of the last record (a short write, or a full write whose fsync failed), or a
+ * next journal that cannot be opened.
+ */
+class VaultJournalTest : public QObject
+{
+  Q_OBJECT
+
+private:
+  QTemporaryDir m_dir;
+  QByteArray m_rootKey = QByteArray(crypto_kdf_KEYBYTES, 'k');
+
+  QString vaultPath() const { return m_dir.filePath("vault.txt"); }
+
+  static VaultJournal::Record put(EntryId id)
+  {
+    VaultJournal::Record record;
+    record.id = id;
+    record.entry.id = id;
+    record.entry.username = QString("user%1").arg(id);
+    record.entry.encryptedPassword = QByteArray("blob") + QByteArray::number(id);
+    return record;
+  }
+
+  static QList<EntryId> replayedIds(const VaultJournal::ReplayResult &replay)
+  {
+    QList<EntryId> ids;
+    for (const VaultJournal::Record &record : replay.records)
+    {
+      ids.append(record.id);
+    }
+    return ids;
+  }
+
+  static void appendGarbage(const QString &path)
+  {
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Append));
+    QVERIFY(file.write(QByteArray(37, '\x5a')) == 37);
+  }
+
+  void attach(VaultJournal &journal, quint64 generation)
+  {
+    journal.setSyncWrites(false);
+    journal.attach(vaultPath(), m_rootKey, generation, VaultJournal::read(vaultPath(), generation, m_rootKey));
+  }
+
+private slots:
+  void initTestCase()
+  {
+    QVERIFY(sodium_init() >= 0);
+    QVERIFY(m_dir.isValid());
+  }
+
+  void cleanup()
+  {
+    QFile::remove(VaultJournal::pathFor(vaultPath()));
+    QFile::remove(VaultJournal::nextPathFor(vaultPath()));
+  }
+
+  void retryAfterTornAppendReplaysEveryRecord()
+  {
+    VaultJournal journal;
+    attach(journal, 1);
+    journal.append(put(1));
+
+    // The failed attempt wrote part of the batch and threw, the caller retries it
+    appendGarbage(VaultJournal::pathFor(vaultPath()));
+    journal.append(QList<VaultJournal::Record>{put(2), put(3)});
+    journal.append(put(4));
+
+    VaultJournal::ReplayResult replay = VaultJournal::read(vaultPath(), 1, m_rootKey);
+    QCOMPARE(replayedIds(replay), (QList<EntryId>{1, 2, 3, 4}));
+    QCOMPARE(replay.validSize, QFileInfo(VaultJournal::pathFor(vaultPath())).size());
+    QCOMPARE(journal.recordCount(), quint64(4));
+  }
+
+  void failedNextJournalDoesNotRepeatCurrentRecords()
+  {
+    VaultJournal journal;
+    attach(journal, 1);
+    journal.append(put(1));
+    journal.beginRollover(2);
+
+    // The next journal cannot be opened while its path is taken by a directory
+    const QString nextPath = VaultJournal::nextPathFor(vaultPath());
+    const QString movedPath = nextPath + ".moved";
+    QVERIFY(QFile::rename(nextPath, movedPath));
+    QVERIFY(QDir().mkdir(nextPath));
+    journal.append(put(2));
+    QVERIFY_THROWS_EXCEPTION(FileUtils::FileOperationError, journal.catchUpRollover());
+
+    // Once it is back, with a torn tail, the missed record is written ahead of the next one
+    QVERIFY(QDir().rmdir(nextPath));
+    QVERIFY(QFile::rename(movedPath, nextPath));
+    appendGarbage(nextPath);
+    journal.append(put(3));
+    journal.catchUpRollover();
+
+    QCOMPARE(replayedIds(VaultJournal::read(vaultPath(), 1, m_rootKey)), (QList<EntryId>{1, 2, 3}));
+    QCOMPARE(replayedIds(VaultJournal::read(vaultPath(), 2, m_rootKey)), (QList<EntryId>{2, 3}));
+
+    journal.commitRollover();
+    journal.append(put(4));
+    QCOMPARE(replayedIds(VaultJournal::read(vaultPath(), 2, m_rootKey)), (QList<EntryId>{2, 3, 4}));
+  }
+};
+
+QTEST_GUILESS_MAIN(VaultJournalTest)
+#include "vaultjournal_test.moc"